@@ -41,19 +41,109 @@ import socket
 import json
 import errno
 import os
+import select
 import shlex
 import subprocess
 import base64
+import struct
+import tempfile
+import uuid
+import zlib
 from collections import defaultdict
+from contextlib import contextmanager
 import logging
+import mmap
 
 from funq.aliases import HooqAliases
-from funq.tools import wait_for
-from funq.models import Action, Widget
+from funq.tools import wait_for, apply_snooze_factor
+from funq.models import Action, Object, Widget
 from funq.errors import FunqError, TimeOutError
 
 LOG = logging.getLogger('funq.client')
 
+# binary framing header: payload size, frame type, flags, reserved
+FRAME_HEADER = struct.Struct('>IBBH')
+FRAME_MESSAGE = 0
+FRAME_ATTACHMENT = 1
+FRAME_FLAG_COMPRESSED = 0x01
+
+# shared memory header: sequence of the end of the last allocated block
+SHM_HEADER = struct.Struct('=q')
+
+
+def _read_exactly(f, size):
+    """
+    Read *size* bytes from *f*, or raise a FunqError if the connection
+    is closed before.
+    """
+    data = f.read(size)
+    if len(data) != size:
+        raise FunqError("NoResponseFromApplication",
+                        "Pas de réponse de l'application testée -"
+                        " probablement un crash.")
+    return data
+
+
+def read_message(f, binary_framing=False):
+    """
+    Read a message sent by a libFunq server from the file object *f* and
+    returns it decoded.
+
+    With the binary framing, the attachments sent before the message are
+    stored as a list of bytes under the '_attachments' key.
+    """
+    if not binary_framing:
+        header = f.readline()
+        if not header:
+            raise FunqError("NoResponseFromApplication",
+                            "Pas de réponse de l'application testée -"
+                            " probablement un crash.")
+        return json.loads(_read_exactly(f, int(header)).decode('utf-8'))
+    attachments = []
+    while True:
+        size, frame_type, flags, _ = FRAME_HEADER.unpack(
+            _read_exactly(f, FRAME_HEADER.size))
+        payload = _read_exactly(f, size)
+        if flags & FRAME_FLAG_COMPRESSED:
+            # qCompress format: uncompressed size (4 bytes), then zlib data
+            payload = zlib.decompress(payload[4:])
+        if frame_type == FRAME_ATTACHMENT:
+            attachments.append(payload)
+        elif frame_type == FRAME_MESSAGE:
+            break
+    response = json.loads(payload.decode('utf-8'))
+    if attachments:
+        response['_attachments'] = attachments
+    return response
+
+
+def merge_partial_response(response, partial):
+    """
+    Merge a part of a streamed response in *response*: lists are
+    concatenated, objects are merged and other values are replaced.
+    """
+    for key, value in partial.items():
+        if isinstance(value, list) and isinstance(response.get(key), list):
+            response[key].extend(value)
+        elif isinstance(value, dict) and isinstance(response.get(key), dict):
+            response[key].update(value)
+        else:
+            response[key] = value
+    return response
+
+
+# python types accepted for each type of the command schemas
+_SCHEMA_TYPES = {
+    'int': (int,),
+    'oid': (int,),
+    'number': (int, float),
+    'bool': (bool,),
+    'string': (str,),
+    'object': (dict,),
+    'list': (list, tuple),
+    'any': (object,),
+}
+
 
 class FunqClient(object):
 
@@ -61,12 +151,21 @@ class FunqClient(object):
     Allow to communicate with a libFunq server.
 
     This is the main class used to manipulate tested application.
+
+    When *socket_path* is given, the connection is made on the unix domain
+    socket of a libFunq server started with FUNQ_SOCKET, instead of
+    *host* and *port*.
+
+    When *shared_memory* is True, bulk data (screenshots, big dumps) is
+    transferred through a memory mapped file. This requires the tested
+    application to run on the same machine.
     """
     DEFAULT_HOST = 'localhost'
     DEFAULT_PORT = 9999
 
     def __init__(self, host=None, port=None, aliases=None,
-                 timeout_connection=10):
+                 timeout_connection=10, binary_framing=False,
+                 compression=None, socket_path=None, shared_memory=False):
         if host is None:
             host = self.DEFAULT_HOST
         if port is None:
@@ -81,22 +180,46 @@ class FunqClient(object):
                             " instance of HooqAliases")
 
         self.aliases = aliases
+        # (name, mmap) of the shared memory file
+        self._shm = None
 
         def connect():
             """ try to connect """
             try:
-                self._socket = socket.socket(socket.AF_INET,
-                                             socket.SOCK_STREAM)
-                self._socket.connect((host, port))
+                if socket_path:
+                    self._socket = socket.socket(socket.AF_UNIX,
+                                                 socket.SOCK_STREAM)
+                    self._socket.connect(socket_path)
+                else:
+                    self._socket = socket.socket(socket.AF_INET,
+                                                 socket.SOCK_STREAM)
+                    self._socket.connect((host, port))
                 return True
             except socket.error as e:
-                if e.errno != errno.ECONNREFUSED:
+                # the local socket file may not be created yet
+                if e.errno not in (errno.ECONNREFUSED, errno.ENOENT):
                     raise
                 return e
 
         wait_for(connect, timeout_connection, 0.2)
         self._socket.settimeout(timeout_connection)
         self._fsocket = self._socket.makefile(mode="rwb")
+        self._binary_framing = False
+        self._next_id = 0
+        # answers to pipelined requests, by request id
+        self._responses = {}
+        self._compression = None
+        self._shared_memory = False
+        self._schemas = None
+        options = {}
+        if binary_framing or compression:
+            options['framing'] = 'binary'
+        if compression:
+            options['compression'] = compression
+        if shared_memory:
+            options['bulk'] = 'shm'
+        if options:
+            self.negotiate(**options)
 
     def duplicate(self):
         """
@@ -109,8 +232,17 @@ class FunqClient(object):
           # `client_copy` may be used in concurrence with `client`.
           client_copy = client.duplicate()
         """
-        host, port = self._socket.getpeername()
-        return FunqClient(host=host, port=port, aliases=self.aliases)
+        if self._socket.family == getattr(socket, 'AF_UNIX', None):
+            host, port = None, None
+            socket_path = self._socket.getpeername()
+        else:
+            host, port = self._socket.getpeername()[:2]
+            socket_path = None
+        return FunqClient(host=host, port=port, aliases=self.aliases,
+                          socket_path=socket_path,
+                          binary_framing=self._binary_framing,
+                          compression=self._compression,
+                          shared_memory=self._shared_memory)
 
     def close(self):
         """
@@ -120,21 +252,154 @@ class FunqClient(object):
         method is automatically called on the object destruction.
         """
         self._socket.close()
+        self._close_shm()
+
+    def _close_shm(self):
+        """
+        Unmap the shared memory file.
+        """
+        if self._shm is not None:
+            self._shm[1].close()
+            self._shm = None
+
+    def _read_shm(self, descriptor):
+        """
+        Returns a copy of the bytes of a shared memory block. This must be
+        done before the block is reused by the libFunq server.
+
+        :raises: :class:`funq.errors.FunqError` (SharedMemoryOverwritten) if
+                 the block was reused before being read
+        """
+        if self._shm is None or self._shm[0] != descriptor['name']:
+            self._close_shm()
+            with open(descriptor['name'], 'rb') as f:
+                self._shm = (descriptor['name'],
+                             mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ))
+        shm = self._shm[1]
+        offset = descriptor['offset']
+        data = shm[offset:offset + descriptor['size']]
+        if 'sequence' in descriptor:
+            # the ring size is the file size
+            end = SHM_HEADER.unpack_from(shm, 0)[0]
+            if end - descriptor['sequence'] > len(shm):
+                raise FunqError("SharedMemoryOverwritten",
+                                "The shared memory block at offset %d was"
+                                " reused before being read" % offset)
+        return data
+
+    def _resolve_shm(self, response):
+        """
+        Read the shared memory blocks referenced by a response: the whole
+        response under the '_shm' key, and binary data under '*_shm' keys
+        which become attachments.
+        """
+        if '_shm' in response:
+            request_id = response.get('id')
+            response = json.loads(
+                self._read_shm(response['_shm']).decode('utf-8'))
+            if request_id is not None:
+                response['id'] = request_id
+        for key in [k for k in response if k.endswith('_shm') and k != '_shm']:
+            attachments = response.setdefault('_attachments', [])
+            response[key[:-4] + '_attachment'] = len(attachments)
+            attachments.append(self._read_shm(response.pop(key)))
+        return response
 
     def __del__(self):
         self.close()
 
     def _raw_send(self, action, kwargs):
         """
-        Send a message without waiting for an answer.
+        Send a message without waiting for an answer. Returns the id of
+        the request.
         """
+        self._next_id += 1
         kwargs['action'] = action
+        kwargs['id'] = self._next_id
         rawdata = json.dumps(kwargs).encode('utf-8')
-        header = '{}\n'.format(len(rawdata)).encode('utf-8')
+        if self._binary_framing:
+            header = FRAME_HEADER.pack(len(rawdata), FRAME_MESSAGE, 0, 0)
+        else:
+            header = '{}\n'.format(len(rawdata)).encode('utf-8')
         message = header + rawdata
         f = self._fsocket
         f.write(message)
         f.flush()
+        return kwargs['id']
+
+    def _receive_message(self):
+        """
+        Read one message and keep it with the messages of its request.
+        """
+        response = read_message(self._fsocket, self._binary_framing)
+        if self._shared_memory:
+            response = self._resolve_shm(response)
+        if 'id' not in response and response.get('success') is False:
+            # error not related to a request, like FrameTooLarge
+            raise FunqError(response["errName"], response["errDesc"])
+        self._responses.setdefault(response.pop('id', None),
+                                   []).append(response)
+
+    def _pending_data(self, timeout=0):
+        """
+        Returns True if data sent by the server can be read, waiting at
+        most *timeout* seconds for it.
+        """
+        previous_timeout = self._socket.gettimeout()
+        self._socket.settimeout(0.0)
+        try:
+            # data may already be buffered by the socket file
+            pending = bool(self._fsocket.peek(1))
+        except socket.error:
+            pending = False
+        finally:
+            self._socket.settimeout(previous_timeout)
+        if not pending and timeout > 0:
+            pending = bool(select.select([self._socket], [], [], timeout)[0])
+        return pending
+
+    def _read_available(self, timeout=0):
+        """
+        Read the messages already sent by the server, waiting at most
+        *timeout* seconds for the first one.
+        """
+        while self._pending_data(timeout):
+            self._receive_message()
+            timeout = 0
+
+    def _read_message(self, request_id):
+        """
+        Read messages until a message for the request *request_id* is
+        received. Messages for other requests in flight are kept.
+        """
+        while not self._responses.get(request_id):
+            self._receive_message()
+        messages = self._responses[request_id]
+        message = messages.pop(0)
+        if not messages:
+            del self._responses[request_id]
+        return message
+
+    def _iter_response(self, request_id):
+        """
+        Yields the parts of the answer to the request *request_id*, the
+        last one being the final response.
+        """
+        while True:
+            message = self._read_message(request_id)
+            partial = message.pop('partial', False)
+            yield message
+            if not partial:
+                return
+
+    def _read_response(self, request_id):
+        """
+        Returns the whole answer to the request *request_id*.
+        """
+        response = {}
+        for message in self._iter_response(request_id):
+            merge_partial_response(response, message)
+        return response
 
     def send_command(self, action, **kwargs):
         """
@@ -143,25 +408,272 @@ class FunqClient(object):
 
         :raises: :class:`funq.errors.FunqError` on error
         """
-        self._raw_send(action, kwargs)
-        f = self._fsocket
-        header = f.readline()
-        if not header:
-            raise FunqError("NoResponseFromApplication",
-                            "Pas de réponse de l'application testée -"
-                            " probablement un crash.")
-        to_read = int(header)
-        response = json.loads(f.read(to_read).decode('utf-8'))
+        response = self._read_response(self._raw_send(action, kwargs))
         if response.get('success') is False:
             raise FunqError(response["errName"], response["errDesc"])
         return response
 
+    def iter_command(self, action, **kwargs):
+        """
+        Send a message to the libFunq server and yields the parts of the
+        answer as they are received. With commands like **model_items**,
+        the size of the parts is given with the *chunk_size* argument.
+
+        Example::
+
+          for part in client.iter_command('model_items', oid=model.oid,
+                                          chunk_size=1000):
+              process(part['items'])
+
+        :raises: :class:`funq.errors.FunqError` on error
+        """
+        for response in self._iter_response(self._raw_send(action, kwargs)):
+            if response.get('success') is False:
+                raise FunqError(response["errName"], response["errDesc"])
+            yield response
+
+    def send_commands(self, commands):
+        """
+        Send many commands without waiting for each answer, then returns
+        the decoded answers in the same order. This saves a round-trip per
+        command.
+
+        Example::
+
+          props, items = client.send_commands([
+              ('object_properties', {'oid': widget.oid}),
+              ('model_items', {'oid': model.oid}),
+          ])
+
+        :param commands: list of (action, arguments dict) tuples
+        :raises: :class:`funq.errors.FunqError` for the first command
+                 in error, once every answer is received
+        """
+        ids = [self._raw_send(action, dict(kwargs))
+               for action, kwargs in commands]
+        responses = [self._read_response(i) for i in ids]
+        for response in responses:
+            if response.get('success') is False:
+                raise FunqError(response["errName"], response["errDesc"])
+        return responses
+
+    def batch(self, commands, stop_on_error=True):
+        """
+        Execute many commands in one round-trip, in order, and returns
+        their results. A string argument like '$0.oid' is replaced by the
+        value under the 'oid' key of the result of the first command
+        ('$$' escapes a leading '$').
+
+        Example::
+
+          path, props = client.batch([
+              ('widget_by_path', {'path': 'mainWindow::label'}),
+              ('object_properties', {'oid': '$0.oid'}),
+          ])
+
+        Commands waiting for the event loop (like `wait_for_object` or
+        `shortcut`) can not be used in a batch; `widgets_list` and
+        `model_items` are run at once, their chunks merged.
+
+        :param commands: list of (action, arguments dict) tuples
+        :param stop_on_error: if True, stop at the first command in error
+                              and raise a :class:`funq.errors.FunqError`.
+                              Else the errors are returned as results.
+        """
+        steps = [dict(kwargs, action=action) for action, kwargs in commands]
+        response = self.send_command('batch', commands=steps,
+                                     stop_on_error=stop_on_error)
+        results = response['results']
+        for result in results:
+            # binary data of every step is attached to the batch response
+            if '_attachments' in response:
+                result['_attachments'] = response['_attachments']
+            if self._shared_memory:
+                self._resolve_shm(result)
+            if stop_on_error and result.get('success') is False:
+                raise FunqError(result["errName"], result["errDesc"])
+        return results
+
+    def command_schemas(self):
+        """
+        Returns the arguments expected by the server commands declaring
+        them, as a dict {action: [{'name', 'type', 'required'
+        [, 'default']}]}. Fetched once, then cached.
+        """
+        if self._schemas is None:
+            response = self.send_command('list_actions')
+            self._schemas = response.get('schemas', {})
+        return self._schemas
+
+    def check_command(self, action, **kwargs):
+        """
+        Check the arguments of a command against its schema (see
+        :meth:`command_schemas`) without sending it. Commands without
+        schema are not checked, and None is handled like a missing
+        argument.
+
+        :raises: :class:`funq.errors.FunqError` (MissingArgument or
+                 InvalidArgument), like the server would.
+        """
+        for field in self.command_schemas().get(action, []):
+            name = field['name']
+            value = kwargs.get(name)
+            if value is None:
+                if field['required']:
+                    raise FunqError("MissingArgument",
+                                    "Missing argument `%s`" % name)
+                continue
+            expected = _SCHEMA_TYPES.get(field['type'], object)
+            if isinstance(value, bool) and bool not in expected:
+                valid = False
+            elif isinstance(value, float) and float not in expected:
+                # like the server, integral numbers are accepted as int
+                valid = (int in expected and value.is_integer())
+            else:
+                valid = isinstance(value, expected)
+            if not valid:
+                raise FunqError("InvalidArgument",
+                                "Argument `%s`: expected %s"
+                                % (name, field['type']))
+
+    def negotiate(self, framing=None,  # pylint: disable=R0913
+                  compression=None, compression_threshold=None,
+                  compression_level=None, bulk=None, bulk_size=None,
+                  bulk_threshold=None):
+        """
+        Negotiate the protocol options of the connection with the libFunq
+        server, and returns the options in use.
+
+        :param framing: 'binary' to use a binary framing, allowing binary
+                        data (like screenshots) to be sent without base64
+                        encoding. 'text' is the default framing.
+        :param compression: 'zlib' to compress the big responses (requires
+                            the binary framing), or 'none'.
+        :param compression_threshold: minimum size in bytes of a compressed
+                                      response.
+        :param compression_level: zlib compression level, from 1 (fastest)
+                                  to 9 (smallest).
+        :param bulk: 'shm' to transfer bulk data through a memory mapped
+                     file (the tested application must run on the same
+                     machine), or 'none'.
+        :param bulk_size: size in bytes of the memory mapped file.
+        :param bulk_threshold: minimum size in bytes of a response
+                               transferred through the memory mapped file.
+        """
+        options = dict(framing=framing,
+                       compression=compression,
+                       compression_threshold=compression_threshold,
+                       compression_level=compression_level,
+                       bulk=bulk,
+                       bulk_size=bulk_size,
+                       bulk_threshold=bulk_threshold)
+        options = dict((k, v) for k, v in options.items() if v is not None)
+        # the answer is sent with the previous options
+        response = self.send_command('negotiate', **options)
+        self._binary_framing = response['framing'] == 'binary'
+        if response.get('compression', 'none') != 'none':
+            self._compression = response['compression']
+        else:
+            self._compression = None
+        self._shared_memory = response.get('bulk') == 'shm'
+        if not self._shared_memory:
+            self._close_shm()
+        return response
+
+    @staticmethod
+    def binary_data(response, key='data'):
+        """
+        Returns the binary data stored under *key* in a response, either as
+        a raw attachment (possibly read from the shared memory) or base64
+        encoded.
+        """
+        if key + '_attachment' in response:
+            return response['_attachments'][response[key + '_attachment']]
+        return base64.standard_b64decode(response[key])
+
     def quit(self):
         """
         Ask the tested application to quit by calling qApp->exit().
         """
         self._raw_send('quit', {})
 
+    def release(self, *objects):
+        """
+        Release the server references of objects (or object ids) that are
+        not used anymore, and returns the number of released references.
+        Using a released object raises a NotRegisteredObject error.
+        """
+        oids = [getattr(obj, 'oid', obj) for obj in objects]
+        return self.send_command('release', oids=oids)['released']
+
+    def release_all(self):
+        """
+        Release the server references of every object.
+        """
+        return self.send_command('release_all')['released']
+
+    @contextmanager
+    def handle_scope(self):
+        """
+        Context manager releasing the server references of the objects
+        found inside the block when leaving it::
+
+          with client.handle_scope():
+              client.widget('btnOk').click()
+        """
+        scope = self.send_command('scope_begin')['scope']
+        try:
+            yield scope
+        finally:
+            self.send_command('scope_end', scope=scope)
+
+    def registry_stats(self):
+        """
+        Returns statistics about the server references of objects, as a
+        dict (count, capacity, destroyed, open_scopes, max_handles,
+        released, evicted, collected).
+        """
+        response = self.send_command('registry_stats')
+        return dict((k, v) for k, v in response.items() if k != 'id')
+
+    def _wait_for_object(self, path, timeout, timeout_interval):
+        """
+        Returns the description of the object at *path*, waiting at most
+        *timeout* seconds for it. The server answers as soon as the object
+        exists; servers without the **wait_for_object** command are polled
+        every *timeout_interval* seconds instead.
+
+        :raises: :class:`funq.errors.FunqError` (InvalidWidgetPath) on
+                 timeout
+        """
+        server_timeout = apply_snooze_factor(timeout)
+        previous_timeout = self._socket.gettimeout()
+        if previous_timeout is not None:
+            # the answer may come server_timeout seconds later
+            self._socket.settimeout(previous_timeout + server_timeout)
+        try:
+            return self.send_command('wait_for_object', path=path,
+                                     timeout=server_timeout)
+        except FunqError as err:
+            if err.classname != 'UnknownAction':
+                raise
+        finally:
+            self._socket.settimeout(previous_timeout)
+
+        data = [None]
+
+        def get_object():
+            """ Try to get the object """
+            try:
+                data[0] = self.send_command('widget_by_path', path=path)
+                return True
+            except FunqError as err:
+                if err.classname != 'InvalidWidgetPath':
+                    raise
+                return err
+        wait_for(get_object, timeout, timeout_interval)
+        return data[0]
+
     def action(self, alias=None, path=None, timeout=10.0,
                timeout_interval=0.1, wait_active=True):
         """
@@ -177,7 +689,8 @@ class FunqClient(object):
         :param timeout: if > 0, tries to get the action until timeout
                         is reached (second)
         :param timeout_interval: time between two atempts to get an action
-                                 (seconds)
+                                 (seconds), with servers not supporting
+                                 the wait_for_object command
         :param wait_active: If true - the default -, wait until the action
                             become visible and enabled.
         """
@@ -187,20 +700,9 @@ class FunqClient(object):
         if alias:
             path = self.aliases[alias]
 
-        wdata = [None]
-
-        def get_action():
-            """ Try to get the action """
-            try:
-                wdata[0] = self.send_command('widget_by_path', path=path)
-                return True
-            except FunqError as err:
-                if err.classname != 'InvalidWidgetPath':
-                    raise
-                return err
-        wait_for(get_action, timeout, timeout_interval)
+        data = self._wait_for_object(path, timeout, timeout_interval)
 
-        action = Action.create(self, wdata[0])
+        action = Action.create(self, data)
         if wait_active:
             action.wait_for_properties({'enabled': True, 'visible': True})
         return action
@@ -220,7 +722,8 @@ class FunqClient(object):
         :param timeout: if > 0, tries to get the widget until timeout
                         is reached (second)
         :param timeout_interval: time between two atempts to get a widget
-                                 (seconds)
+                                 (seconds), with servers not supporting
+                                 the wait_for_object command
         :param wait_active: If true - the default -, wait until the widget
                             become visible and enabled.
         """
@@ -230,22 +733,11 @@ class FunqClient(object):
         if alias:
             path = self.aliases[alias]
 
-        wdata = [None]
+        data = self._wait_for_object(path, timeout, timeout_interval)
 
-        def get_widget():
-            """ Try to get the widget """
-            try:
-                wdata[0] = self.send_command('widget_by_path', path=path)
-                return True
-            except FunqError as err:
-                if err.classname != 'InvalidWidgetPath':
-                    raise
-                return err
-        wait_for(get_widget, timeout, timeout_interval)
-
-        widget = Widget.create(self, wdata[0])
+        widget = Widget.create(self, data)
         if wait_active:
-            if 'QWindow' in wdata[0]['classes']:
+            if 'QWindow' in data['classes']:
                 # QWindow (Qt5) does not have the enabled property
                 props = {'active': True, 'visible': True}
             else:
@@ -253,6 +745,37 @@ class FunqClient(object):
             widget.wait_for_properties(props)
         return widget
 
+    def find_objects(self, selector, root=None, limit=None):
+        """
+        Returns the objects matching a selector, as a list of
+        :class:`funq.models.Widget` or derived for widgets, else
+        :class:`funq.models.Object`, in tree order (depth first, children
+        in their order).
+
+        Example::
+
+          apply = client.find_objects(
+              'QDialog QPushButton[text=Apply]:visible')[0]
+
+        A selector is a list of compound selectors separated by spaces,
+        each one matching a descendant of an object matched by the previous
+        one. A compound selector is made of a class name (superclasses
+        included, or `*`), a `#` objectName glob, property predicates
+        `[name=value]` (values compared as strings) and `:visible`, each
+        part being optional.
+
+        :param selector: the selector
+        :param root: if given, only the descendants of this object (or
+                     object id) are returned
+        :param limit: maximum number of returned objects
+        """
+        kwargs = {'selector': selector, 'limit': limit}
+        if root is not None:
+            kwargs['oid'] = getattr(root, 'oid', root)
+        response = self.send_command('find_objects', **kwargs)
+        return [(Widget if 'QWidget' in data['classes'] else Object)
+                .create(self, data) for data in response['objects']]
+
     def active_widget(self, widget_type='window', timeout=10.0,
                       timeout_interval=0.1, wait_active=True):
         """
@@ -303,23 +826,127 @@ class FunqClient(object):
             widget.wait_for_properties(props)
         return widget
 
-    def widgets_list(self, with_properties=False):
+    def widgets_list(self, with_properties=False,  # pylint: disable=R0913
+                     properties=None, max_depth=None, visible_only=False,
+                     classes=None, class_table=False, hashes=False):
         """
         Returns a dict with every widgets in the application.
+
+        :param with_properties: if True, dump the properties of the widgets
+        :param properties: list of the property names to dump (implies
+                           with_properties)
+        :param max_depth: if given, maximum depth of the dumped widgets (1
+                          for the top-level widgets only)
+        :param visible_only: if True, hidden widgets and their children are
+                             not dumped
+        :param classes: list of class names; only the widgets inheriting one
+                        of them are dumped, the other ones being kept (with
+                        their path only) when they contain dumped widgets
+        :param class_table: if True, each widget has a 'class' index in the
+                            list of class lists under the '_class_table' key,
+                            instead of a 'classes' list
+        :param hashes: if True, each widget has a 'hash' of its name, class,
+                       dumped properties and children hashes (see
+                       :meth:`tree_hash`)
         """
+        options = dict(properties=properties, max_depth=max_depth,
+                       visible_only=visible_only, classes=classes,
+                       class_table=class_table, hashes=hashes)
+        options = dict((k, v) for k, v in options.items() if v is not None)
         return self.send_command('widgets_list',
-                                 with_properties=with_properties)
+                                 with_properties=with_properties, **options)
+
+    def tree_hash(self, root=None, **kwargs):
+        """
+        Returns the hashes of a widgets tree, as a dict {'hash': hash,
+        'children': {name: {'hash': hash, 'children': {...}}}}. The hash of
+        a widget covers its name, class, selected properties and the hashes
+        of its children, so a subtree whose hash did not change does not
+        need to be fetched again.
+
+        Example::
+
+          before = client.tree_hash(dialog, properties=['text'])
+          # ...
+          if client.tree_hash(dialog, properties=['text']) != before:
+              refresh()
+
+        :param root: if given, hash the children of this object (or object
+                     id) instead of the top-level widgets
+        :param kwargs: options of :meth:`widgets_list` selecting the hashed
+                       widgets and properties
+        """
+        if root is not None:
+            kwargs['oid'] = getattr(root, 'oid', root)
+        response = self.send_command('tree_hash', **kwargs)
+        return {'hash': response['hash'], 'children': response['children']}
+
+    def subscribe_tree(self, interval=None):
+        """
+        Returns a :class:`TreeSubscription` receiving the changes of the
+        widgets tree as they happen.
+
+        :param interval: minimum time in milliseconds between two sets of
+                         changes sent by the server (50 by default)
+        """
+        kwargs = {}
+        if interval is not None:
+            kwargs['interval'] = interval
+        return TreeSubscription(self, self._raw_send('subscribe_tree',
+                                                     kwargs))
+
+    def widgets_mirror(self, **kwargs):
+        """
+        Returns a :class:`WidgetsMirror`, a copy of :meth:`widgets_list`
+        kept up to date. The keyword arguments are the options of
+        :meth:`widgets_list` (except *class_table*).
+        """
+        return WidgetsMirror(self, **kwargs)
 
     def dump_widgets_list(self, stream='widgets_list.json',
-                          with_properties=False):
+                          with_properties=False, **kwargs):
         """
-        Write in a file the result of :meth:`widgets_list`.
+        Write in a file the result of :meth:`widgets_list`, the keyword
+        arguments being given to it.
         """
         if isinstance(stream, str):
             stream = open(stream, 'w')
-        json.dump(self.widgets_list(with_properties=with_properties),
+        json.dump(self.widgets_list(with_properties=with_properties,
+                                    **kwargs),
                   stream, sort_keys=True, indent=4, separators=(',', ': '))
 
+    def eval_script(self, script, **args):
+        """
+        Run a javascript snippet in the tested application and returns
+        its result. The snippet is the body of a function receiving the
+        keyword arguments as *args*, and may use the **funq** object:
+
+        - funq.find(path): oid of the object at path, or null
+        - funq.properties(oid): properties of an object
+        - funq.call(action, args): result of a libFunq command, with the
+          restrictions of :meth:`batch`
+        - funq.rowCount(oid), funq.columnCount(oid) and
+          funq.data(oid, row, column, role): top level items of a model
+          or of the model of a view ('display', 'edit', 'checkState'...)
+
+        Example::
+
+          checked = self.funq.eval_script('''
+              var oid = funq.find(args.path);
+              for (var row = 0; row < funq.rowCount(oid); ++row) {
+                  if (funq.data(oid, row, 2) == args.text) {
+                      return funq.data(oid, row, 2, 'checkState') == 2;
+                  }
+              }
+              return false;
+          ''', path='mainWindow::table', text='Item 3')
+
+        Requires libFunq compiled with Qt Qml. With Qt >= 5.14, a script
+        running more than 10 seconds is interrupted (ScriptTimeout error).
+        """
+        return self.send_command('eval_script', script=script,
+                                 args=args).get('result')
+
     def take_screenshot(self, stream='screenshot.png', format_='PNG'):
         """
         Take a screenshot of the active desktop.
@@ -327,7 +954,7 @@ class FunqClient(object):
         data = self.send_command('grab', format=format_)
         if isinstance(stream, str):
             stream = open(stream, 'wb')
-        raw = base64.standard_b64decode(data['data'])
+        raw = self.binary_data(data)
         stream.write(raw)  # pylint: disable=E1103
 
     def keyclick(self, text):
@@ -337,7 +964,7 @@ class FunqClient(object):
         """
         self.send_command('widget_keyclick', text=text)
 
-    def shortcut(self, key_sequence):
+    def shortcut(self, key_sequence, timeout=None):
         """
         Send a shortcut defined with a text sequence. The format of this
         text sequence is defined with QKeySequence::fromString (see QT
@@ -347,11 +974,14 @@ class FunqClient(object):
 
           client.shortcut('F2')
 
+        :param timeout: maximum time in seconds for the server to send the
+                        shortcut, None for the server default (20 seconds)
         """
-        self.send_command('shortcut', keysequence=key_sequence)
+        self.send_command('shortcut', keysequence=key_sequence,
+                          timeout=timeout)
 
-    def drag_n_drop(self, src_widget, src_pos=None,
-                    dest_widget=None, dest_pos=None):
+    def drag_n_drop(self, src_widget, src_pos=None,  # pylint: disable=R0913
+                    dest_widget=None, dest_pos=None, timeout=None):
         """
         Do a drag and drop.
 
@@ -364,6 +994,8 @@ class FunqClient(object):
         :param dest_pos: ending position for the drop. If None, the center
                          of `dest_widget` will be used, else it must be a
                          tuple (x, y) in widget coordinates.
+        :param timeout: maximum time in seconds for the drag and drop, None
+                        for the server default (20 seconds)
         """
         if dest_widget is None:
             dest_widget = src_widget
@@ -375,7 +1007,196 @@ class FunqClient(object):
                           srcoid=src_widget.oid,
                           destoid=dest_widget.oid,
                           srcpos=src_pos,
-                          destpos=dest_pos)
+                          destpos=dest_pos,
+                          timeout=timeout)
+
+
+class TreeSubscription(object):
+
+    """
+    Changes of the widgets tree pushed by the libFunq server, returned by
+    :meth:`FunqClient.subscribe_tree`.
+
+    Each change is a dict with a sequence number 'seq', an 'event' and
+    the 'path' of the changed widget:
+
+    - 'children': children added, removed, renamed or restacked
+    - 'shown' or 'hidden': the widget (and its children) were shown or
+      hidden
+    - 'roots': the top-level widgets may have changed (no path)
+    - 'reset': changes were lost, everything may have changed (no path)
+
+    Example::
+
+      with client.subscribe_tree() as subscription:
+          client.widget('btnOpen').click()
+          for change in subscription.changes(timeout=1):
+              print(change['event'], change.get('path'))
+    """
+
+    def __init__(self, funq, request_id):
+        self._funq = funq
+        self._request_id = request_id
+        self.closed = False
+        self.token = None
+        #: sequence number of the last change received
+        self.seq = 0
+        self._read_part()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def _read_part(self):
+        """
+        Read the next part of the subscription response and returns its
+        changes.
+        """
+        message = self._funq._read_message(self._request_id)
+        if message.get('success') is False:
+            self.closed = True
+            raise FunqError(message["errName"], message["errDesc"])
+        if not message.pop('partial', False):
+            self.closed = True
+        self.token = message.get('subscription', self.token)
+        self.seq = message['seq']
+        return message['changes']
+
+    def changes(self, timeout=0):
+        """
+        Returns the list of the changes received since the last call,
+        waiting at most *timeout* seconds if there are none yet.
+        """
+        funq = self._funq
+        if not self.closed:
+            pending = funq._responses.get(self._request_id)
+            funq._read_available(0 if pending else timeout)
+        changes = []
+        while not self.closed and funq._responses.get(self._request_id):
+            changes.extend(self._read_part())
+        return changes
+
+    def close(self):
+        """
+        End the subscription, and returns the changes not read yet.
+        """
+        changes = self.changes()
+        if self.closed:
+            return changes
+        self._funq.send_command('unsubscribe_tree', subscription=self.token)
+        while not self.closed:
+            changes.extend(self._read_part())
+        return changes
+
+
+class WidgetsMirror(object):
+
+    """
+    Copy of the widgets tree (see :meth:`FunqClient.widgets_list`) kept up
+    to date with a :class:`TreeSubscription`: only the widgets whose
+    children changed are listed again.
+
+    Example::
+
+      mirror = client.widgets_mirror(properties=['text'])
+      client.widget('btnOpen').click()
+      mirror.update(timeout=1)
+      assert 'MainWindow::Dialog' in mirror
+    """
+
+    def __init__(self, funq, **kwargs):
+        self._funq = funq
+        self._options = kwargs
+        #: the widgets tree, like the result of widgets_list
+        self.tree = {}
+        self._nodes = {}
+        self.subscription = funq.subscribe_tree()
+        self._snapshot()
+
+    def __contains__(self, path):
+        return path in self._nodes
+
+    def get(self, path, default=None):
+        """
+        Returns the node of the widget at *path*, a dict like the values
+        of :meth:`FunqClient.widgets_list`.
+        """
+        return self._nodes.get(path, default)
+
+    def _snapshot(self):
+        """
+        List every widget again.
+        """
+        self.tree = self._funq.send_command('widgets_list', **self._options)
+        self._nodes = {}
+        self._index(self.tree)
+
+    def _index(self, children):
+        for node in children.values():
+            if isinstance(node, dict) and 'path' in node:
+                self._nodes[node['path']] = node
+                self._index(node.get('children', {}))
+
+    def _unindex(self, children):
+        for node in children.values():
+            if isinstance(node, dict) and 'path' in node:
+                self._nodes.pop(node['path'], None)
+                self._unindex(node.get('children', {}))
+
+    def _refresh(self, node):
+        """
+        List the children of a widget again.
+        """
+        try:
+            oid = self._funq.send_command('widget_by_path',
+                                          path=node['path'])['oid']
+        except FunqError:
+            # destroyed, its parent changed too
+            return
+        try:
+            children = self._funq.send_command('widgets_list', oid=oid,
+                                               **self._options)
+        finally:
+            self._funq.release(oid)
+        self._unindex(node.get('children', {}))
+        node['children'] = children
+        self._index(children)
+
+    def update(self, timeout=0):
+        """
+        Apply the changes received since the last call, waiting at most
+        *timeout* seconds if there are none yet, and returns them.
+        """
+        changes = self.subscription.changes(timeout)
+        events = set(change['event'] for change in changes)
+        if 'reset' in events or 'roots' in events:
+            self._snapshot()
+            return changes
+        paths = set()
+        for change in changes:
+            if change['event'] == 'children':
+                paths.add(change['path'])
+            elif self._options.get('visible_only') and '::' in change['path']:
+                # hidden widgets are not listed by their parent
+                paths.add(change['path'].rsplit('::', 1)[0])
+        refreshed = []
+        # parents first, their subtree being listed again as a whole
+        for path in sorted(paths):
+            if any(path.startswith(parent + '::') for parent in refreshed):
+                continue
+            node = self._nodes.get(path)
+            if node is not None:
+                self._refresh(node)
+                refreshed.append(path)
+        return changes
+
+    def close(self):
+        """
+        End the subscription; the mirror is not updated anymore.
+        """
+        self.subscription.close()
 
 
 class ApplicationContext(object):  # pylint: disable=R0903
@@ -407,7 +1228,11 @@ class ApplicationContext(object):  # pylint: disable=R0903
             host=host,
             port=appconfig.funq_port,
             aliases=appconfig.create_aliases(),
-            timeout_connection=appconfig.timeout_connection
+            timeout_connection=appconfig.timeout_connection,
+            binary_framing=appconfig.binary_framing,
+            compression=appconfig.compression,
+            socket_path=appconfig.funq_socket,
+            shared_memory=appconfig.shared_memory
         )
 
     def _start_test_process(self, appconfig):
@@ -418,6 +1243,7 @@ class ApplicationContext(object):  # pylint: disable=R0903
         env = appconfig.env
         cmd = []
         funq_port = appconfig.funq_port
+        funq_socket = appconfig.funq_socket
 
         stdout = appconfig.executable_stdout
         stderr = appconfig.executable_stderr
@@ -441,6 +1267,8 @@ class ApplicationContext(object):  # pylint: disable=R0903
             env['FUNQ_ACTIVATION'] = '1'
             if funq_port:
                 env['FUNQ_PORT'] = str(funq_port)
+            if funq_socket:
+                env['FUNQ_SOCKET'] = funq_socket
 
         else:
             # inject libFunq with funq executable
@@ -452,6 +1280,9 @@ class ApplicationContext(object):  # pylint: disable=R0903
             if funq_port:
                 cmd.append('--port')
                 cmd.append(str(funq_port))
+            if funq_socket:
+                cmd.append('--socket')
+                cmd.append(funq_socket)
 
         if appconfig.with_valgrind:
             cmd.append('valgrind')
@@ -539,6 +1370,8 @@ class ApplicationConfig(object):  # pylint: disable=R0902
     :param executable: complete path to the tested application
     :param args: executable arguments
     :param funq_port: socket port number for the libFunq connection
+    :param funq_socket: unix domain socket path for the libFunq connection,
+                        used instead of funq_port when given.
     :param cwd: execution path for the tested application. If None, the
                 value will be the directory of executable.
     :param env: dict environment variables. If None, os.environ will be
@@ -553,12 +1386,19 @@ class ApplicationConfig(object):  # pylint: disable=R0902
                                 on errors.
     :param with_valgrind: indicate if valgrind must be used.
     :param valgrind_args: valgrind arguments
+    :param binary_framing: indicate if the binary framing must be negotiated
+                           with libFunq.
+    :param compression: compression of the big responses to negotiate with
+                        libFunq ('zlib'), or None.
+    :param shared_memory: indicate if bulk data must be transferred through
+                          a memory mapped file.
     :param global_options: options from the funq nose plugin.
     """
 
     def __init__(self, executable,  # pylint: disable=R0913
                  args=(),
                  funq_port=None,
+                 funq_socket=None,
                  cwd=None,
                  env=None,
                  timeout_connection=10,
@@ -570,10 +1410,14 @@ class ApplicationConfig(object):  # pylint: disable=R0902
                  with_valgrind=False,
                  valgrind_args=('--leak-check=full',
                                 '--show-reachable=yes'),
+                 binary_framing=False,
+                 compression=None,
+                 shared_memory=False,
                  global_options=None):
         self.executable = executable
         self.args = args
         self.funq_port = funq_port
+        self.funq_socket = funq_socket
         self.cwd = cwd or os.path.dirname(executable) or os.getcwd()
         self.env = env
         self.timeout_connection = timeout_connection
@@ -584,6 +1428,9 @@ class ApplicationConfig(object):  # pylint: disable=R0902
         self.screenshot_on_error = screenshot_on_error
         self.with_valgrind = with_valgrind
         self.valgrind_args = valgrind_args
+        self.binary_framing = binary_framing
+        self.compression = compression
+        self.shared_memory = shared_memory
         self.global_options = global_options
 
     def create_aliases(self):
@@ -625,6 +1472,15 @@ class ApplicationConfig(object):  # pylint: disable=R0902
                 sock.close()
                 del sock
 
+        if conf.has_option(section, 'funq_socket'):
+            kwargs['funq_socket'] = conf.get(section, 'funq_socket')
+            if kwargs['funq_socket'] == 'auto':
+                # take an unique path
+                kwargs['funq_socket'] = os.path.join(
+                    tempfile.gettempdir(),
+                    'funq-{}-{}.sock'.format(os.getpid(),
+                                             uuid.uuid4().hex[:8]))
+
         if conf.has_option(section, 'timeout_connection'):
             kwargs['timeout_connection'] = conf.getint(section,
                                                        'timeout_connection')
@@ -657,6 +1513,17 @@ class ApplicationConfig(object):  # pylint: disable=R0902
             kwargs["screenshot_on_error"] = \
                 conf.getboolean(section, 'screenshot_on_error')
 
+        if conf.has_option(section, 'binary_framing'):
+            kwargs["binary_framing"] = \
+                conf.getboolean(section, 'binary_framing')
+
+        if conf.has_option(section, 'compression'):
+            kwargs["compression"] = conf.get(section, 'compression')
+
+        if conf.has_option(section, 'shared_memory'):
+            kwargs["shared_memory"] = \
+                conf.getboolean(section, 'shared_memory')
+
         return cls(executable, **kwargs)
 
 
@@ -38,7 +38,6 @@ Definition of widgets and models useable in funq.
 from funq.tools import wait_for, QtKeyDict, QtKeyboardModifierDict
 from funq.errors import FunqError
 import json
-import base64
 
 
 
@@ -256,12 +255,19 @@ class AbstractItemModel(Object):
     Allow to manipulate a QAbstractItemModel or derived.
     """
 
-    def items(self):
+    def items(self, chunk_size=None):
         """
         Returns an instance of :class:`ModelItems` with all items of this
         model.
+
+        :param chunk_size: if given, the items are streamed by the libFunq
+                           server by chunks of *chunk_size* top level rows,
+                           which bounds its memory usage for big models.
         """
-        data = self.client.send_command('model_items', oid=self.oid)
+        kwargs = {}
+        if chunk_size:
+            kwargs['chunk_size'] = chunk_size
+        data = self.client.send_command('model_items', oid=self.oid, **kwargs)
         return ModelItems.create(self.client, data)
 
 
@@ -325,7 +331,7 @@ class Widget(Object):
         """
         self.client.send_command('widget_keyclick', text=text, oid=self.oid)
 
-    def shortcut(self, key_sequence):
+    def shortcut(self, key_sequence, timeout=None):
         """
         Send a shortcut on the widget, defined with a text sequence. See the
         QKeySequence::fromString to see the documentation of the format needed
@@ -333,13 +339,16 @@ class Widget(Object):
 
         :param text: text sequence of the shortcut (see
                      QKeySequence::fromString documentation)
+        :param timeout: maximum time in seconds for the server to send the
+                        shortcut, None for the server default
         """
         self.client.send_command('shortcut',
                                  keysequence=key_sequence,
-                                 oid=self.oid)
+                                 oid=self.oid,
+                                 timeout=timeout)
 
     def drag_n_drop(self, src_pos=None,
-                    dest_widget=None, dest_pos=None):
+                    dest_widget=None, dest_pos=None, timeout=None):
         """
         Do a drag and drop from this widget.
 
@@ -351,9 +360,11 @@ class Widget(Object):
         :param dest_pos: ending position (the drop). Must be a tuple (x, y)
                          in widget coordinates or None (the center of the dest
                          widget will then be used)
+        :param timeout: maximum time in seconds for the drag and drop, None
+                        for the server default
         """
         self.client.drag_n_drop(self, src_pos=src_pos, dest_widget=dest_widget,
-                                dest_pos=dest_pos)
+                                dest_pos=dest_pos, timeout=timeout)
 
     def move(self, x=None, y=None):
         """
@@ -395,7 +406,7 @@ class Widget(Object):
         :return: The image as a binary blob in the given format.
         """
         data = self.client.send_command('grab', format=format, oid=self.oid)
-        return base64.standard_b64decode(data['data'])
+        return self.client.binary_data(data)
 
     def map_position_from(self, x, y, parent):
         """
@@ -861,7 +872,7 @@ class GraphicsView(Widget):
         if isinstance(stream, str):
             stream = open(stream, 'wb')
             has_to_be_closed = True
-        raw = base64.standard_b64decode(data['data'])
+        raw = self.client.binary_data(data)
         stream.write(raw)
         if has_to_be_closed:
             stream.close()
@@ -32,10 +32,17 @@
 # The fact that you are presently reading this means that you have had
 # knowledge of the CeCILL v2.1 license and that you accept its terms.
 
-from nose.tools import assert_equals, raises
+from nose.tools import assert_equals, assert_not_equals, assert_true, \
+    raises
 from funq import client
+from funq.errors import FunqError
+import io
+import json
 import os
 import subprocess
+import tempfile
+import struct
+import zlib
 
 from configparser import ConfigParser, NoOptionError
 
@@ -92,6 +99,20 @@ class TestApplicationConfigFromConf:
         appconf = self.createApplicationConfig()
         assert_equals(appconf.funq_port, 12000)
 
+    def test_socket(self):
+        self.set_opt('executable', 'toto')
+        self.set_opt('funq_socket', '/tmp/funq.sock')
+        appconf = self.createApplicationConfig()
+        assert_equals(appconf.funq_socket, '/tmp/funq.sock')
+
+    def test_socket_auto(self):
+        self.set_opt('executable', 'toto')
+        self.set_opt('funq_socket', 'auto')
+        appconf = self.createApplicationConfig()
+        assert_true(appconf.funq_socket.endswith('.sock'))
+        assert_not_equals(self.createApplicationConfig().funq_socket,
+                          appconf.funq_socket)
+
     def test_timeout_connection(self):
         self.set_opt('executable', 'toto')
         self.set_opt('timeout_connection', '5')
@@ -190,3 +211,474 @@ class TestApplicationContext:
         ctx = client.ApplicationContext(
             appconf, client_class=lambda *a, **kwa: None)
         assert_equals(ctx._process.command, ['funq', 'valgrind', 'command'])
+
+    @FakePopen.patch_subprocess_popen
+    def test_start_with_socket(self):
+        class OptionsDefault:
+            funq_attach_exe = 'funq'
+        appconf = client.ApplicationConfig(
+            executable='command',
+            funq_socket='/tmp/funq.sock',
+            global_options=OptionsDefault(),
+        )
+
+        kwargs = {}
+        ctx = client.ApplicationContext(
+            appconf, client_class=lambda *a, **kwa: kwargs.update(kwa))
+        assert_equals(ctx._process.command,
+                      ['funq', '--socket', '/tmp/funq.sock', 'command'])
+        assert_equals(kwargs['socket_path'], '/tmp/funq.sock')
+
+
+class TestReadMessage:
+
+    def test_text_framing(self):
+        f = io.BytesIO(b'8\n{"1": 2}')
+        assert_equals(client.read_message(f), {"1": 2})
+
+    def test_binary_framing(self):
+        f = io.BytesIO(
+            client.FRAME_HEADER.pack(3, client.FRAME_ATTACHMENT, 0, 0) +
+            b'raw' +
+            client.FRAME_HEADER.pack(24, client.FRAME_MESSAGE, 0, 0) +
+            b'{"data_attachment": 0}  ')
+        response = client.read_message(f, binary_framing=True)
+        assert_equals(client.FunqClient.binary_data(response), b'raw')
+
+    def test_compressed_frame(self):
+        data = b'{"data": "' + b'a' * 1000 + b'"}'
+        # qCompress format
+        payload = struct.pack('>I', len(data)) + zlib.compress(data)
+        f = io.BytesIO(
+            client.FRAME_HEADER.pack(len(payload), client.FRAME_MESSAGE,
+                                     client.FRAME_FLAG_COMPRESSED, 0) +
+            payload)
+        response = client.read_message(f, binary_framing=True)
+        assert_equals(response, {"data": "a" * 1000})
+
+    def test_binary_data_base64(self):
+        assert_equals(client.FunqClient.binary_data({'data': 'cmF3'}),
+                      b'raw')
+
+    @raises(FunqError)
+    def test_connection_closed(self):
+        f = io.BytesIO(client.FRAME_HEADER.pack(3, client.FRAME_MESSAGE, 0, 0))
+        client.read_message(f, binary_framing=True)
+
+
+class FakeSocketFile(object):
+
+    def __init__(self, incoming):
+        self.incoming = io.BytesIO(incoming)
+        self.outgoing = io.BytesIO()
+        self.read = self.incoming.read
+        self.readline = self.incoming.readline
+        self.write = self.outgoing.write
+
+    def flush(self):
+        pass
+
+
+class FakeSocket(object):
+
+    def __init__(self):
+        self.timeout = 10
+        self.timeouts = []
+
+    def gettimeout(self):
+        return self.timeout
+
+    def settimeout(self, timeout):
+        self.timeouts.append(timeout)
+        self.timeout = timeout
+
+
+class FakeFunqClient(client.FunqClient):
+
+    def __init__(self, incoming):
+        self._socket = FakeSocket()
+        self._fsocket = FakeSocketFile(incoming)
+        self._binary_framing = False
+        self._next_id = 0
+        self._responses = {}
+        self._compression = None
+        self._shared_memory = False
+        self._shm = None
+        self._schemas = None
+
+    def close(self):
+        pass
+
+    def _pending_data(self, timeout=0):
+        incoming = self._fsocket.incoming
+        return incoming.tell() < len(incoming.getvalue())
+
+
+def text_frame(data):
+    data = data.encode('utf-8')
+    return '{}\n'.format(len(data)).encode('utf-8') + data
+
+
+def sent_commands(funq):
+    """
+    Returns the commands sent by a FakeFunqClient.
+    """
+    data, commands = funq._fsocket.outgoing.getvalue(), []
+    while data:
+        size, data = data.split(b'\n', 1)
+        commands.append(json.loads(data[:int(size)].decode('utf-8')))
+        data = data[int(size):]
+    return commands
+
+
+class TestPipelining:
+
+    def test_send_commands_out_of_order_answers(self):
+        funq = FakeFunqClient(text_frame('{"id": 2, "value": "second"}') +
+                              text_frame('{"id": 1, "value": "first"}'))
+        responses = funq.send_commands([('a', {}), ('b', {'x': 1})])
+        assert_equals(responses, [{'value': 'first'}, {'value': 'second'}])
+
+    @raises(FunqError)
+    def test_send_commands_error(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1}') +
+            text_frame('{"id": 2, "success": false, "errName": "E",'
+                       ' "errDesc": "D"}'))
+        funq.send_commands([('a', {}), ('b', {})])
+
+
+class TestBatch:
+
+    def test_batch(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "results": [{"oid": 5}, {"value": 2}]}'))
+        results = funq.batch([('widget_by_path', {'path': 'a'}),
+                              ('object_properties', {'oid': '$0.oid'})])
+        assert_equals(results, [{'oid': 5}, {'value': 2}])
+        assert_equals(sent_commands(funq)[0]['commands'],
+                      [{'action': 'widget_by_path', 'path': 'a'},
+                       {'action': 'object_properties', 'oid': '$0.oid'}])
+
+    @raises(FunqError)
+    def test_batch_error(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "results": [{"success": false,'
+                       ' "errName": "E", "errDesc": "D"}]}'))
+        funq.batch([('a', {})])
+
+    def test_batch_continue_on_error(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "results": [{"success": false,'
+                       ' "errName": "E", "errDesc": "D"}, {"value": 1}]}'))
+        results = funq.batch([('a', {}), ('b', {})], stop_on_error=False)
+        assert_equals(results[0]['errName'], 'E')
+        assert_equals(results[1], {'value': 1})
+
+
+class TestEvalScript:
+
+    def test_eval_script(self):
+        funq = FakeFunqClient(text_frame('{"id": 1, "result": [1, 2]}'))
+        assert_equals(funq.eval_script('return [1, args.x];', x=2), [1, 2])
+        assert_equals(sent_commands(funq)[0]['args'], {'x': 2})
+
+    def test_eval_script_without_result(self):
+        funq = FakeFunqClient(text_frame('{"id": 1}'))
+        assert_equals(funq.eval_script('var a = 1;'), None)
+
+
+class TestCheckCommand:
+
+    def setup(self):
+        schemas = {'widget_move': [
+            {'name': 'oid', 'type': 'oid', 'required': True},
+            {'name': 'x', 'type': 'int', 'required': False},
+        ]}
+        self.funq = FakeFunqClient(
+            text_frame(json.dumps({'id': 1, 'commands': [],
+                                   'schemas': schemas})))
+
+    def test_valid_command(self):
+        self.funq.check_command('widget_move', oid=1, x=None)
+        self.funq.check_command('widget_move', oid=1.0, x=2.0)
+        self.funq.check_command('unknown', foo='bar')
+        # schemas are only fetched once
+        assert_equals(self.funq._next_id, 1)
+
+    def test_missing_argument(self):
+        try:
+            self.funq.check_command('widget_move', x=2)
+        except FunqError as exc:
+            assert_equals(exc.classname, 'MissingArgument')
+        else:
+            raise AssertionError('FunqError not raised')
+
+    def test_invalid_argument(self):
+        for value in ('2', True, 2.5):
+            try:
+                self.funq.check_command('widget_move', oid=1, x=value)
+            except FunqError as exc:
+                assert_equals(exc.classname, 'InvalidArgument')
+            else:
+                raise AssertionError('FunqError not raised')
+
+
+class TestDelayedCommands:
+
+    def test_shortcut_timeout(self):
+        funq = FakeFunqClient(text_frame('{"id": 1}'))
+        funq.shortcut('F2', timeout=2.5)
+        assert_equals(sent_commands(funq)[0]['timeout'], 2.5)
+
+
+class TestWidgetsList:
+
+    def test_widgets_list_options(self):
+        funq = FakeFunqClient(text_frame('{"id": 1}'))
+        funq.widgets_list(properties=['text'], max_depth=2)
+        sent = sent_commands(funq)[0]
+        assert_equals(sent['properties'], ['text'])
+        assert_equals(sent['max_depth'], 2)
+        assert_true('classes' not in sent)
+
+
+class TestTreeHash:
+
+    def test_tree_hash(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "hash": "0a", "children": {}}'))
+        assert_equals(funq.tree_hash(5, properties=['text']),
+                      {'hash': '0a', 'children': {}})
+        sent = sent_commands(funq)[0]
+        assert_equals(sent['oid'], 5)
+        assert_equals(sent['properties'], ['text'])
+
+
+class TestFindObjects:
+
+    def test_find_objects(self):
+        funq = FakeFunqClient(text_frame(json.dumps({'id': 1, 'objects': [
+            {'oid': 3, 'path': 'dialog::QPushButton',
+             'classes': ['QPushButton', 'QAbstractButton', 'QWidget',
+                         'QObject']}]})))
+        objects = funq.find_objects('QPushButton[text=Apply]', root=2)
+        assert_equals(len(objects), 1)
+        assert_true(isinstance(objects[0], client.Widget))
+        assert_equals(objects[0].oid, 3)
+        assert_equals(sent_commands(funq)[0]['oid'], 2)
+
+
+class TestHandleRelease:
+
+    def test_release(self):
+        funq = FakeFunqClient(text_frame('{"id": 1, "released": 2}'))
+        widget = client.Widget()
+        widget.oid = 3
+        assert_equals(funq.release(widget, 4), 2)
+        assert_equals(sent_commands(funq)[0]['oids'], [3, 4])
+
+    def test_handle_scope(self):
+        funq = FakeFunqClient(text_frame('{"id": 1, "scope": 7}') +
+                              text_frame('{"id": 2, "released": 1}'))
+        with funq.handle_scope() as scope:
+            assert_equals(scope, 7)
+        sent = sent_commands(funq)
+        assert_equals(sent[1]['action'], 'scope_end')
+        assert_equals(sent[1]['scope'], 7)
+
+    def test_registry_stats(self):
+        funq = FakeFunqClient(text_frame('{"id": 1, "count": 5}'))
+        assert_equals(funq.registry_stats(), {'count': 5})
+
+
+class TestTreeSubscription:
+
+    def test_changes(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "partial": true, "subscription": 3,'
+                       ' "seq": 4, "changes": []}') +
+            text_frame('{"id": 1, "partial": true, "seq": 6, "changes":'
+                       ' [{"seq": 6, "event": "children", "path": "w"}]}') +
+            text_frame('{"id": 1, "seq": 7, "changes":'
+                       ' [{"seq": 7, "event": "roots"}]}') +
+            text_frame('{"id": 2}'))
+        subscription = funq.subscribe_tree(interval=10)
+        assert_equals(subscription.token, 3)
+        assert_equals(subscription.seq, 4)
+        changes = subscription.changes()
+        assert_equals([c['event'] for c in changes], ['children', 'roots'])
+        assert_true(subscription.closed)
+        assert_equals(subscription.close(), [])
+
+    def test_close(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "partial": true, "subscription": 3,'
+                       ' "seq": 0, "changes": []}') +
+            text_frame('{"id": 1, "seq": 1, "changes":'
+                       ' [{"seq": 1, "event": "hidden", "path": "w"}]}') +
+            text_frame('{"id": 2}'))
+        subscription = funq.subscribe_tree()
+        # the final part is only sent once unsubscribed
+        funq._pending_data = lambda timeout=0: False
+        with subscription:
+            pass
+        assert_true(subscription.closed)
+        assert_equals(subscription.seq, 1)
+        sent = sent_commands(funq)
+        assert_equals(sent[1], {'action': 'unsubscribe_tree',
+                                'subscription': 3, 'id': 2})
+
+    def test_mirror_refreshes_changed_children(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "partial": true, "subscription": 1,'
+                       ' "seq": 0, "changes": []}') +
+            text_frame(json.dumps({'id': 2, 'w': {
+                'path': 'w', 'children': {
+                    'a': {'path': 'w::a', 'children': {}}}}})) +
+            text_frame('{"id": 1, "partial": true, "seq": 2, "changes":'
+                       ' [{"seq": 1, "event": "children", "path": "w::a"},'
+                       ' {"seq": 2, "event": "children", "path": "w"}]}') +
+            text_frame('{"id": 3, "oid": 5}') +
+            text_frame(json.dumps({'id': 4, 'b': {
+                'path': 'w::b', 'children': {}}})) +
+            text_frame('{"id": 5, "released": 1}'))
+        mirror = funq.widgets_mirror()
+        assert_true('w::a' in mirror)
+        changes = mirror.update()
+        assert_equals(len(changes), 2)
+        assert_true('w::a' not in mirror)
+        assert_true('w::b' in mirror)
+        assert_equals(list(mirror.get('w')['children']), ['b'])
+        sent = sent_commands(funq)
+        assert_equals([c['action'] for c in sent[2:]],
+                      ['widget_by_path', 'widgets_list', 'release'])
+        assert_equals(sent[3]['oid'], 5)
+
+
+class TestWaitForObject:
+
+    def test_widget(self):
+        funq = FakeFunqClient(text_frame(
+            '{"id": 1, "oid": 3, "path": "w", "classes": ["QWidget"]}'))
+        widget = funq.widget(path='w', timeout=2, wait_active=False)
+        assert_equals(widget.oid, 3)
+        sent = sent_commands(funq)
+        assert_equals(sent, [{'action': 'wait_for_object', 'path': 'w',
+                              'timeout': 2, 'id': 1}])
+        # the socket waits for the server timeout, then is restored
+        assert_equals(funq._socket.timeouts, [12, 10])
+
+    @raises(FunqError)
+    def test_widget_timeout(self):
+        funq = FakeFunqClient(text_frame(
+            '{"id": 1, "success": false, "errName": "InvalidWidgetPath",'
+            ' "errDesc": "D"}'))
+        funq.widget(path='w', timeout=0, wait_active=False)
+
+    def test_widget_old_server(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "success": false, "errName":'
+                       ' "UnknownAction", "errDesc": "D"}') +
+            text_frame('{"id": 2, "oid": 3, "path": "w",'
+                       ' "classes": ["QWidget"]}'))
+        widget = funq.widget(path='w', timeout=0, wait_active=False)
+        assert_equals(widget.oid, 3)
+        sent = sent_commands(funq)
+        assert_equals(sent[1]['action'], 'widget_by_path')
+
+
+class TestUnrelatedError:
+
+    @raises(FunqError)
+    def test_error_without_id(self):
+        funq = FakeFunqClient(
+            text_frame('{"success": false, "errName": "FrameTooLarge",'
+                       ' "errDesc": "D"}'))
+        funq.send_command('a')
+
+
+class TestPartialResponses:
+
+    def test_partial_responses_are_merged(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "partial": true, "items": [1, 2]}') +
+            text_frame('{"id": 2, "value": 3}') +
+            text_frame('{"id": 1, "items": [3], "count": 3}'))
+        responses = funq.send_commands([('a', {}), ('b', {})])
+        assert_equals(responses, [{'items': [1, 2, 3], 'count': 3},
+                                  {'value': 3}])
+
+    def test_iter_command(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "partial": true, "items": [1, 2]}') +
+            text_frame('{"id": 1, "items": [3]}'))
+        assert_equals(list(funq.iter_command('a')),
+                      [{'items': [1, 2]}, {'items': [3]}])
+
+    @raises(FunqError)
+    def test_iter_command_error(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "partial": true, "items": [1, 2]}') +
+            text_frame('{"id": 1, "success": false, "errName": "E",'
+                       ' "errDesc": "D"}'))
+        list(funq.iter_command('a'))
+
+
+class TestSharedMemory:
+
+    def setup(self):
+        self.shm = tempfile.NamedTemporaryFile(suffix='.shm')
+        self.shm.write(b'{"value": 1}' + b'raw')
+        self.shm.flush()
+
+    def teardown(self):
+        self.shm.close()
+
+    def descriptor(self, offset, size):
+        return json.dumps({'name': self.shm.name, 'offset': offset,
+                           'size': size, 'format': ''})
+
+    def test_response_in_shared_memory(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "_shm": %s}' % self.descriptor(0, 12)))
+        funq._shared_memory = True
+        assert_equals(funq.send_command('a'), {'value': 1})
+        funq._close_shm()
+
+    def test_binary_data_in_shared_memory(self):
+        funq = FakeFunqClient(
+            text_frame('{"id": 1, "data_shm": %s}' % self.descriptor(12, 3)))
+        funq._shared_memory = True
+        response = funq.send_command('grab')
+        assert_equals(funq.binary_data(response), b'raw')
+        funq._close_shm()
+
+    def ring(self, end):
+        shm = tempfile.NamedTemporaryFile(suffix='.shm')
+        shm.write(client.SHM_HEADER.pack(end) + b'raw')
+        shm.flush()
+        return shm
+
+    def test_block_sequence(self):
+        # the ring has 11 bytes, the block is at offset 8 of the second lap
+        shm = self.ring(22)
+        descriptor = {'name': shm.name, 'offset': 8, 'size': 3,
+                      'format': '', 'sequence': 19}
+        funq = FakeFunqClient(b'')
+        assert_equals(funq._read_shm(descriptor), b'raw')
+        funq._close_shm()
+        shm.close()
+
+    @raises(FunqError)
+    def test_block_overwritten(self):
+        # the third lap reached the offset of the block of the second lap
+        shm = self.ring(33)
+        descriptor = {'name': shm.name, 'offset': 8, 'size': 3,
+                      'format': '', 'sequence': 19}
+        funq = FakeFunqClient(b'')
+        try:
+            funq._read_shm(descriptor)
+        finally:
+            funq._close_shm()
+            shm.close()
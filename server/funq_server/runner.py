@@ -77,6 +77,9 @@ class Runner(object):
                             help="Specify funq host.")
         parser.add_argument('--port', type=int,
                             help="Specify funq port.")
+        parser.add_argument('--socket', type=str,
+                            help="Specify a local socket path to use instead"
+                                 " of the host and port.")
         parser.add_argument('command', nargs=argparse.REMAINDER)
         return parser.parse_args(argv)
 
@@ -111,6 +114,8 @@ class Runner(object):
             env['FUNQ_PORT'] = str(opts.port)
         if opts.host is not None:
             env['FUNQ_HOST'] = str(opts.host)
+        if opts.socket is not None:
+            env['FUNQ_SOCKET'] = opts.socket
 
         library_path = self._find_library()
         if not os.path.isfile(library_path):
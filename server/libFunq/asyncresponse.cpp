@@ -0,0 +1,130 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "asyncresponse.h"
+
+#include <QWidget>
+#include <QWindow>
+
+namespace Async {
+
+void Wait::await_suspend(AsyncCommand::Handle handle) const {
+    AsyncResponse * response = handle.promise().response;
+    Q_ASSERT(response);
+    switch (kind) {
+        case Signal:
+            response->waitForSignal(object, signal);
+            break;
+        case Event:
+            response->waitForEvent(object, eventType, msecs);
+            break;
+        case Idle:
+            response->waitForIdle();
+            break;
+        case Delay:
+            response->waitFor(msecs);
+            break;
+        case Frame:
+            if (QWidget * widget = qobject_cast<QWidget *>(object)) {
+                widget->update();
+                response->waitForEvent(widget, QEvent::Paint, msecs);
+            } else if (QWindow * window = qobject_cast<QWindow *>(object)) {
+                window->requestUpdate();
+                response->waitForEvent(window, QEvent::UpdateRequest, msecs);
+            } else {
+                response->waitForIdle();
+            }
+            break;
+    }
+}
+
+Wait signal(QObject * sender, const char * signal) {
+    Wait wait(Wait::Signal);
+    wait.object = sender;
+    wait.signal = signal;
+    return wait;
+}
+
+Wait event(QObject * target, QEvent::Type type, int maxWait) {
+    Wait wait(Wait::Event);
+    wait.object = target;
+    wait.eventType = type;
+    wait.msecs = maxWait;
+    return wait;
+}
+
+Wait idle() {
+    return Wait(Wait::Idle);
+}
+
+Wait delay(int msecs) {
+    Wait wait(Wait::Delay);
+    wait.msecs = msecs;
+    return wait;
+}
+
+Wait nextFrame(QObject * target, int maxWait) {
+    Wait wait(Wait::Frame);
+    wait.object = target;
+    wait.msecs = maxWait;
+    return wait;
+}
+
+}  // namespace Async
+
+AsyncResponse::AsyncResponse(JsonClient * client,
+                             const QtJson::JsonObject & command,
+                             AsyncCommand coroutine)
+    : DelayedResponse(client, command),
+      m_coroutine(std::move(coroutine)),
+      m_action(command["action"].toString()) {
+    m_coroutine.m_handle.promise().response = this;
+}
+
+void AsyncResponse::execute(int) {
+    AsyncCommand::Handle handle = m_coroutine.m_handle;
+    // runs until the next co_await, which arms the wait resuming it
+    handle.resume();
+    if (!handle.done()) {
+        return;
+    }
+    if (handle.promise().failed) {
+        writeResponse(JsonClient::createError(
+            "ActionFailed",
+            QString::fromUtf8("Unhandled exception in the action `%1`")
+                .arg(m_action)));
+    } else {
+        writeResponse(handle.promise().result);
+    }
+}
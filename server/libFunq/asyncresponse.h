@@ -0,0 +1,175 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef ASYNCRESPONSE_H
+#define ASYNCRESPONSE_H
+
+#include "delayedresponse.h"
+
+#include <coroutine>
+
+class AsyncResponse;
+
+/**
+ * @brief Return type of the coroutines implementing an asynchronous command.
+ *
+ * The coroutine co_awaits the conditions of the Async namespace and
+ * co_returns its result. It is driven by an AsyncResponse:
+ *
+ * @code
+ * AsyncCommand clickTwice(QWidget * widget) {
+ *     QTest::mouseClick(widget, Qt::LeftButton);
+ *     co_await Async::idle();
+ *     QTest::mouseClick(widget, Qt::LeftButton);
+ *     co_await Async::nextFrame(widget);
+ *     co_return QtJson::JsonObject();
+ * }
+ *
+ * DelayedResponse * Player::click_twice(const QtJson::JsonObject & command) {
+ *     WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+ *     ...
+ *     return new AsyncResponse(this, command, clickTwice(ctx.widget));
+ * }
+ * @endcode
+ *
+ * The arguments of the coroutine must be taken by value: the coroutine
+ * outlives the slot that created it.
+ */
+class AsyncCommand {
+public:
+    struct promise_type {
+        AsyncResponse * response = nullptr;
+        QtJson::JsonObject result;
+        bool failed = false;
+
+        AsyncCommand get_return_object() {
+            return AsyncCommand(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(const QtJson::JsonObject & value) { result = value; }
+        void unhandled_exception() { failed = true; }
+    };
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    AsyncCommand(AsyncCommand && other) noexcept : m_handle(other.m_handle) {
+        other.m_handle = nullptr;
+    }
+    ~AsyncCommand() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+    AsyncCommand(const AsyncCommand &) = delete;
+    AsyncCommand & operator=(const AsyncCommand &) = delete;
+
+private:
+    friend class AsyncResponse;
+    explicit AsyncCommand(Handle handle) : m_handle(handle) {}
+
+    Handle m_handle;
+};
+
+namespace Async {
+
+/**
+ * @brief Awaitable condition, resuming the coroutine from the event loop
+ * (see the wait methods of DelayedResponse).
+ */
+class Wait {
+public:
+    enum Kind { Signal, Event, Idle, Delay, Frame };
+
+    explicit Wait(Kind kind)
+        : kind(kind),
+          object(nullptr),
+          signal(nullptr),
+          eventType(QEvent::None),
+          msecs(-1) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(AsyncCommand::Handle handle) const;
+    void await_resume() const noexcept {}
+
+    Kind kind;
+    QObject * object;
+    const char * signal;
+    QEvent::Type eventType;
+    int msecs;
+};
+
+/** @brief Resume when sender emits signal (given with SIGNAL()). */
+Wait signal(QObject * sender, const char * signal);
+
+/**
+ * @brief Resume when target receives an event of the given type, or after
+ * maxWait milliseconds if maxWait is positive.
+ */
+Wait event(QObject * target, QEvent::Type type, int maxWait = -1);
+
+/** @brief Resume once the events already posted are processed. */
+Wait idle();
+
+/** @brief Resume after msecs milliseconds. */
+Wait delay(int msecs);
+
+/**
+ * @brief Resume once the widget or window (a QWidget or a QWindow) has
+ * been repainted, or after maxWait milliseconds if it is not visible.
+ */
+Wait nextFrame(QObject * target, int maxWait = 100);
+
+}  // namespace Async
+
+/**
+ * @brief Delayed response driving an AsyncCommand coroutine, and writing
+ * its result once it co_returns.
+ */
+class AsyncResponse : public DelayedResponse {
+public:
+    AsyncResponse(JsonClient * client, const QtJson::JsonObject & command,
+                  AsyncCommand coroutine);
+
+protected:
+    virtual void execute(int call);
+
+private:
+    friend class Async::Wait;
+
+    AsyncCommand m_coroutine;
+    QString m_action;
+};
+
+#endif  // ASYNCRESPONSE_H
@@ -0,0 +1,71 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "commandargs.h"
+
+#include "jsonclient.h"
+
+namespace CommandArgs {
+
+QtJson::JsonObject Decoder::missingError(const char * name) {
+    return JsonClient::createError(
+        "MissingArgument",
+        QString::fromUtf8("Missing argument `%1`").arg(name));
+}
+
+QtJson::JsonObject Decoder::invalidError(const char * name,
+                                         const char * type) {
+    return JsonClient::createError(
+        "InvalidArgument",
+        QString::fromUtf8("Argument `%1`: expected %2").arg(name).arg(type));
+}
+
+void SchemaWriter::add(const char * name, const char * type, bool required,
+                       const QVariant & defaultValue) {
+    QtJson::JsonObject field;
+    field["name"] = QString::fromLatin1(name);
+    field["type"] = QString::fromLatin1(type);
+    field["required"] = required;
+    if (defaultValue.isValid()) {
+        field["default"] = defaultValue;
+    }
+    m_fields << field;
+}
+
+QHash<QString, QtJson::JsonArray> & schemas() {
+    static QHash<QString, QtJson::JsonArray> schemas;
+    return schemas;
+}
+
+}  // namespace CommandArgs
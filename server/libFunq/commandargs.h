@@ -0,0 +1,317 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef COMMANDARGS_H
+#define COMMANDARGS_H
+
+#include "json.h"
+
+#include <QHash>
+#include <QString>
+#include <QVariant>
+#include <QtNumeric>
+
+#include <cmath>
+
+/**
+ * @brief Typed decoding of the command arguments.
+ *
+ * Each action declares a struct holding its arguments, with default values
+ * for the optional ones, and a visit() method describing them:
+ *
+ * @code
+ * struct WidgetMoveArgs {
+ *     WidgetMoveArgs() : oid(0), x(0), y(0), hasX(false), hasY(false) {}
+ *     qulonglong oid;
+ *     int x, y;
+ *     bool hasX, hasY;
+ *     template <class V> void visit(V & v) {
+ *         v.required("oid", oid);
+ *         v.optional("x", x, &hasX);
+ *         v.optional("y", y, &hasY);
+ *     }
+ * };
+ * @endcode
+ *
+ * The same description is used to decode a command in one pass (see
+ * CommandArgs::decode) and to publish the schema of the action (see
+ * CommandArgs::Register), so both can not diverge.
+ *
+ * A null value is handled like a missing one: the client sends None for
+ * the optional arguments it does not use.
+ */
+namespace CommandArgs {
+
+/**
+ * @brief Traits giving the schema name of an argument type and its strict
+ * conversion from the decoded json (no string to number conversion, no
+ * truncation of the numbers given for integers).
+ */
+template <class T>
+struct Type;
+
+inline bool isNumber(const QVariant & value) {
+    switch (int(value.type())) {
+        case QVariant::Int:
+        case QVariant::UInt:
+        case QVariant::LongLong:
+        case QVariant::ULongLong:
+        case QVariant::Double:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/** @brief Numbers without a fractional part: 2.0 is accepted, not 2.5. */
+inline bool isIntegral(const QVariant & value) {
+    if (int(value.type()) == QVariant::Double) {
+        const double number = value.toDouble();
+        return qIsFinite(number) && std::floor(number) == number;
+    }
+    return isNumber(value);
+}
+
+template <>
+struct Type<int> {
+    static const char * name() { return "int"; }
+    static bool convert(const QVariant & v, int & out) {
+        if (!isIntegral(v)) {
+            return false;
+        }
+        out = v.toInt();
+        return true;
+    }
+};
+
+/** @brief qulonglong is only used for object ids. */
+template <>
+struct Type<qulonglong> {
+    static const char * name() { return "oid"; }
+    static bool convert(const QVariant & v, qulonglong & out) {
+        if (!isIntegral(v)) {
+            return false;
+        }
+        out = v.toULongLong();
+        return true;
+    }
+};
+
+template <>
+struct Type<double> {
+    static const char * name() { return "number"; }
+    static bool convert(const QVariant & v, double & out) {
+        if (!isNumber(v)) {
+            return false;
+        }
+        out = v.toDouble();
+        return true;
+    }
+};
+
+template <>
+struct Type<bool> {
+    static const char * name() { return "bool"; }
+    static bool convert(const QVariant & v, bool & out) {
+        if (v.type() != QVariant::Bool) {
+            return false;
+        }
+        out = v.toBool();
+        return true;
+    }
+};
+
+template <>
+struct Type<QString> {
+    static const char * name() { return "string"; }
+    static bool convert(const QVariant & v, QString & out) {
+        if (v.type() != QVariant::String) {
+            return false;
+        }
+        out = v.toString();
+        return true;
+    }
+};
+
+template <>
+struct Type<QVariantMap> {
+    static const char * name() { return "object"; }
+    static bool convert(const QVariant & v, QVariantMap & out) {
+        if (v.type() != QVariant::Map) {
+            return false;
+        }
+        out = v.toMap();
+        return true;
+    }
+};
+
+template <>
+struct Type<QVariantList> {
+    static const char * name() { return "list"; }
+    static bool convert(const QVariant & v, QVariantList & out) {
+        if (v.type() != QVariant::List && v.type() != QVariant::StringList) {
+            return false;
+        }
+        out = v.toList();
+        return true;
+    }
+};
+
+template <>
+struct Type<QVariant> {
+    static const char * name() { return "any"; }
+    static bool convert(const QVariant & v, QVariant & out) {
+        out = v;
+        return true;
+    }
+};
+
+/**
+ * @brief Visitor filling an argument struct from a command. Stops at the
+ * first error.
+ */
+class Decoder {
+public:
+    explicit Decoder(const QtJson::JsonObject & command) : m_command(command) {}
+
+    template <class T>
+    void required(const char * name, T & value) {
+        if (!m_error.isEmpty()) {
+            return;
+        }
+        QVariant v = m_command.value(QLatin1String(name));
+        if (!v.isValid()) {
+            m_error = missingError(name);
+        } else if (!Type<T>::convert(v, value)) {
+            m_error = invalidError(name, Type<T>::name());
+        }
+    }
+
+    template <class T>
+    void optional(const char * name, T & value, bool * present = 0) {
+        if (present) {
+            *present = false;
+        }
+        if (!m_error.isEmpty()) {
+            return;
+        }
+        QVariant v = m_command.value(QLatin1String(name));
+        if (!v.isValid()) {
+            return;
+        }
+        if (!Type<T>::convert(v, value)) {
+            m_error = invalidError(name, Type<T>::name());
+        } else if (present) {
+            *present = true;
+        }
+    }
+
+    const QtJson::JsonObject & error() const { return m_error; }
+
+private:
+    static QtJson::JsonObject missingError(const char * name);
+    static QtJson::JsonObject invalidError(const char * name,
+                                           const char * type);
+
+    const QtJson::JsonObject & m_command;
+    QtJson::JsonObject m_error;
+};
+
+/**
+ * @brief Visitor listing the arguments of a struct, as
+ * {"name", "type", "required"[, "default"]} objects. An optional argument
+ * tracked with a presence flag has no default.
+ */
+class SchemaWriter {
+public:
+    template <class T>
+    void required(const char * name, T &) {
+        add(name, Type<T>::name(), true, QVariant());
+    }
+
+    template <class T>
+    void optional(const char * name, T & value, bool * present = 0) {
+        add(name, Type<T>::name(), false,
+            present ? QVariant() : QVariant::fromValue(value));
+    }
+
+    const QtJson::JsonArray & fields() const { return m_fields; }
+
+private:
+    void add(const char * name, const char * type, bool required,
+             const QVariant & defaultValue);
+
+    QtJson::JsonArray m_fields;
+};
+
+/**
+ * @brief Decode the command into args. Returns false and fills error
+ * (MissingArgument or InvalidArgument) on failure.
+ */
+template <class Args>
+bool decode(const QtJson::JsonObject & command, Args & args,
+            QtJson::JsonObject & error) {
+    Decoder decoder(command);
+    args.visit(decoder);
+    error = decoder.error();
+    return error.isEmpty();
+}
+
+template <class Args>
+QtJson::JsonArray schema() {
+    Args args;
+    SchemaWriter writer;
+    args.visit(writer);
+    return writer.fields();
+}
+
+/**
+ * @brief Schemas of the actions declaring typed arguments, by action name.
+ */
+QHash<QString, QtJson::JsonArray> & schemas();
+
+/**
+ * @brief Publish the schema of an action; meant to be instanciated
+ * statically next to the action implementation.
+ */
+template <class Args>
+struct Register {
+    explicit Register(const char * action) {
+        schemas()[QString::fromLatin1(action)] = schema<Args>();
+    }
+};
+
+}  // namespace CommandArgs
+
+#endif  // COMMANDARGS_H
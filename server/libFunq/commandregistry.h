@@ -0,0 +1,88 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef COMMANDREGISTRY_H
+#define COMMANDREGISTRY_H
+
+#include "json.h"
+
+#include <QHash>
+#include <QStringList>
+
+#include <functional>
+
+class Player;
+
+/**
+ * @brief Execute an application defined command. The player allows to find
+ * the objects designated by their oid, and to create errors.
+ */
+typedef std::function<QtJson::JsonObject(Player * player,
+                                         const QtJson::JsonObject & command)>
+    CommandHandler;
+
+/**
+ * @brief Commands registered by the tested application, executed by the
+ * players alongside their own slots (which take precedence).
+ *
+ * The registry must only be used from the GUI thread.
+ */
+class CommandRegistry {
+public:
+    /**
+     * @brief Register a command, replacing a previous one with the same
+     * name.
+     */
+    static void registerCommand(const QString & name,
+                                const CommandHandler & handler);
+    static bool unregisterCommand(const QString & name);
+
+    /**
+     * @brief Returns the handler of a command, or an empty handler.
+     */
+    static CommandHandler handler(const QString & name);
+    static QStringList names();
+
+    /**
+     * @brief Load the plugins listed in the FUNQ_PLUGINS environment
+     * variable (paths separated like in PATH) and let them register their
+     * commands.
+     */
+    static void loadPlugins();
+
+private:
+    static QHash<QString, CommandHandler> & commands();
+};
+
+#endif  // COMMANDREGISTRY_H
@@ -34,33 +34,258 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 
 #include "delayedresponse.h"
 
-#include "protocole.h"
+#include "commandargs.h"
 
+#include <QCoreApplication>
 #include <QDebug>
 #include <QTimer>
 
+// partial responses wait while more data is pending
+static const qint64 MaxPendingBytes = 1024 * 1024;
+
+/**
+ * @brief Posted to the response when an awaited condition is met. The
+ * sequence number discards the events of a wait that is already over.
+ */
+class WaitDoneEvent : public QEvent {
+public:
+    explicit WaitDoneEvent(int sequence)
+        : QEvent(eventType()), sequence(sequence) {}
+
+    static QEvent::Type eventType() {
+        static const QEvent::Type type =
+            static_cast<QEvent::Type>(QEvent::registerEventType());
+        return type;
+    }
+
+    int sequence;
+};
+
+// longest accepted "timeout", in seconds
+static const double MaxTimeout = 86400.0;
+
+/**
+ * @brief Arguments common to the commands answering with a DelayedResponse.
+ */
+struct DelayedResponseArgs {
+    DelayedResponseArgs() : timeout(0), hasTimeout(false) {}
+    double timeout;
+    bool hasTimeout;
+    template <class V>
+    void visit(V & v) {
+        v.optional("timeout", timeout, &hasTimeout);
+    }
+};
+
+/**
+ * Merge a part of a response like the clients do: lists are concatenated,
+ * objects are merged and other values are replaced.
+ */
+static void mergeResponse(QtJson::JsonObject & response,
+                          const QtJson::JsonObject & part) {
+    for (QtJson::JsonObject::const_iterator it = part.constBegin();
+         it != part.constEnd(); ++it) {
+        QVariant & value = response[it.key()];
+        if (it.value().type() == QVariant::List &&
+            value.type() == QVariant::List) {
+            value = value.toList() + it.value().toList();
+        } else if (it.value().type() == QVariant::Map &&
+                   value.type() == QVariant::Map) {
+            QVariantMap merged = value.toMap();
+            QVariantMap values = it.value().toMap();
+            for (QVariantMap::const_iterator v = values.constBegin();
+                 v != values.constEnd(); ++v) {
+                merged[v.key()] = v.value();
+            }
+            value = merged;
+        } else {
+            value = it.value();
+        }
+    }
+}
+
 DelayedResponse::DelayedResponse(JsonClient * client,
                                  const QtJson::JsonObject & command,
                                  int interval, int timerOut)
-    : QObject(client), m_client(client), m_hasResponded(false), m_nbCall(0) {
+    : QObject(client),
+      m_client(client),
+      m_hasResponded(false),
+      m_nbCall(0),
+      m_synchronous(client->isCallingAction()),
+      m_waiting(false),
+      m_waitEvent(QEvent::None),
+      m_waitSequence(0) {
     Q_ASSERT(client);
     m_timer.setInterval(interval);
     connect(&m_timer, SIGNAL(timeout()), this, SLOT(timerCall()));
 
-    QTimer::singleShot(timerOut, this, SLOT(onTimerOut()));
+    m_waitTimer.setSingleShot(true);
+    connect(&m_waitTimer, SIGNAL(timeout()), this, SLOT(onWaitDone()));
 
     m_action = command["action"].toString();
+    m_id = command.value("id");
+
+    m_timeoutTimer.setSingleShot(true);
+    connect(&m_timeoutTimer, SIGNAL(timeout()), this, SLOT(onTimerOut()));
+
+    QtJson::JsonObject error;
+    if (!decodeTimeout(command, timerOut, error)) {
+        writeResponse(error);
+        return;
+    }
+    m_timeoutTimer.setInterval(timerOut);
+    m_timeoutTimer.start();
+}
+
+bool DelayedResponse::decodeTimeout(const QtJson::JsonObject & command,
+                                    int & msecs, QtJson::JsonObject & error) {
+    DelayedResponseArgs args;
+    if (!CommandArgs::decode(command, args, error)) {
+        return false;
+    }
+    if (args.timeout < 0) {
+        error = JsonClient::createError(
+            "InvalidArgument", "Argument `timeout`: expected a positive number");
+        return false;
+    }
+    if (args.hasTimeout) {
+        msecs = qRound(qMin(args.timeout, MaxTimeout) * 1000);
+    }
+    return true;
 }
 
 void DelayedResponse::start() {
+    if (m_hasResponded) {
+        // answered from the constructor
+        deleteLater();
+        return;
+    }
     m_timer.start();
 }
 
-void DelayedResponse::timerCall() {
-    if (!m_hasResponded) {
+bool DelayedResponse::runSynchronously(QtJson::JsonObject & result) {
+    Q_ASSERT(m_synchronous);
+    if (!m_hasResponded && !canRunSynchronously()) {
+        return false;
+    }
+    while (!m_hasResponded && !m_waiting) {
         execute(m_nbCall);
         m_nbCall += 1;
     }
+    if (!m_hasResponded) {
+        return false;
+    }
+    result = m_result;
+    return true;
+}
+
+void DelayedResponse::timerCall() {
+    runStep();
+}
+
+void DelayedResponse::runStep() {
+    if (m_hasResponded) {
+        return;
+    }
+    execute(m_nbCall);
+    m_nbCall += 1;
+    if (!m_hasResponded && !m_waiting && !m_timer.isActive()) {
+        // no condition awaited, back to polling
+        m_timer.start();
+    }
+}
+
+void DelayedResponse::startWaiting() {
+    stopWaiting();
+    m_timer.stop();
+    m_waiting = true;
+    m_waitSequence += 1;
+}
+
+void DelayedResponse::stopWaiting() {
+    m_waiting = false;
+    m_waitTimer.stop();
+    if (m_waitSender) {
+        disconnect(m_waitSender.data(), m_waitSignal.constData(), this,
+                   SLOT(onWaitDone()));
+        disconnect(m_waitSender.data(), SIGNAL(destroyed()), this,
+                   SLOT(onWaitDone()));
+    }
+    m_waitSender.clear();
+    if (m_waitTarget) {
+        m_waitTarget->removeEventFilter(this);
+        disconnect(m_waitTarget.data(), SIGNAL(destroyed()), this,
+                   SLOT(onWaitDone()));
+    }
+    m_waitTarget.clear();
+}
+
+void DelayedResponse::waitForSignal(QObject * sender, const char * signal) {
+    startWaiting();
+    if (!sender) {
+        onWaitDone();
+        return;
+    }
+    m_waitSender = sender;
+    m_waitSignal = signal;
+    connect(sender, signal, this, SLOT(onWaitDone()));
+    connect(sender, SIGNAL(destroyed()), this, SLOT(onWaitDone()));
+}
+
+void DelayedResponse::waitForEvent(QObject * target, QEvent::Type type,
+                                   int maxWait) {
+    startWaiting();
+    if (!target) {
+        onWaitDone();
+        return;
+    }
+    m_waitTarget = target;
+    m_waitEvent = type;
+    target->installEventFilter(this);
+    connect(target, SIGNAL(destroyed()), this, SLOT(onWaitDone()));
+    if (maxWait >= 0) {
+        m_waitTimer.start(maxWait);
+    }
+}
+
+void DelayedResponse::waitForIdle() {
+    startWaiting();
+    // low priority events are delivered after the other posted events
+    QCoreApplication::postEvent(this, new WaitDoneEvent(m_waitSequence),
+                                Qt::LowEventPriority);
+}
+
+void DelayedResponse::waitFor(int msecs) {
+    startWaiting();
+    m_waitTimer.start(msecs);
+}
+
+void DelayedResponse::onWaitDone() {
+    // execute() is never called from within a signal emission or an event
+    // delivery, but from the event loop
+    if (m_waiting) {
+        QCoreApplication::postEvent(this, new WaitDoneEvent(m_waitSequence));
+    }
+}
+
+bool DelayedResponse::event(QEvent * event) {
+    if (event->type() == WaitDoneEvent::eventType()) {
+        if (m_waiting && static_cast<WaitDoneEvent *>(event)->sequence ==
+                             m_waitSequence) {
+            stopWaiting();
+            runStep();
+        }
+        return true;
+    }
+    return QObject::event(event);
+}
+
+bool DelayedResponse::eventFilter(QObject * watched, QEvent * event) {
+    if (m_waiting && watched == m_waitTarget.data() &&
+        event->type() == m_waitEvent) {
+        onWaitDone();
+    }
+    return false;
 }
 
 void DelayedResponse::onTimerOut() {
@@ -72,19 +297,45 @@ void DelayedResponse::onTimerOut() {
     }
 }
 
+void DelayedResponse::writePartialResponse(const QtJson::JsonObject & result) {
+    if (m_hasResponded) {
+        return;
+    }
+    if (m_synchronous) {
+        mergeResponse(m_result, result);
+        return;
+    }
+    QtJson::JsonObject partial(result);
+    partial["partial"] = true;
+    if (!m_client->sendResponse(partial, m_id)) {
+        qDebug() << "unable to serialize result to json" << m_action;
+        m_client->closeConnection();
+        return;
+    }
+    m_timeoutTimer.start();
+}
+
+bool DelayedResponse::canWritePartialResponse() {
+    return m_synchronous || m_client->bytesToWrite() < MaxPendingBytes;
+}
+
 void DelayedResponse::writeResponse(const QtJson::JsonObject & result) {
+    if (m_hasResponded) {
+        // a subclass constructor may answer after an argument error
+        return;
+    }
     m_timer.stop();
+    stopWaiting();
+    m_timeoutTimer.stop();
     emit aboutToWriteResponse(result);
     m_hasResponded = true;
 
-    bool success;
-    QByteArray response = QtJson::serialize(result, success);
-
-    if (!success) {
-        qDebug() << "unable to serialize result to json" << m_action;
-        m_client->protocole()->close();
+    if (m_synchronous) {
+        mergeResponse(m_result, result);
         return;
     }
-
-    m_client->protocole()->sendMessage(response);
+    if (!m_client->sendResponse(result, m_id)) {
+        qDebug() << "unable to serialize result to json" << m_action;
+        m_client->closeConnection();
+    }
 }
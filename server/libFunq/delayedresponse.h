@@ -37,7 +37,9 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 
 #include "jsonclient.h"
 
+#include <QEvent>
 #include <QObject>
+#include <QPointer>
 #include <QTimer>
 
 /**
@@ -50,9 +52,23 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
  * writeResponse() is called. After the writeResponse() call, execute()
  * won't be called again and the object will be deleted automatically.
  *
+ * Instead of being polled, execute() may wait for an event before being
+ * called again: see waitForSignal(), waitForEvent(), waitForIdle() and
+ * waitFor(). The polling goes on once the awaited call returns without
+ * waiting again.
+ *
  * If the writeResponse() method is not called in the given time (timerOut,
  * given in the constructor), an automatic error response will be sent. Default
- * timeout is 20 seconds.
+ * timeout is 20 seconds; a command can change it with a "timeout" argument,
+ * in seconds. An invalid "timeout" is answered with an InvalidArgument error
+ * from the constructor, later writeResponse() calls being ignored.
+ *
+ * Big results may be streamed with writePartialResponse() before the final
+ * writeResponse() call.
+ *
+ * Responses created by JsonClient::callAction() are synchronous: their
+ * result is kept, partial responses merged, to be returned by
+ * runSynchronously() instead of being sent.
  */
 class DelayedResponse : public QObject {
     Q_OBJECT
@@ -74,7 +90,29 @@ public:
      */
     void start();
 
+    /**
+     * @brief Call execute() until a synchronous response is written, and
+     * returns its result. Returns false if the response needs the event
+     * loop, see canRunSynchronously().
+     */
+    bool runSynchronously(QtJson::JsonObject & result);
+
 protected:
+    /**
+     * @brief Returns true if execute() never waits, so that the response can
+     * run to completion without the event loop. False by default.
+     */
+    virtual bool canRunSynchronously() const { return false; }
+
+    /**
+     * @brief Decode the "timeout" argument of a command, in seconds, to
+     * msecs (capped to a day), leaving msecs unchanged if it is missing.
+     * Returns false with an InvalidArgument error if it is not a positive
+     * number.
+     */
+    static bool decodeTimeout(const QtJson::JsonObject & command, int & msecs,
+                              QtJson::JsonObject & error);
+
     /**
      * @brief This needs to be implemented, this is the entry point for
      * answering.
@@ -84,27 +122,88 @@ protected:
      */
     virtual void execute(int call) = 0;
 
+    /**
+     * @brief Call execute() again once the signal of sender is emitted, or
+     * when sender is destroyed.
+     */
+    void waitForSignal(QObject * sender, const char * signal);
+
+    /**
+     * @brief Call execute() again once target received an event of the
+     * given type (for example QEvent::Paint), or after maxWait
+     * milliseconds if maxWait is positive.
+     */
+    void waitForEvent(QObject * target, QEvent::Type type, int maxWait = -1);
+
+    /**
+     * @brief Call execute() again once the events already posted are
+     * processed.
+     */
+    void waitForIdle();
+
+    /**
+     * @brief Call execute() again after msecs milliseconds.
+     */
+    void waitFor(int msecs);
+
+    virtual bool event(QEvent * event);
+    virtual bool eventFilter(QObject * watched, QEvent * event);
+
     /**
      * @brief Returns the response.
      *
      * This call will automatically ask for object deletion.
      */
     void writeResponse(const QtJson::JsonObject & result);
+
+    /**
+     * @brief Send a part of the response, marked with "partial": true.
+     *
+     * Clients merge the parts with the final response: lists are
+     * concatenated and objects are merged. The timeout is restarted.
+     */
+    void writePartialResponse(const QtJson::JsonObject & result);
+
+    /**
+     * @brief Returns false while too much data is waiting to be written to
+     * the client, to keep the buffering bounded.
+     */
+    bool canWritePartialResponse();
+
     JsonClient * jsonClient() { return m_client; }
+    bool hasResponded() const { return m_hasResponded; }
 
 private slots:
     void timerCall();
     void onTimerOut();
+    void onWaitDone();
 
 signals:
     void aboutToWriteResponse(const QtJson::JsonObject &);
 
 private:
+    void runStep();
+    void startWaiting();
+    void stopWaiting();
+
     JsonClient * m_client;
     QTimer m_timer;
+    QTimer m_timeoutTimer;
     QString m_action;
+    QVariant m_id;
     bool m_hasResponded;
     int m_nbCall;
+    bool m_synchronous;
+    QtJson::JsonObject m_result;
+
+    // awaited condition before the next execute() call
+    bool m_waiting;
+    QTimer m_waitTimer;
+    QPointer<QObject> m_waitSender;
+    QByteArray m_waitSignal;
+    QPointer<QObject> m_waitTarget;
+    QEvent::Type m_waitEvent;
+    int m_waitSequence;
 };
 
 #endif  // DELAYEDRESPONSE_H
@@ -113,7 +113,7 @@ void DragNDropResponse::execute(int call) {
                  // mapToGlobal to work
             m_src->repaint();
             m_dest->repaint();
-            setInterval(100);
+            waitForIdle();
             break;
         case 1:  // 1: press event
             m_srcPosGlobal = m_src->mapToGlobal(m_srcPos);
@@ -123,13 +123,13 @@ void DragNDropResponse::execute(int call) {
                             new QMouseEvent(QEvent::MouseButtonPress, m_srcPos,
                                             m_srcPosGlobal, Qt::LeftButton,
                                             Qt::NoButton, Qt::NoModifier));
+            waitForIdle();
             break;
-        case 2: {  // 2: WaitForDragStart
-            setInterval(qApp->startDragTime() + 20);
+        case 2: {  // 2: WaitForDragStart, counted from the press handling
+            waitFor(qApp->startDragTime() + 20);
             break;
         }
         case 3: {  // 3: do some move event
-            setInterval(0);
             QList<QPoint> moves;
             calculate_drag_n_drop_moves(moves, m_srcPosGlobal, m_destPosGlobal,
                                         4);
@@ -144,6 +144,7 @@ void DragNDropResponse::execute(int call) {
                                         Qt::NoModifier));
                 }
             }
+            waitForIdle();
             break;
         }
         case 4: {  // 4: now release the button
@@ -152,6 +153,7 @@ void DragNDropResponse::execute(int call) {
                 new QMouseEvent(QEvent::MouseButtonRelease, m_destPos,
                                 m_destPosGlobal, Qt::LeftButton, Qt::NoButton,
                                 Qt::NoModifier));
+            waitForIdle();
             break;
         }
         case 5:  // and reply
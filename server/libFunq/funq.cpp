@@ -34,13 +34,14 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 
 #include "funq.h"
 
+#include "jsonchannel.h"
+#include "networkserver.h"
 #include "pick.h"
 #include "player.h"
 
 #include <QCoreApplication>
 #include <QEvent>
-#include <QTcpServer>
-#include <QTcpSocket>
+#include <QThread>
 #include <QTimer>
 
 #define DEFAUT_HOOQ_PORT 9999
@@ -52,12 +53,15 @@ extern Q_GUI_EXPORT bool qt_use_native_dialogs;
 /*static*/
 Funq * Funq::_instance = 0;
 
-Funq::Funq(Funq::MODE mode, const QHostAddress & host, int port)
+Funq::Funq(Funq::MODE mode, const QHostAddress & host, int port,
+           const QString & socketPath)
     : QObject(),
       m_mode(mode),
       m_port(port),
       m_host(host),
-      m_server(0),
+      m_socketPath(socketPath),
+      m_network(0),
+      m_ioThread(0),
       m_pick(0) {
     Q_ASSERT(!_instance);
     _instance = this;
@@ -70,18 +74,35 @@ Funq::Funq(Funq::MODE mode, const QHostAddress & host, int port)
     QTimer::singleShot(0, this, SLOT(funqInit()));
 }
 
+Funq::~Funq() {
+    // channels of the players are deleted in the I/O thread, so it must be
+    // running when players are deleted
+    qDeleteAll(findChildren<Player *>(QString(), Qt::FindDirectChildrenOnly));
+    if (m_ioThread) {
+        m_ioThread->quit();
+        m_ioThread->wait();
+    }
+}
+
 void Funq::funqInit() {
     if (m_mode == Funq::PLAYER) {
-        m_server = new QTcpServer(this);
-        connect(m_server, SIGNAL(newConnection()), this,
-                SLOT(onNewConnection()));
-        if (!m_server->listen(m_host, m_port)) {
-            qDebug() << "Unable to initialize funq. Error:\n\t"
-                     << m_server->errorString();
+        CommandRegistry::loadPlugins();
+        m_network = new NetworkServer(m_host, m_port, m_socketPath);
+        connect(m_network, SIGNAL(newConnection(JsonChannel *)), this,
+                SLOT(onNewConnection(JsonChannel *)));
+        const char * env_thread = getenv("FUNQ_IO_THREAD");
+        if (env_thread && strcmp(env_thread, "0") == 0) {
+            m_network->setParent(this);
         } else {
-            qDebug() << "funq is initialized on host " << m_host.toString()
-                     << " and on port " << m_port << ".";
+            // sockets, framing and json encoding are handled in a dedicated
+            // thread, only the commands are executed in the GUI thread
+            m_ioThread = new QThread(this);
+            m_network->moveToThread(m_ioThread);
+            connect(m_ioThread, SIGNAL(finished()), m_network,
+                    SLOT(deleteLater()));
+            m_ioThread->start();
         }
+        QMetaObject::invokeMethod(m_network, "listen", Qt::QueuedConnection);
     } else {
         m_pick = new Pick(new PickFormatter);
         if (registerPick()) {
@@ -92,12 +113,13 @@ void Funq::funqInit() {
     }
 }
 
-void Funq::onNewConnection() {
-    QTcpSocket * socket = m_server->nextPendingConnection();
-    Player * player = new Player(socket, this);
-
-    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
-    connect(socket, SIGNAL(destroyed()), player, SLOT(deleteLater()));
+void Funq::onNewConnection(JsonChannel * channel) {
+    Player * player = new Player(channel, this);
+    connect(channel, SIGNAL(closed()), player, SLOT(deleteLater()));
+    // the connection may be closed before the signal is connected
+    if (!channel->isOpen()) {
+        player->deleteLater();
+    }
 }
 
 void Funq::active_hook_player(Funq::MODE mode) {
@@ -121,7 +143,13 @@ void Funq::active_hook_player(Funq::MODE mode) {
         }
     }
 
-    Funq * hook = new Funq(mode, host, port);
+    QString socketPath;
+    const char * env_socket = getenv("FUNQ_SOCKET");
+    if (env_socket) {
+        socketPath = QString::fromLocal8Bit(env_socket);
+    }
+
+    Funq * hook = new Funq(mode, host, port, socketPath);
 
     QObject::connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), hook,
                      SLOT(deleteLater()));
@@ -151,6 +179,12 @@ bool Funq::eventFilter(QObject * receiver, QEvent * event) {
     return handled;
 }
 
+/* static */
+void Funq::registerCommand(const QString & name,
+                           const CommandHandler & handler) {
+    CommandRegistry::registerCommand(name, handler);
+}
+
 void Funq::activate(bool check_activation) {
     if (check_activation) {
         const char * env_activation = getenv("FUNQ_ACTIVATION");
@@ -35,27 +35,43 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 #ifndef FUNQ_H
 #define FUNQ_H
 
+#include "commandregistry.h"
+
 #include <QHostAddress>
 #include <QObject>
 
-class QTcpServer;
+class JsonChannel;
+class NetworkServer;
 class Pick;
+class QThread;
 
 class Funq : public QObject {
     Q_OBJECT
 public:
     static void activate(bool check_activation = false);
 
+    /**
+     * @brief Add a command available to funq clients, see CommandRegistry.
+     */
+    static void registerCommand(const QString & name,
+                                const CommandHandler & handler);
+
     enum MODE { PLAYER, PICK };
 
 protected:
-    explicit Funq(MODE mode, const QHostAddress & host, int port);
+    /**
+     * @brief When socketPath is not empty, a local socket (unix domain socket
+     * or windows named pipe) is used instead of the tcp host and port.
+     */
+    explicit Funq(MODE mode, const QHostAddress & host, int port,
+                  const QString & socketPath = QString());
+    ~Funq();
     bool eventFilter(QObject * receiver, QEvent * event);
 
 signals:
 
 private slots:
-    void onNewConnection();
+    void onNewConnection(JsonChannel * channel);
     void funqInit();
 
 private:
@@ -69,7 +85,9 @@ private:
     MODE m_mode;
     int m_port;
     QHostAddress m_host;
-    QTcpServer * m_server;
+    QString m_socketPath;
+    NetworkServer * m_network;
+    QThread * m_ioThread;
     Pick * m_pick;
 };
 
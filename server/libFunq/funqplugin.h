@@ -0,0 +1,73 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef FUNQPLUGIN_H
+#define FUNQPLUGIN_H
+
+#include <QtPlugin>
+
+/**
+ * @brief Interface of the Qt plugins listed in the FUNQ_PLUGINS environment
+ * variable, allowing applications where libFunq is injected to add their
+ * own commands.
+ *
+ * Example:
+ *
+ * @code
+ * class MyPlugin : public QObject, public FunqPluginInterface {
+ *     Q_OBJECT
+ *     Q_PLUGIN_METADATA(IID FunqPluginInterface_iid)
+ *     Q_INTERFACES(FunqPluginInterface)
+ * public:
+ *     void registerCommands() {
+ *         CommandRegistry::registerCommand("my_command", myCommand);
+ *     }
+ * };
+ * @endcode
+ */
+class FunqPluginInterface {
+public:
+    virtual ~FunqPluginInterface() {}
+
+    /**
+     * @brief Called once the plugin is loaded, in the GUI thread.
+     */
+    virtual void registerCommands() = 0;
+};
+
+#define FunqPluginInterface_iid "org.funq.FunqPluginInterface/1.0"
+
+Q_DECLARE_INTERFACE(FunqPluginInterface, FunqPluginInterface_iid)
+
+#endif  // FUNQPLUGIN_H
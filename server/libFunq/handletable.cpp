@@ -0,0 +1,259 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "handletable.h"
+
+// handle layout: generation (29 bits) | index + 1 (24 bits)
+static const int IndexBits = 24;
+static const qulonglong IndexMask = (Q_UINT64_C(1) << IndexBits) - 1;
+static const quint32 GenerationMask = (1u << 29) - 1;
+
+static const int MinCollectThreshold = 64;
+static const int DefaultMaxHandles = 100000;
+
+HandleTable::HandleTable()
+    : m_collectThreshold(MinCollectThreshold),
+      m_maxHandles(DefaultMaxHandles),
+      m_mostRecent(-1),
+      m_leastRecent(-1),
+      m_lastScope(0),
+      m_released(0),
+      m_evicted(0),
+      m_collected(0) {
+    bool ok = false;
+    int maxHandles = qgetenv("FUNQ_MAX_HANDLES").toInt(&ok);
+    if (ok) {
+        setMaxHandles(maxHandles);
+    }
+}
+
+qulonglong HandleTable::handle(int index) const {
+    return (qulonglong(m_slots[index].generation) << IndexBits) |
+           qulonglong(index + 1);
+}
+
+qulonglong HandleTable::insert(QObject * object) {
+    if (!object) {
+        return 0;
+    }
+    QHash<QObject *, int>::const_iterator it = m_indexes.constFind(object);
+    if (it != m_indexes.constEnd()) {
+        int index = it.value();
+        if (m_slots[index].object.data() == object) {
+            unlink(index);
+            link(index);
+            return handle(index);
+        }
+        // a destroyed object had the same address
+        free(index);
+        m_collected += 1;
+    }
+    if (m_free.isEmpty() && m_slots.count() >= m_collectThreshold) {
+        collect();
+    }
+    while (m_maxHandles > 0 && m_indexes.count() >= m_maxHandles) {
+        // destroyed objects are never used, so they are evicted first
+        int index = m_leastRecent;
+        if (m_slots[index].object) {
+            m_evicted += 1;
+        } else {
+            m_collected += 1;
+        }
+        free(index);
+    }
+    int index;
+    if (!m_free.isEmpty()) {
+        index = m_free.takeLast();
+    } else {
+        if (qulonglong(m_slots.count()) >= IndexMask) {
+            return 0;  // table full
+        }
+        index = m_slots.count();
+        m_slots.append(Slot());
+    }
+    Slot & slot = m_slots[index];
+    slot.object = object;
+    slot.address = object;
+    slot.scope = m_scopes.isEmpty() ? 0 : m_scopes.last();
+    m_indexes.insert(object, index);
+    link(index);
+    return handle(index);
+}
+
+QObject * HandleTable::find(qulonglong handle, Status * status) {
+    Status result = Unknown;
+    QObject * object = 0;
+    qulonglong index = (handle & IndexMask);
+    if (index > 0 && index <= qulonglong(m_slots.count())) {
+        const Slot & slot = m_slots[int(index - 1)];
+        if ((handle >> IndexBits) != slot.generation) {
+            result = Stale;
+        } else if (!slot.address) {
+            result = Unknown;  // released, not reused yet
+        } else {
+            object = slot.object.data();
+            result = object ? Valid : Destroyed;
+        }
+    }
+    if (object) {
+        unlink(int(index - 1));
+        link(int(index - 1));
+    }
+    if (status) {
+        *status = result;
+    }
+    return object;
+}
+
+bool HandleTable::release(qulonglong handle) {
+    qulonglong index = (handle & IndexMask);
+    if (index == 0 || index > qulonglong(m_slots.count())) {
+        return false;
+    }
+    const Slot & slot = m_slots[int(index - 1)];
+    if ((handle >> IndexBits) != slot.generation || !slot.address) {
+        return false;
+    }
+    free(int(index - 1));
+    m_released += 1;
+    return true;
+}
+
+void HandleTable::releaseAll() {
+    for (int i = 0; i < m_slots.count(); ++i) {
+        if (m_slots[i].address) {
+            free(i);
+            m_released += 1;
+        }
+    }
+}
+
+quint32 HandleTable::openScope() {
+    m_lastScope += 1;
+    if (m_lastScope == 0) {
+        m_lastScope = 1;  // 0 is "no scope"
+    }
+    m_scopes.append(m_lastScope);
+    return m_lastScope;
+}
+
+int HandleTable::closeScope(quint32 scope) {
+    int position = m_scopes.indexOf(scope);
+    if (position < 0) {
+        return -1;
+    }
+    m_scopes.remove(position);
+    int released = 0;
+    for (int i = 0; i < m_slots.count(); ++i) {
+        if (m_slots[i].address && m_slots[i].scope == scope) {
+            free(i);
+            released += 1;
+        }
+    }
+    m_released += released;
+    return released;
+}
+
+void HandleTable::setMaxHandles(int maxHandles) {
+    m_maxHandles = qMax(0, maxHandles);
+}
+
+HandleTable::Stats HandleTable::stats() const {
+    Stats stats;
+    stats.count = m_indexes.count();
+    stats.capacity = m_slots.count();
+    stats.destroyed = 0;
+    foreach (const Slot & slot, m_slots) {
+        if (slot.address && !slot.object) {
+            stats.destroyed += 1;
+        }
+    }
+    stats.openScopes = m_scopes.count();
+    stats.maxHandles = m_maxHandles;
+    stats.released = m_released;
+    stats.evicted = m_evicted;
+    stats.collected = m_collected;
+    return stats;
+}
+
+void HandleTable::free(int index) {
+    Slot & slot = m_slots[index];
+    unlink(index);
+    m_indexes.remove(slot.address);
+    slot.object.clear();
+    slot.address = 0;
+    slot.scope = 0;
+    slot.generation = (slot.generation % GenerationMask) + 1;
+    m_free.append(index);
+}
+
+void HandleTable::collect() {
+    for (int i = 0; i < m_slots.count(); ++i) {
+        if (m_slots[i].address && !m_slots[i].object) {
+            free(i);
+            m_collected += 1;
+        }
+    }
+    // amortize the scans: wait for the table to double before the next one
+    m_collectThreshold = qMax(MinCollectThreshold, 2 * m_indexes.count());
+}
+
+void HandleTable::link(int index) {
+    Slot & slot = m_slots[index];
+    slot.previous = -1;
+    slot.next = m_mostRecent;
+    if (m_mostRecent >= 0) {
+        m_slots[m_mostRecent].previous = index;
+    }
+    m_mostRecent = index;
+    if (m_leastRecent < 0) {
+        m_leastRecent = index;
+    }
+}
+
+void HandleTable::unlink(int index) {
+    Slot & slot = m_slots[index];
+    if (slot.previous >= 0) {
+        m_slots[slot.previous].next = slot.next;
+    } else {
+        m_mostRecent = slot.next;
+    }
+    if (slot.next >= 0) {
+        m_slots[slot.next].previous = slot.previous;
+    } else {
+        m_leastRecent = slot.previous;
+    }
+    slot.previous = -1;
+    slot.next = -1;
+}
@@ -0,0 +1,158 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef HANDLETABLE_H
+#define HANDLETABLE_H
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QVector>
+
+/**
+ * @brief Table of the objects referenced by the clients, giving them
+ * handles made of a slot index and a generation.
+ *
+ * A slot is reused once its object is destroyed or its handle released,
+ * with a new generation: an old handle is then detected as stale instead of
+ * designating the new object. Handles fit in 53 bits so that javascript
+ * numbers can hold them, and 0 is never a valid handle.
+ *
+ * Objects are tracked with QPointer, so registering an object costs no
+ * signal connection. The slots of destroyed objects are collected when the
+ * table would grow, and the least recently used handles are released when
+ * the table holds more than maxHandles() objects.
+ *
+ * Handles created while a scope is open belong to it, and are released
+ * when it is closed.
+ */
+class HandleTable {
+public:
+    enum Status {
+        Valid,
+        Unknown,   // never given, or 0
+        Stale,     // released since, or the slot has been reused
+        Destroyed  // the object has been destroyed
+    };
+
+    struct Stats {
+        int count;       // slots in use
+        int capacity;    // allocated slots
+        int destroyed;   // slots of destroyed objects, not collected yet
+        int openScopes;
+        int maxHandles;
+        qulonglong released;  // explicitly, or with a scope
+        qulonglong evicted;   // least recently used above maxHandles
+        qulonglong collected; // destroyed objects
+    };
+
+    HandleTable();
+
+    /**
+     * @brief Returns the handle of an object, registering it if needed.
+     * Always returns the same handle for a registered living object.
+     */
+    qulonglong insert(QObject * object);
+
+    /**
+     * @brief Returns the object of a handle, or 0. Never inserts anything,
+     * only marks the handle as recently used.
+     */
+    QObject * find(qulonglong handle, Status * status = 0);
+
+    /**
+     * @brief Release a handle. Returns false if it was not in use.
+     */
+    bool release(qulonglong handle);
+    void releaseAll();
+
+    /**
+     * @brief Open a scope for the next insertions, and returns its token.
+     */
+    quint32 openScope();
+
+    /**
+     * @brief Close a scope and release its handles. Returns the number of
+     * released handles, or -1 for an unknown scope.
+     */
+    int closeScope(quint32 scope);
+
+    /**
+     * @brief Maximum number of handles (0 for no limit). Defaults to the
+     * FUNQ_MAX_HANDLES environment variable, or 100000.
+     */
+    int maxHandles() const { return m_maxHandles; }
+    void setMaxHandles(int maxHandles);
+
+    /**
+     * @brief Number of slots in use, destroyed objects not collected yet
+     * included.
+     */
+    int count() const { return m_indexes.count(); }
+    Stats stats() const;
+
+private:
+    struct Slot {
+        Slot()
+            : address(0), generation(1), scope(0), previous(-1), next(-1) {}
+        QPointer<QObject> object;
+        QObject * address;  // key in m_indexes, even once destroyed
+        quint32 generation;
+        quint32 scope;
+        // least recently used list
+        int previous;
+        int next;
+    };
+
+    qulonglong handle(int index) const;
+    void free(int index);
+    void collect();
+    void link(int index);
+    void unlink(int index);
+
+    QVector<Slot> m_slots;
+    QVector<int> m_free;
+    QHash<QObject *, int> m_indexes;
+    int m_collectThreshold;
+    int m_maxHandles;
+    int m_mostRecent;
+    int m_leastRecent;
+    QVector<quint32> m_scopes;
+    quint32 m_lastScope;
+    qulonglong m_released;
+    qulonglong m_evicted;
+    qulonglong m_collected;
+};
+
+#endif  // HANDLETABLE_H
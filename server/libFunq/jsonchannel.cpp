@@ -0,0 +1,350 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "jsonchannel.h"
+
+#include "jsonclient.h"
+#include "protocole.h"
+#include "sharedbuffer.h"
+
+#include <QAbstractSocket>
+#include <QDebug>
+#include <QLocalSocket>
+#include <QMetaType>
+
+#include <limits>
+
+/**
+ * @brief Replace the "*_attachment" indexes of an object, and of the objects
+ * it contains, by the base64 encoded data.
+ */
+static void embed_attachments(QtJson::JsonObject & object,
+                              const QList<QByteArray> & attachments) {
+    const QString suffix = QString::fromLatin1("_attachment");
+    foreach (const QString & key, object.keys()) {
+        if (key.endsWith(suffix)) {
+            int index = object.take(key).toInt();
+            object[key.left(key.length() - suffix.length())] =
+                attachments.value(index).toBase64();
+            continue;
+        }
+        QVariant & value = object[key];
+        if (value.type() == QVariant::Map) {
+            QtJson::JsonObject child = value.toMap();
+            embed_attachments(child, attachments);
+            value = child;
+        } else if (value.type() == QVariant::List) {
+            QVariantList children = value.toList();
+            for (int i = 0; i < children.count(); ++i) {
+                if (children.at(i).type() == QVariant::Map) {
+                    QtJson::JsonObject child = children.at(i).toMap();
+                    embed_attachments(child, attachments);
+                    children[i] = child;
+                }
+            }
+            value = children;
+        }
+    }
+}
+
+JsonChannel::JsonChannel(QIODevice * device, QObject * parent)
+    : QObject(parent),
+      m_device(device),
+      m_protocole(new Protocole(this)),
+      m_sharedBuffer(0),
+      m_sharedThreshold(0),
+      m_pendingCommands(0),
+      m_dispatchDepth(0),
+      m_processScheduled(false),
+      m_open(1),
+      m_bytesToWrite(0) {
+    // required to queue the calls between the channel and its client
+    qRegisterMetaType<QtJson::JsonObject>("QtJson::JsonObject");
+    qRegisterMetaType<QList<QByteArray> >("QList<QByteArray>");
+    connect(m_protocole, SIGNAL(messageReceived()), this,
+            SLOT(processMessages()));
+    connect(m_protocole, SIGNAL(frameTooLarge(qint64)), this,
+            SLOT(onFrameTooLarge(qint64)));
+}
+
+JsonChannel::~JsonChannel() {
+    delete m_protocole;
+    delete m_sharedBuffer;
+}
+
+void JsonChannel::start() {
+    QIODevice * device = m_device.data();
+    if (!device) {
+        onDeviceClosed();
+        return;
+    }
+    connect(device, SIGNAL(aboutToClose()), this, SLOT(onDeviceClosed()));
+    connect(device, SIGNAL(bytesWritten(qint64)), this,
+            SLOT(onBytesWritten()));
+    if (qobject_cast<QAbstractSocket *>(device) ||
+        qobject_cast<QLocalSocket *>(device)) {
+        connect(device, SIGNAL(disconnected()), this, SLOT(onDeviceClosed()));
+    }
+    m_protocole->setDevice(device);
+    if (!device->isOpen()) {
+        onDeviceClosed();
+    } else if (device->bytesAvailable() > 0) {
+        // data received before the client was ready
+        QMetaObject::invokeMethod(device, "readyRead", Qt::QueuedConnection);
+    }
+}
+
+void JsonChannel::processMessages() {
+    m_processScheduled = false;
+    // may be reentered from a nested event loop run by a command (like a
+    // modal dialog) when the client lives in the channel thread
+    ++m_dispatchDepth;
+    while (m_pendingCommands < MaxPendingCommands &&
+           m_protocole->hasAvailableMessage()) {
+        QByteArray data = m_protocole->nextAvailableMessage();
+        bool success = false;
+        QVariant message = QtJson::parse(data, success);
+        if (!success) {
+            qDebug() << "Unable to parse Json data. received:";
+            qDebug() << data;
+            close();
+            break;
+        }
+        ++m_pendingCommands;
+        if (m_protocole->hasAvailableMessage()) {
+            // dispatched from a nested event loop if the command runs one
+            scheduleProcessing();
+        }
+        emit commandReceived(message.value<QtJson::JsonObject>());
+    }
+    --m_dispatchDepth;
+}
+
+void JsonChannel::scheduleProcessing() {
+    if (!m_processScheduled) {
+        m_processScheduled = true;
+        QMetaObject::invokeMethod(this, "processMessages",
+                                  Qt::QueuedConnection);
+    }
+}
+
+void JsonChannel::commandProcessed() {
+    if (m_pendingCommands > 0) {
+        --m_pendingCommands;
+    }
+    if (m_dispatchDepth == 0) {
+        processMessages();
+    } else if (m_protocole->hasAvailableMessage()) {
+        // the running dispatch loop may be blocked by a nested event loop,
+        // or stopped by the pending commands limit
+        scheduleProcessing();
+    }
+}
+
+void JsonChannel::onFrameTooLarge(qint64 size) {
+    // the request is not read, so its id is unknown
+    sendResponse(
+        JsonClient::createError(
+            "FrameTooLarge",
+            QString::fromUtf8(
+                "A frame of %1 bytes was dropped, the maximum is %2")
+                .arg(size)
+                .arg(m_protocole->maxFrameSize())),
+        QVariant(), QList<QByteArray>());
+}
+
+void JsonChannel::onBytesWritten() {
+    qint64 pending = m_device ? m_device->bytesToWrite() : 0;
+    m_bytesToWrite.storeRelease(
+        int(qMin<qint64>(pending, std::numeric_limits<int>::max())));
+}
+
+void JsonChannel::onDeviceClosed() {
+    if (m_open.testAndSetOrdered(1, 0)) {
+        emit closed();
+    }
+}
+
+void JsonChannel::close() {
+    m_protocole->close();
+    onDeviceClosed();
+}
+
+bool JsonChannel::sendResponse(const QtJson::JsonObject & result,
+                               const QVariant & id,
+                               const QList<QByteArray> & attachments) {
+    QtJson::JsonObject response(result);
+    if (id.isValid()) {
+        response["id"] = id;
+    }
+    QList<QByteArray> frames;
+    if (m_protocole->framing() == Protocole::BinaryFraming) {
+        frames = attachments;
+    } else if (!attachments.isEmpty()) {
+        // raw frames are not available, embed the attachments
+        embed_attachments(response, attachments);
+    }
+    bool success = false;
+    QByteArray data = QtJson::serialize(response, success);
+    if (!success) {
+        qDebug() << "unable to serialize result to json";
+        close();
+        return false;
+    }
+    if (m_sharedBuffer && data.size() >= m_sharedThreshold) {
+        QtJson::JsonObject descriptor = m_sharedBuffer->write(data, "JSON");
+        if (!descriptor.isEmpty()) {
+            QtJson::JsonObject stub;
+            stub["_shm"] = descriptor;
+            if (id.isValid()) {
+                stub["id"] = id;
+            }
+            data = QtJson::serialize(stub, success);
+        }
+    }
+    m_protocole->sendMessage(data, frames);
+    onBytesWritten();
+    return true;
+}
+
+bool JsonChannel::enableSharedBuffer(qint64 capacity, int threshold) {
+    if (!m_sharedBuffer || m_sharedBuffer->capacity() != capacity) {
+        delete m_sharedBuffer;
+        m_sharedBuffer = new SharedBuffer(capacity);
+    }
+    m_sharedThreshold = threshold;
+    if (!m_sharedBuffer->isValid()) {
+        disableSharedBuffer();
+        return false;
+    }
+    return true;
+}
+
+void JsonChannel::disableSharedBuffer() {
+    delete m_sharedBuffer;
+    m_sharedBuffer = 0;
+}
+
+QtJson::JsonObject JsonChannel::negotiate(const QtJson::JsonObject & command) {
+    Protocole::Framing framing = m_protocole->framing();
+    if (command.contains("framing")) {
+        QString name = command["framing"].toString();
+        if (name == "binary") {
+            framing = Protocole::BinaryFraming;
+        } else if (name == "text") {
+            framing = Protocole::TextFraming;
+        } else {
+            return JsonClient::createError(
+                "InvalidFraming",
+                QString::fromUtf8("The framing `%1` is unknown").arg(name));
+        }
+        // the answer is sent with the current framing
+        m_protocole->setFramingAfterNextMessage(framing);
+    }
+    if (command.contains("compression")) {
+        QString name = command["compression"].toString();
+        Protocole::Compression compression;
+        if (name == "zlib") {
+            compression = Protocole::ZlibCompression;
+        } else if (name == "none") {
+            compression = Protocole::NoCompression;
+        } else {
+            return JsonClient::createError(
+                "InvalidCompression",
+                QString::fromUtf8("The compression `%1` is unknown")
+                    .arg(name));
+        }
+        if (compression != Protocole::NoCompression &&
+            framing != Protocole::BinaryFraming) {
+            return JsonClient::createError(
+                "CompressionRequiresBinaryFraming",
+                "Compression is only available with the binary framing");
+        }
+        int threshold = command.value("compression_threshold",
+                                      Protocole::DefaultCompressionThreshold)
+                            .toInt();
+        int level = command.value("compression_level", -1).toInt();
+        if (level < -1 || level > 9) {
+            return JsonClient::createError(
+                "InvalidCompression",
+                QString::fromUtf8("Invalid compression level %1").arg(level));
+        }
+        m_protocole->setCompression(compression, threshold, level);
+    }
+    if (command.contains("bulk")) {
+        QString name = command["bulk"].toString();
+        if (name == "shm") {
+            qint64 size = command.value("bulk_size",
+                                        SharedBuffer::DefaultCapacity)
+                              .toLongLong();
+            int threshold = command.value("bulk_threshold", 65536).toInt();
+            if (size <= 0 || !enableSharedBuffer(size, threshold)) {
+                return JsonClient::createError(
+                    "SharedBufferUnavailable",
+                    "Unable to create the shared buffer for bulk data");
+            }
+        } else if (name == "none") {
+            disableSharedBuffer();
+        } else {
+            return JsonClient::createError(
+                "InvalidBulkChannel",
+                QString::fromUtf8("The bulk channel `%1` is unknown")
+                    .arg(name));
+        }
+    }
+    QtJson::JsonObject result;
+    result["framing"] =
+        framing == Protocole::BinaryFraming ? "binary" : "text";
+    result["compression"] =
+        m_protocole->compression() == Protocole::ZlibCompression ? "zlib"
+                                                                 : "none";
+    result["compression_threshold"] = m_protocole->compressionThreshold();
+    result["bulk"] = m_sharedBuffer ? "shm" : "none";
+    if (m_sharedBuffer) {
+        result["bulk_name"] = m_sharedBuffer->path();
+    }
+    return result;
+}
+
+QtJson::JsonObject JsonChannel::stats() {
+    const Protocole::Stats & stats = m_protocole->stats();
+    QtJson::JsonObject result;
+    result["received_frames"] = stats.receivedFrames;
+    result["received_bytes"] = stats.receivedBytes;
+    result["dropped_frames"] = stats.droppedFrames;
+    result["oversized_frames"] = stats.oversizedFrames;
+    result["read_pauses"] = stats.readPauses;
+    result["max_frame_size"] = m_protocole->maxFrameSize();
+    return result;
+}
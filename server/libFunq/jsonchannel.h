@@ -0,0 +1,138 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef JSONCHANNEL_H
+#define JSONCHANNEL_H
+
+#include "json.h"
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+
+class Protocole;
+class SharedBuffer;
+
+/**
+ * @brief The network side of a JsonClient: it frames the data of a device
+ * with a Protocole, parses the received commands and serializes the
+ * responses.
+ *
+ * A JsonChannel may live in a dedicated I/O thread, the JsonClient calling
+ * its slots with queued connections, so that big messages do not stall the
+ * Qt main loop. isOpen(), bytesToWrite() and sharedBuffer() may be called
+ * from any thread.
+ */
+class JsonChannel : public QObject {
+    Q_OBJECT
+public:
+    enum { MaxPendingCommands = 16 };
+
+    explicit JsonChannel(QIODevice * device, QObject * parent = 0);
+    ~JsonChannel();
+
+    /**
+     * @brief Returns the protocole, only usable from the thread of the
+     * channel.
+     */
+    Protocole * protocole() { return m_protocole; }
+
+    bool isOpen() const { return m_open.loadAcquire(); }
+    qint64 bytesToWrite() const { return m_bytesToWrite.loadAcquire(); }
+    SharedBuffer * sharedBuffer() const { return m_sharedBuffer; }
+
+public slots:
+    /**
+     * @brief Start reading the commands from the device.
+     */
+    void start();
+
+    /**
+     * @brief Serialize and send a response with its attachments.
+     *
+     * The attachments are referenced by result[key + "_attachment"]. They
+     * are sent as raw frames with the binary framing, else they are base64
+     * encoded in result[key].
+     *
+     * The connection is closed if the response can not be serialized.
+     */
+    bool sendResponse(const QtJson::JsonObject & result, const QVariant & id,
+                      const QList<QByteArray> & attachments);
+
+    /**
+     * @brief Change the framing, compression and bulk channel options.
+     */
+    QtJson::JsonObject negotiate(const QtJson::JsonObject & command);
+
+    QtJson::JsonObject stats();
+
+    bool enableSharedBuffer(qint64 capacity, int threshold);
+    void disableSharedBuffer();
+
+    /**
+     * @brief Must be called once a received command has been handled, so
+     * that the next one is parsed.
+     */
+    void commandProcessed();
+
+    void close();
+
+signals:
+    void commandReceived(const QtJson::JsonObject & command);
+    void closed();
+
+private slots:
+    void processMessages();
+    void onFrameTooLarge(qint64 size);
+    void onBytesWritten();
+    void onDeviceClosed();
+
+private:
+    void scheduleProcessing();
+
+    QPointer<QIODevice> m_device;
+    Protocole * m_protocole;
+    SharedBuffer * m_sharedBuffer;
+    int m_sharedThreshold;
+    int m_pendingCommands;
+    int m_dispatchDepth;
+    bool m_processScheduled;
+    QAtomicInt m_open;
+    QAtomicInt m_bytesToWrite;
+};
+
+#endif  // JSONCHANNEL_H
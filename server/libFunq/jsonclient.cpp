@@ -35,92 +35,220 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 #include "jsonclient.h"
 
 #include "delayedresponse.h"
-#include "protocole.h"
+#include "jsonchannel.h"
+#include "sharedbuffer.h"
 
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QMetaMethod>
+#include <QThread>
+
+#include <cstring>
 
 JsonClient::JsonClient(QIODevice * device, QObject * parent)
-    : QObject(parent), m_protocole(new Protocole(this)) {
-    m_protocole->setDevice(device);
-    connect(m_protocole, SIGNAL(messageReceived()), this,
-            SLOT(onMessageReceived()));
+    : QObject(parent),
+      m_channel(new JsonChannel(device)),
+      m_callingAction(false) {
+    init();
+}
+
+JsonClient::JsonClient(JsonChannel * channel, QObject * parent)
+    : QObject(parent), m_channel(channel), m_callingAction(false) {
+    init();
+}
+
+void JsonClient::init() {
+    connect(m_channel, SIGNAL(commandReceived(const QtJson::JsonObject &)),
+            this, SLOT(onCommandReceived(const QtJson::JsonObject &)));
+    QMetaObject::invokeMethod(m_channel, "start", Qt::AutoConnection);
 }
 
 JsonClient::~JsonClient() {
-    delete m_protocole;
+    if (m_channel->thread() == QThread::currentThread()) {
+        delete m_channel;
+    } else {
+        m_channel->deleteLater();
+    }
 }
 
-void JsonClient::onMessageReceived() {
-    QByteArray data = m_protocole->nextAvailableMessage();
-    bool success = false;
-    QVariant message = QtJson::parse(data, success);
-    if (!success) {
-        qDebug() << "Unable to parse Json data. received:";
-        qDebug() << data;
-        m_protocole->close();
-        return;
+Qt::ConnectionType JsonClient::blockingConnection() const {
+    return m_channel->thread() == QThread::currentThread()
+               ? Qt::DirectConnection
+               : Qt::BlockingQueuedConnection;
+}
+
+Protocole * JsonClient::protocole() {
+    return m_channel->protocole();
+}
+
+SharedBuffer * JsonClient::sharedBuffer() {
+    return m_channel->sharedBuffer();
+}
+
+bool JsonClient::enableSharedBuffer(qint64 capacity, int threshold) {
+    bool result = false;
+    QMetaObject::invokeMethod(m_channel, "enableSharedBuffer",
+                              blockingConnection(), Q_RETURN_ARG(bool, result),
+                              Q_ARG(qint64, capacity), Q_ARG(int, threshold));
+    return result;
+}
+
+void JsonClient::disableSharedBuffer() {
+    QMetaObject::invokeMethod(m_channel, "disableSharedBuffer",
+                              blockingConnection());
+}
+
+QtJson::JsonObject JsonClient::negotiateChannel(
+    const QtJson::JsonObject & command) {
+    QtJson::JsonObject result;
+    QMetaObject::invokeMethod(m_channel, "negotiate", blockingConnection(),
+                              Q_RETURN_ARG(QtJson::JsonObject, result),
+                              Q_ARG(QtJson::JsonObject, command));
+    return result;
+}
+
+QtJson::JsonObject JsonClient::channelStats() {
+    QtJson::JsonObject result;
+    QMetaObject::invokeMethod(m_channel, "stats", blockingConnection(),
+                              Q_RETURN_ARG(QtJson::JsonObject, result));
+    return result;
+}
+
+qint64 JsonClient::bytesToWrite() const {
+    return m_channel->bytesToWrite();
+}
+
+void JsonClient::closeConnection() {
+    QMetaObject::invokeMethod(m_channel, "close", Qt::AutoConnection);
+}
+
+namespace {
+
+struct ActionMethod {
+    QMetaMethod method;
+    bool delayed;
+};
+
+typedef QHash<QString, ActionMethod> ActionTable;
+
+/**
+ * @brief Returns the actions of a JsonClient subclass, indexed by name. The
+ * table is built once per meta object.
+ */
+const ActionTable & actionTable(const QMetaObject * metaObject) {
+    // only used from the GUI thread
+    static QHash<const QMetaObject *, ActionTable> tables;
+    QHash<const QMetaObject *, ActionTable>::iterator it =
+        tables.find(metaObject);
+    if (it != tables.end()) {
+        return it.value();
+    }
+    ActionTable table;
+    for (int i = metaObject->methodOffset(); i < metaObject->methodCount();
+         ++i) {
+        QMetaMethod method = metaObject->method(i);
+        QString name = QString::fromLatin1(method.name());
+        // the first method wins when an action is overloaded
+        if (!table.contains(name)) {
+            ActionMethod action;
+            action.method = method;
+            action.delayed =
+                strcmp(method.typeName(), "QtJson::JsonObject") != 0;
+            table[name] = action;
+        }
     }
+    return tables.insert(metaObject, table).value();
+}
+
+}  // namespace
+
+void JsonClient::onCommandReceived(const QtJson::JsonObject & command) {
+    executeCommand(command);
+    // let the channel parse the next command
+    QMetaObject::invokeMethod(m_channel, "commandProcessed",
+                              Qt::AutoConnection);
+}
 
-    QtJson::JsonObject command = message.value<QtJson::JsonObject>();
+void JsonClient::executeCommand(const QtJson::JsonObject & command) {
+    // optional request id, echoed in the response
+    QVariant id = command.value("id");
     if (!command.contains("action")) {
         qDebug() << "a JSon object is required with an 'action' field";
-        m_protocole->close();
+        sendResponse(createError("MissingAction",
+                                 "A command requires an 'action' field"),
+                     id);
         return;
     }
 
     QString action = command["action"].toString();
+    QElapsedTimer timer;
+    timer.start();
     // localise la méthode
-    success = false;
-    QMetaMethod method;
-    for (int i = metaObject()->methodOffset(); i < metaObject()->methodCount();
-         ++i) {
-        method = metaObject()->method(i);
-        QString signature = method.methodSignature();
-        if (signature.startsWith(action) &&
-            signature.at(action.length()) == '(') {
-            success = true;
-            break;
+    const ActionTable & actions = actionTable(metaObject());
+    ActionTable::const_iterator it = actions.constFind(action);
+    qint64 lookupNsecs = 0;
+    if (it != actions.constEnd()) {
+        // copied, as the table may grow while the action runs an event loop
+        ActionMethod target = it.value();
+        lookupNsecs = timer.nsecsElapsed();
+        invokeAction(target.method, target.delayed, command, id);
+    } else {
+        lookupNsecs = timer.nsecsElapsed();
+        QtJson::JsonObject result;
+        if (!callExtraAction(action, command, result)) {
+            qDebug() << "unable to find action" << action;
+            sendResponse(createError("UnknownAction",
+                                     QString::fromUtf8(
+                                         "The action `%1` is unknown")
+                                         .arg(action)),
+                         id);
+            return;
         }
-    }
-    if (!success) {
-        qDebug() << "unable to find action" << action;
-        m_protocole->close();
-        return;
+        sendResponse(result, id);
     }
 
-    bool is_delayed_call =
-        !(strcmp(method.typeName(), "QtJson::JsonObject") == 0);
+    qint64 executeNsecs = timer.nsecsElapsed() - lookupNsecs;
+    ActionStats & stats = m_dispatchStats[action];
+    stats.count += 1;
+    stats.lookupNsecs += lookupNsecs;
+    stats.executeNsecs += executeNsecs;
+    stats.maxExecuteNsecs = qMax(stats.maxExecuteNsecs, executeNsecs);
+}
 
-    if (!is_delayed_call) {
+void JsonClient::invokeAction(const QMetaMethod & method, bool delayed,
+                              const QtJson::JsonObject & command,
+                              const QVariant & id) {
+    QString action = QString::fromLatin1(method.name());
+    bool success = false;
+    if (!delayed) {
         QtJson::JsonObject result;
         success = method.invoke(this, Qt::DirectConnection,
                                 Q_RETURN_ARG(QtJson::JsonObject, result),
                                 Q_ARG(QtJson::JsonObject, command));
         if (!success) {
             qDebug() << "error while executing action" << action;
-            m_protocole->close();
+            sendResponse(createError("ActionFailed",
+                                     QString::fromUtf8(
+                                         "Unable to execute the action `%1`")
+                                         .arg(action)),
+                         id);
             return;
         }
 
-        // serialize response
-        QByteArray response = QtJson::serialize(result, success);
-
-        if (!success) {
-            qDebug() << "unable to serialize result to json" << action;
-            m_protocole->close();
-            return;
-        }
-
-        m_protocole->sendMessage(response);
+        sendResponse(result, id);
     } else {
-        DelayedResponse * dresponse;
+        DelayedResponse * dresponse = 0;
         success = method.invoke(this, Qt::DirectConnection,
                                 Q_RETURN_ARG(DelayedResponse *, dresponse),
                                 Q_ARG(QtJson::JsonObject, command));
-        if (!success && dresponse) {
+        if (!success || !dresponse) {
             qDebug() << "error while executing action" << action;
-            m_protocole->close();
+            sendResponse(createError("ActionFailed",
+                                     QString::fromUtf8(
+                                         "Unable to execute the action `%1`")
+                                         .arg(action)),
+                         id);
             return;
         }
         connect(dresponse,
@@ -130,6 +258,96 @@ void JsonClient::onMessageReceived() {
     }
 }
 
+void JsonClient::writeBinaryData(QtJson::JsonObject & result,
+                                 const QString & key,
+                                 const QByteArray & data,
+                                 const QString & format) {
+    SharedBuffer * shared = sharedBuffer();
+    if (shared) {
+        QtJson::JsonObject descriptor = shared->write(data, format);
+        if (!descriptor.isEmpty()) {
+            result[key + "_shm"] = descriptor;
+            return;
+        }
+    }
+    result[key + "_attachment"] = m_attachments.count();
+    m_attachments << data;
+}
+
+bool JsonClient::sendResponse(const QtJson::JsonObject & result,
+                              const QVariant & id) {
+    QList<QByteArray> attachments = m_attachments;
+    m_attachments.clear();
+    if (m_channel->thread() == QThread::currentThread()) {
+        return m_channel->sendResponse(result, id, attachments);
+    }
+    return QMetaObject::invokeMethod(
+        m_channel, "sendResponse", Qt::QueuedConnection,
+        Q_ARG(QtJson::JsonObject, result), Q_ARG(QVariant, id),
+        Q_ARG(QList<QByteArray>, attachments));
+}
+
+QtJson::JsonObject JsonClient::callAction(const QtJson::JsonObject & command) {
+    if (!command.contains("action")) {
+        return createError("MissingAction",
+                           "A command requires an 'action' field");
+    }
+    QString action = command["action"].toString();
+    const ActionTable & actions = actionTable(metaObject());
+    ActionTable::const_iterator it = actions.constFind(action);
+    if (it == actions.constEnd()) {
+        QtJson::JsonObject result;
+        if (!callExtraAction(action, command, result)) {
+            return createError(
+                "UnknownAction",
+                QString::fromUtf8("The action `%1` is unknown").arg(action));
+        }
+        return result;
+    }
+    QMetaMethod method = it.value().method;
+    QtJson::JsonObject result;
+    if (it.value().delayed) {
+        // the response captures its result instead of sending it
+        DelayedResponse * dresponse = 0;
+        bool wasCallingAction = m_callingAction;
+        m_callingAction = true;
+        bool success =
+            method.invoke(this, Qt::DirectConnection,
+                          Q_RETURN_ARG(DelayedResponse *, dresponse),
+                          Q_ARG(QtJson::JsonObject, command));
+        m_callingAction = wasCallingAction;
+        if (!success || !dresponse) {
+            return createError("ActionFailed",
+                               QString::fromUtf8(
+                                   "Unable to execute the action `%1`")
+                                   .arg(action));
+        }
+        success = dresponse->runSynchronously(result);
+        delete dresponse;
+        if (!success) {
+            return createError(
+                "DelayedAction",
+                QString::fromUtf8(
+                    "The action `%1` can not be called synchronously")
+                    .arg(action));
+        }
+        return result;
+    }
+    if (!method.invoke(this, Qt::DirectConnection,
+                       Q_RETURN_ARG(QtJson::JsonObject, result),
+                       Q_ARG(QtJson::JsonObject, command))) {
+        return createError(
+            "ActionFailed",
+            QString::fromUtf8("Unable to execute the action `%1`").arg(action));
+    }
+    return result;
+}
+
+bool JsonClient::callExtraAction(const QString &, const QtJson::JsonObject &,
+                                 QtJson::JsonObject &) {
+    return false;
+}
+
 QtJson::JsonObject JsonClient::createError(const QString & name,
                                            const QString & description) {
     QtJson::JsonObject message;
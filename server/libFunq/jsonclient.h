@@ -37,30 +37,151 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 
 #include "json.h"
 
+#include <QByteArray>
+#include <QHash>
+#include <QList>
 #include <QObject>
 
+class JsonChannel;
+class QMetaMethod;
 class Protocole;
 class QIODevice;
-
+class SharedBuffer;
+
+/**
+ * @brief Execute the commands received by a JsonChannel, calling the public
+ * slots of subclasses by their name.
+ *
+ * The JsonClient lives in the GUI thread while its channel may live in a
+ * network I/O thread.
+ */
 class JsonClient : public QObject {
     Q_OBJECT
 public:
+    /**
+     * @brief Create a client with its own channel in the current thread.
+     */
     explicit JsonClient(QIODevice * device, QObject * parent = 0);
+    /**
+     * @brief Create a client for a channel, possibly living in another
+     * thread. The client takes the ownership of the channel.
+     */
+    explicit JsonClient(JsonChannel * channel, QObject * parent = 0);
 
     ~JsonClient();
 
-    QtJson::JsonObject createError(const QString & name,
-                                   const QString & description);
-
-    Protocole * protocole() { return m_protocole; }
+    static QtJson::JsonObject createError(const QString & name,
+                                          const QString & description);
+
+    JsonChannel * channel() { return m_channel; }
+
+    /**
+     * @brief Returns the protocole of the channel, only usable when the
+     * channel lives in the current thread.
+     */
+    Protocole * protocole();
+
+    /**
+     * @brief Transfer bulk data of local clients with a SharedBuffer.
+     *
+     * Responses of at least threshold bytes are then written in the shared
+     * buffer, only their descriptor being sent under the "_shm" key.
+     * Returns false if the shared buffer can not be created.
+     */
+    bool enableSharedBuffer(qint64 capacity, int threshold);
+    void disableSharedBuffer();
+    SharedBuffer * sharedBuffer();
+
+    /**
+     * @brief Store binary data under the given key of a result.
+     *
+     * If a shared buffer is enabled, the data is copied in it and
+     * result[key + "_shm"] is its descriptor. Else the data is attached to
+     * the next response and result[key + "_attachment"] is its index: the
+     * channel sends it as a raw frame with the binary framing, or base64
+     * encodes it in result[key].
+     */
+    void writeBinaryData(QtJson::JsonObject & result, const QString & key,
+                         const QByteArray & data,
+                         const QString & format = QString());
+
+    /**
+     * @brief Send a response with its pending attachments.
+     *
+     * If id is valid, it is echoed in the response under the "id" key so
+     * that clients with many requests in flight can match the answers.
+     *
+     * Returns false if the response can not be serialized, the connection
+     * being then closed. Responses are serialized asynchronously when the
+     * channel lives in another thread.
+     */
+    bool sendResponse(const QtJson::JsonObject & result,
+                      const QVariant & id = QVariant());
+
+    /**
+     * @brief Number of bytes not yet written to the device, thread safe.
+     */
+    qint64 bytesToWrite() const;
+
+    void closeConnection();
+
+    /**
+     * @brief Execute a command synchronously and returns its result, or an
+     * error if the action is unknown or answers with a DelayedResponse
+     * which can not run to completion without the event loop.
+     */
+    QtJson::JsonObject callAction(const QtJson::JsonObject & command);
+
+    /**
+     * @brief Returns true while callAction() creates a DelayedResponse.
+     */
+    bool isCallingAction() const { return m_callingAction; }
+
+    /**
+     * @brief Dispatch timings of an action, in nanoseconds.
+     */
+    struct ActionStats {
+        ActionStats()
+            : count(0), lookupNsecs(0), executeNsecs(0), maxExecuteNsecs(0) {}
+        qint64 count;
+        qint64 lookupNsecs;
+        qint64 executeNsecs;
+        qint64 maxExecuteNsecs;
+    };
+
+    const QHash<QString, ActionStats> & dispatchStats() const {
+        return m_dispatchStats;
+    }
+    void resetDispatchStats() { m_dispatchStats.clear(); }
+
+protected:
+    /**
+     * @brief Execute an action which is not a slot of the client, returns
+     * false if there is no such action.
+     */
+    virtual bool callExtraAction(const QString & action,
+                                 const QtJson::JsonObject & command,
+                                 QtJson::JsonObject & result);
+
+    QtJson::JsonObject negotiateChannel(const QtJson::JsonObject & command);
+    QtJson::JsonObject channelStats();
 
 signals:
 
 private slots:
-    void onMessageReceived();
+    void onCommandReceived(const QtJson::JsonObject & command);
 
 private:
-    Protocole * m_protocole;
+    void init();
+    void executeCommand(const QtJson::JsonObject & command);
+    void invokeAction(const QMetaMethod & method, bool delayed,
+                      const QtJson::JsonObject & command, const QVariant & id);
+    Qt::ConnectionType blockingConnection() const;
+
+    JsonChannel * m_channel;
+    bool m_callingAction;
+    QList<QByteArray> m_attachments;
+    QHash<QString, ActionStats> m_dispatchStats;
 };
 
 #endif  // JSONCLIENT_H
@@ -0,0 +1,105 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "networkserver.h"
+
+#include "jsonchannel.h"
+
+#include <QDebug>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMetaType>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+NetworkServer::NetworkServer(const QHostAddress & host, int port,
+                             const QString & socketPath, QObject * parent)
+    : QObject(parent),
+      m_host(host),
+      m_port(port),
+      m_socketPath(socketPath),
+      m_server(0),
+      m_localServer(0) {
+    qRegisterMetaType<JsonChannel *>("JsonChannel*");
+}
+
+void NetworkServer::listen() {
+    if (!m_socketPath.isEmpty()) {
+        m_localServer = new QLocalServer(this);
+        connect(m_localServer, SIGNAL(newConnection()), this,
+                SLOT(onNewLocalConnection()));
+        // a previous instance may have left its socket file
+        QLocalServer::removeServer(m_socketPath);
+        if (!m_localServer->listen(m_socketPath)) {
+            qDebug() << "Unable to initialize funq. Error:\n\t"
+                     << m_localServer->errorString();
+        } else {
+            qDebug() << "funq is initialized on local socket "
+                     << m_localServer->fullServerName() << ".";
+        }
+    } else {
+        m_server = new QTcpServer(this);
+        connect(m_server, SIGNAL(newConnection()), this,
+                SLOT(onNewConnection()));
+        if (!m_server->listen(m_host, m_port)) {
+            qDebug() << "Unable to initialize funq. Error:\n\t"
+                     << m_server->errorString();
+        } else {
+            qDebug() << "funq is initialized on host " << m_host.toString()
+                     << " and on port " << m_port << ".";
+        }
+    }
+}
+
+void NetworkServer::onNewConnection() {
+    while (m_server->hasPendingConnections()) {
+        QTcpSocket * socket = m_server->nextPendingConnection();
+        // responses are small and interactive, do not wait to fill packets
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        addChannel(socket);
+    }
+}
+
+void NetworkServer::onNewLocalConnection() {
+    while (m_localServer->hasPendingConnections()) {
+        addChannel(m_localServer->nextPendingConnection());
+    }
+}
+
+void NetworkServer::addChannel(QIODevice * socket) {
+    JsonChannel * channel = new JsonChannel(socket);
+    // the socket is deleted with its channel
+    socket->setParent(channel);
+    emit newConnection(channel);
+}
@@ -0,0 +1,222 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "objectindex.h"
+
+#include <QApplication>
+#include <QChildEvent>
+#include <QWidget>
+#include <QWindow>
+
+static const int MinCollectThreshold = 64;
+
+ObjectIndex * ObjectIndex::instance() {
+    static QPointer<ObjectIndex> index;
+    if (!index && qApp) {
+        index = new ObjectIndex(qApp);
+        qApp->installEventFilter(index);
+    }
+    return index;
+}
+
+ObjectIndex::ObjectIndex(QObject * parent)
+    : QObject(parent),
+      m_collectThreshold(MinCollectThreshold),
+      m_pendingThreshold(MinCollectThreshold) {}
+
+QList<QObject *> ObjectIndex::objectsOfClass(const QString & className) {
+    update();
+    return living(m_byClass.value(className));
+}
+
+QList<QObject *> ObjectIndex::objectsNamed(const QString & name) {
+    update();
+    return living(m_byName.value(name));
+}
+
+QList<QObject *> ObjectIndex::objects() {
+    update();
+    QList<QObject *> objects;
+    foreach (const Entry & entry, m_entries) {
+        if (entry.object) {
+            objects << entry.object.data();
+        }
+    }
+    return objects;
+}
+
+bool ObjectIndex::eventFilter(QObject *, QEvent * event) {
+    if (event->type() == QEvent::ChildAdded) {
+        // the child is not fully constructed yet, index it later
+        m_pending << static_cast<QChildEvent *>(event)->child();
+        if (m_pending.count() >= m_pendingThreshold) {
+            m_pending.removeAll(QPointer<QObject>());
+            m_pendingThreshold =
+                qMax(MinCollectThreshold, 2 * m_pending.count());
+        }
+    }
+    return false;
+}
+
+void ObjectIndex::onObjectNameChanged() {
+    QObject * object = sender();
+    QHash<QObject *, Entry>::iterator it = m_entries.find(object);
+    if (it == m_entries.end() || it->object.data() != object) {
+        return;
+    }
+    if (!it->name.isEmpty()) {
+        QSet<QObject *> & named = m_byName[it->name];
+        named.remove(object);
+        if (named.isEmpty()) {
+            m_byName.remove(it->name);
+        }
+    }
+    it->name = object->objectName();
+    if (!it->name.isEmpty()) {
+        m_byName[it->name].insert(object);
+    }
+}
+
+void ObjectIndex::update() {
+    // top-level objects have no parent to notify their creation
+    foreach (QWidget * widget, QApplication::topLevelWidgets()) {
+        insertTree(widget);
+    }
+    foreach (QWindow * window, QGuiApplication::topLevelWindows()) {
+        insertTree(window);
+    }
+    QList<QPointer<QObject> > pending;
+    pending.swap(m_pending);
+    m_pendingThreshold = MinCollectThreshold;
+    foreach (const QPointer<QObject> & object, pending) {
+        if (object) {
+            insertTree(object.data());
+        }
+    }
+}
+
+void ObjectIndex::insertTree(QObject * root) {
+    QObjectList stack;
+    stack << root;
+    while (!stack.isEmpty()) {
+        QObject * object = stack.takeLast();
+        // the descendants of an indexed object are already indexed, or
+        // pending
+        if (insert(object)) {
+            stack << object->children();
+        }
+    }
+}
+
+bool ObjectIndex::insert(QObject * object) {
+    QHash<QObject *, Entry>::const_iterator it = m_entries.constFind(object);
+    if (it != m_entries.constEnd()) {
+        if (it->object.data() == object) {
+            return false;
+        }
+        // a destroyed object had the same address
+        remove(object);
+    }
+    if (m_entries.count() >= m_collectThreshold) {
+        collect();
+    }
+    Entry entry;
+    entry.object = object;
+    entry.name = object->objectName();
+    for (const QMetaObject * mo = object->metaObject(); mo;
+         mo = mo->superClass()) {
+        const QString className = QString::fromLatin1(mo->className());
+        // sometimes classes appears twice
+        if (!entry.classes.contains(className)) {
+            entry.classes << className;
+            m_byClass[className].insert(object);
+        }
+    }
+    if (!entry.name.isEmpty()) {
+        m_byName[entry.name].insert(object);
+    }
+    m_entries.insert(object, entry);
+    connect(object, SIGNAL(objectNameChanged(QString)), this,
+            SLOT(onObjectNameChanged()), Qt::UniqueConnection);
+    return true;
+}
+
+void ObjectIndex::remove(QObject * address) {
+    QHash<QObject *, Entry>::iterator it = m_entries.find(address);
+    if (it == m_entries.end()) {
+        return;
+    }
+    foreach (const QString & className, it->classes) {
+        QSet<QObject *> & objects = m_byClass[className];
+        objects.remove(address);
+        if (objects.isEmpty()) {
+            m_byClass.remove(className);
+        }
+    }
+    if (!it->name.isEmpty()) {
+        QSet<QObject *> & named = m_byName[it->name];
+        named.remove(address);
+        if (named.isEmpty()) {
+            m_byName.remove(it->name);
+        }
+    }
+    m_entries.erase(it);
+}
+
+void ObjectIndex::collect() {
+    QObjectList destroyed;
+    for (QHash<QObject *, Entry>::const_iterator it = m_entries.constBegin();
+         it != m_entries.constEnd(); ++it) {
+        if (!it->object) {
+            destroyed << it.key();
+        }
+    }
+    foreach (QObject * address, destroyed) {
+        remove(address);
+    }
+    // amortize the scans: wait for the index to double before the next one
+    m_collectThreshold = qMax(MinCollectThreshold, 2 * m_entries.count());
+}
+
+QList<QObject *> ObjectIndex::living(const QSet<QObject *> & addresses) const {
+    QList<QObject *> objects;
+    foreach (QObject * address, addresses) {
+        QHash<QObject *, Entry>::const_iterator it =
+            m_entries.constFind(address);
+        if (it != m_entries.constEnd() && it->object.data() == address) {
+            objects << address;
+        }
+    }
+    return objects;
+}
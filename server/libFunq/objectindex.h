@@ -0,0 +1,115 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef OBJECTINDEX_H
+#define OBJECTINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief Inverted index of the objects of the application by class name
+ * (superclasses included) and by objectName.
+ *
+ * The index is built on first use from the top-level widgets and windows,
+ * then maintained incrementally: children added to an object are queued
+ * (they are not constructed yet when their parent is notified) and indexed
+ * with their descendants before the next lookup, renamed objects are
+ * reindexed, and the entries of destroyed objects are collected.
+ */
+class ObjectIndex : public QObject {
+    Q_OBJECT
+public:
+    /**
+     * @brief Returns the index of the application (0 without application).
+     */
+    static ObjectIndex * instance();
+
+    /**
+     * @brief Returns the living objects of a class, or inheriting it.
+     */
+    QList<QObject *> objectsOfClass(const QString & className);
+
+    /**
+     * @brief Returns the living objects with the given objectName.
+     */
+    QList<QObject *> objectsNamed(const QString & name);
+
+    /**
+     * @brief Returns every living object.
+     */
+    QList<QObject *> objects();
+
+    /**
+     * @brief Number of indexed objects, destroyed ones included until they
+     * are collected.
+     */
+    int count() const { return m_entries.count(); }
+
+    virtual bool eventFilter(QObject * watched, QEvent * event);
+
+private slots:
+    void onObjectNameChanged();
+
+private:
+    explicit ObjectIndex(QObject * parent);
+
+    struct Entry {
+        QPointer<QObject> object;
+        QStringList classes;
+        QString name;
+    };
+
+    void update();
+    void insertTree(QObject * root);
+    bool insert(QObject * object);
+    void remove(QObject * address);
+    void collect();
+    QList<QObject *> living(const QSet<QObject *> & addresses) const;
+
+    // keyed by address: the QPointer tells if the object is still the same
+    QHash<QObject *, Entry> m_entries;
+    QHash<QString, QSet<QObject *> > m_byClass;
+    QHash<QString, QSet<QObject *> > m_byName;
+    QList<QPointer<QObject> > m_pending;
+    int m_collectThreshold;
+    int m_pendingThreshold;
+};
+
+#endif  // OBJECTINDEX_H
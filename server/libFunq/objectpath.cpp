@@ -34,12 +34,16 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 
 #include "objectpath.h"
 
+#include <QHash>
+
 #include <QApplication>
 #include <QGraphicsItem>
 #include <QGraphicsView>
 #include <QWidget>
 #include <QWindow>
 
+#include "objectpathindex.h"
+
 #ifdef QT_QUICK_LIB
 #include <QQmlContext>
 #include <QQmlEngine>
@@ -103,44 +107,49 @@ QString ObjectPath::objectName(QObject * object) {
     return name;
 }
 
-QObject * ObjectPath::findObject(const QString & path) {
-    const QString separator("::");
-    QStringList parts = path.split(separator);
-    if (parts.isEmpty()) {
-        return 0;
+QStringList ObjectPath::childrenNames(QObject * parent) {
+    QStringList names;
+    QHash<QString, int> counts;  // previous siblings with the same name
+    foreach (QObject * child, parent->children()) {
+        const QString rawName = _rawObjectName(child);
+        int & index = counts[rawName];
+        QString name =
+            index == 0 ? rawName : QString("%1-%2").arg(rawName).arg(index);
+        ++index;
+        name.replace("::", ":_:");
+        names << name;
     }
-    const QString name = parts.takeLast();
-    QObject * parent = 0;
-    if (parts.isEmpty()) {
-        // Top level widget
-        Q_FOREACH (QWidget * widget, QApplication::topLevelWidgets()) {
-            if (objectName(widget) == name) {
-                return widget;
-            }
-        }
-        // did not find any ? - let's try on windows (qtquick)
-        Q_FOREACH (QWindow * window, QApplication::topLevelWindows()) {
-            if (objectName(window) == name) {
-                return window;
-            }
-        }
-        return 0;
-    } else {
-        parent = findObject(parts.join(separator));
-        if (!parent) {
-            return 0;
+    return names;
+}
+
+static QObject * findTopLevelObject(const QString & name) {
+    Q_FOREACH (QWidget * widget, QApplication::topLevelWidgets()) {
+        if (ObjectPath::objectName(widget) == name) {
+            return widget;
         }
     }
-
-    Q_FOREACH (QObject * child, parent->children()) {
-        if (objectName(child) == name) {
-            return child;
+    // did not find any ? - let's try on windows (qtquick)
+    Q_FOREACH (QWindow * window, QApplication::topLevelWindows()) {
+        if (ObjectPath::objectName(window) == name) {
+            return window;
         }
     }
-
     return 0;
 }
 
+QObject * ObjectPath::findObject(const QString & path) {
+    ObjectPathIndex * index = ObjectPathIndex::instance();
+    if (!index) {
+        return 0;
+    }
+    const QStringList parts = path.split("::");
+    QObject * object = findTopLevelObject(parts.first());
+    for (int i = 1; object && i < parts.count(); ++i) {
+        object = index->child(object, parts[i]);
+    }
+    return object;
+}
+
 qulonglong ObjectPath::graphicsItemId(QGraphicsItem * item) {
     return (qulonglong)item;
 }
@@ -37,6 +37,7 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 
 #include <QObject>
 #include <QString>
+#include <QStringList>
 
 class QGraphicsItem;
 class QGraphicsView;
@@ -48,6 +49,11 @@ QString objectPath(QObject * object);
 QString objectName(QObject * object);
 QObject * findObject(const QString & path);
 
+/**
+ * @brief Returns objectName() of every child of an object, in one pass.
+ */
+QStringList childrenNames(QObject * parent);
+
 #ifdef QT_QUICK_LIB
 QString quickItemPath(QQuickItem * item);
 QQuickItem * findQuickItem(QQuickWindow * window, const QString & path);
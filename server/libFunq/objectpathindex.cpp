@@ -0,0 +1,125 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "objectpathindex.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QStringList>
+
+#include "objectpath.h"
+
+static const int MinCollectThreshold = 64;
+
+ObjectPathIndex * ObjectPathIndex::instance() {
+    static QPointer<ObjectPathIndex> index;
+    if (!index && qApp) {
+        index = new ObjectPathIndex(qApp);
+        qApp->installEventFilter(index);
+    }
+    return index;
+}
+
+ObjectPathIndex::ObjectPathIndex(QObject * parent)
+    : QObject(parent), m_collectThreshold(MinCollectThreshold) {}
+
+QObject * ObjectPathIndex::child(QObject * parent, const QString & name) {
+    QHash<QObject *, Children>::iterator it = m_indexes.find(parent);
+    if (it == m_indexes.end() || it->parent.data() != parent) {
+        return build(parent).byName.value(name).data();
+    }
+    QObject * child = it->byName.value(name).data();
+    if (child && child->parent() != parent) {
+        // a change was not notified, do not trust the index
+        child = build(parent).byName.value(name).data();
+    }
+    return child;
+}
+
+bool ObjectPathIndex::eventFilter(QObject * watched, QEvent * event) {
+    switch (event->type()) {
+        case QEvent::ChildAdded:
+        case QEvent::ChildRemoved:
+            m_indexes.remove(watched);
+            break;
+        case QEvent::ZOrderChange:
+            // raise() and lower() reorder the children, so the names
+            if (watched->parent()) {
+                m_indexes.remove(watched->parent());
+            }
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+void ObjectPathIndex::onObjectNameChanged() {
+    QObject * object = sender();
+    if (object && object->parent()) {
+        m_indexes.remove(object->parent());
+    }
+}
+
+ObjectPathIndex::Children & ObjectPathIndex::build(QObject * parent) {
+    if (m_indexes.count() >= m_collectThreshold) {
+        collect();
+    }
+    Children & children = m_indexes[parent];
+    children.parent = parent;
+    children.byName.clear();
+    const QObjectList objects = parent->children();
+    const QStringList names = ObjectPath::childrenNames(parent);
+    for (int i = 0; i < objects.count(); ++i) {
+        // the first child wins when names collide, like a linear scan
+        if (!children.byName.contains(names[i])) {
+            children.byName.insert(names[i], objects[i]);
+        }
+        connect(objects[i], SIGNAL(objectNameChanged(QString)), this,
+                SLOT(onObjectNameChanged()), Qt::UniqueConnection);
+    }
+    return children;
+}
+
+void ObjectPathIndex::collect() {
+    QHash<QObject *, Children>::iterator it = m_indexes.begin();
+    while (it != m_indexes.end()) {
+        if (it->parent.isNull()) {
+            it = m_indexes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_collectThreshold = qMax(MinCollectThreshold, 2 * m_indexes.count());
+}
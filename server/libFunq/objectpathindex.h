@@ -0,0 +1,91 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef OBJECTPATHINDEX_H
+#define OBJECTPATHINDEX_H
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+
+/**
+ * @brief Index of the children of objects by their path names (see
+ * ObjectPath::objectName), so that resolving a path does not depend on the
+ * number of siblings at each level.
+ *
+ * The index of a parent is built on its first lookup, and dropped when a
+ * child is added, removed, restacked or renamed. It only lives in the GUI
+ * thread, watching the events of the application.
+ */
+class ObjectPathIndex : public QObject {
+    Q_OBJECT
+public:
+    /**
+     * @brief Returns the index of the application (0 without application).
+     */
+    static ObjectPathIndex * instance();
+
+    /**
+     * @brief Returns the child of parent having the given path name, or 0.
+     */
+    QObject * child(QObject * parent, const QString & name);
+
+    /**
+     * @brief Number of parents currently indexed.
+     */
+    int count() const { return m_indexes.count(); }
+
+    virtual bool eventFilter(QObject * watched, QEvent * event);
+
+private slots:
+    void onObjectNameChanged();
+
+private:
+    explicit ObjectPathIndex(QObject * parent);
+
+    struct Children {
+        QPointer<QObject> parent;
+        QHash<QString, QPointer<QObject> > byName;
+    };
+
+    Children & build(QObject * parent);
+    void collect();
+
+    // keyed by address: the QPointer tells if the parent is still the same
+    QHash<QObject *, Children> m_indexes;
+    int m_collectThreshold;
+};
+
+#endif  // OBJECTPATHINDEX_H
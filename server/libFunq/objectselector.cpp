@@ -0,0 +1,302 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "objectselector.h"
+
+#include <QGuiApplication>
+#include <QVariant>
+#include <QVector>
+#include <QWidget>
+#include <QWindow>
+
+#include <algorithm>
+
+#include "objectindex.h"
+
+/**
+ * Glob matching with the "*" and "?" wildcards.
+ */
+static bool globMatch(const QString & pattern, const QString & text) {
+    int p = 0, t = 0, star = -1, mark = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && pattern[p] == QLatin1Char('*')) {
+            star = p++;
+            mark = t;
+        } else if (p < pattern.size() && (pattern[p] == QLatin1Char('?') ||
+                                          pattern[p] == text[t])) {
+            ++p;
+            ++t;
+        } else if (star >= 0) {
+            p = star + 1;
+            t = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == QLatin1Char('*')) {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+/**
+ * Position of an object in the object trees, as the indexes of its
+ * ancestors in their parents' children. Top-level objects come in the
+ * creation order of their window, those without a window last.
+ */
+static QVector<int> treePosition(QObject * object) {
+    QVector<int> position;
+    while (QObject * parent = object->parent()) {
+        position.prepend(parent->children().indexOf(object));
+        object = parent;
+    }
+    QWidget * widget = qobject_cast<QWidget *>(object);
+    QWindow * window =
+        widget ? widget->windowHandle() : qobject_cast<QWindow *>(object);
+    const QList<QWindow *> windows = QGuiApplication::allWindows();
+    int rank = window ? windows.indexOf(window) : -1;
+    position.prepend(rank < 0 ? windows.count() : rank);
+    return position;
+}
+
+namespace {
+struct TreeOrder {
+    bool operator()(const QPair<QVector<int>, QObject *> & a,
+                    const QPair<QVector<int>, QObject *> & b) const {
+        return std::lexicographical_compare(a.first.begin(), a.first.end(),
+                                            b.first.begin(), b.first.end());
+    }
+};
+} // namespace
+
+static bool hasWildcard(const QString & pattern) {
+    return pattern.contains(QLatin1Char('*')) ||
+           pattern.contains(QLatin1Char('?'));
+}
+
+bool ObjectSelector::parse(const QString & selector) {
+    m_compounds.clear();
+    m_error.clear();
+    int pos = 0;
+    while (true) {
+        while (pos < selector.size() && selector[pos].isSpace()) {
+            ++pos;
+        }
+        if (pos >= selector.size()) {
+            break;
+        }
+        Compound compound;
+        if (!parseCompound(selector, pos, compound)) {
+            m_compounds.clear();
+            return false;
+        }
+        m_compounds << compound;
+    }
+    if (m_compounds.isEmpty()) {
+        m_error = "empty selector";
+        return false;
+    }
+    return true;
+}
+
+bool ObjectSelector::parseCompound(const QString & s, int & pos,
+                                   Compound & compound) {
+    const int start = pos;
+    if (s[pos] == QLatin1Char('*')) {
+        ++pos;
+    } else {
+        // class names may contain "::", but not ":visible"
+        while (pos < s.size()) {
+            if (s[pos].isLetterOrNumber() || s[pos] == QLatin1Char('_')) {
+                ++pos;
+            } else if (s.mid(pos, 2) == QLatin1String("::")) {
+                pos += 2;
+            } else {
+                break;
+            }
+        }
+        compound.className = s.mid(start, pos - start);
+        compound.classNameLatin1 = compound.className.toLatin1();
+    }
+    if (pos < s.size() && s[pos] == QLatin1Char('#')) {
+        ++pos;
+        compound.hasName = true;
+        if (!parseValue(s, pos, false, compound.name)) {
+            return false;
+        }
+    }
+    while (pos < s.size() && s[pos] == QLatin1Char('[')) {
+        int nameStart = ++pos;
+        while (pos < s.size() && s[pos] != QLatin1Char('=') &&
+               s[pos] != QLatin1Char(']')) {
+            ++pos;
+        }
+        QString name = s.mid(nameStart, pos - nameStart).trimmed();
+        if (pos >= s.size() || s[pos] != QLatin1Char('=') || name.isEmpty()) {
+            m_error =
+                QString("expected [property=value] at %1").arg(nameStart);
+            return false;
+        }
+        ++pos;
+        QString value;
+        if (!parseValue(s, pos, true, value)) {
+            return false;
+        }
+        if (pos >= s.size() || s[pos] != QLatin1Char(']')) {
+            m_error = QString("missing ] at %1").arg(pos);
+            return false;
+        }
+        ++pos;
+        compound.properties << qMakePair(name.toLatin1(), value);
+    }
+    if (s.mid(pos, 8) == QLatin1String(":visible")) {
+        compound.visible = true;
+        pos += 8;
+    }
+    if (pos == start || (pos < s.size() && !s[pos].isSpace())) {
+        m_error =
+            QString("unexpected character '%1' at %2").arg(s[pos]).arg(pos);
+        return false;
+    }
+    return true;
+}
+
+bool ObjectSelector::parseValue(const QString & s, int & pos,
+                                bool untilBracket, QString & value) {
+    if (pos < s.size() &&
+        (s[pos] == QLatin1Char('\'') || s[pos] == QLatin1Char('"'))) {
+        int end = s.indexOf(s[pos], pos + 1);
+        if (end < 0) {
+            m_error = QString("unterminated quote at %1").arg(pos);
+            return false;
+        }
+        value = s.mid(pos + 1, end - pos - 1);
+        pos = end + 1;
+        return true;
+    }
+    const int start = pos;
+    while (pos < s.size()) {
+        const QChar c = s[pos];
+        if (untilBracket ? c == QLatin1Char(']')
+                         : (c.isSpace() || c == QLatin1Char('[') ||
+                            c == QLatin1Char(':'))) {
+            break;
+        }
+        ++pos;
+    }
+    value = s.mid(start, pos - start);
+    if (untilBracket) {
+        value = value.trimmed();
+    }
+    return true;
+}
+
+bool ObjectSelector::matchesCompound(const Compound & compound,
+                                     QObject * object) {
+    if (!compound.classNameLatin1.isEmpty() &&
+        !object->inherits(compound.classNameLatin1.constData())) {
+        return false;
+    }
+    if (compound.hasName && !globMatch(compound.name, object->objectName())) {
+        return false;
+    }
+    for (int i = 0; i < compound.properties.count(); ++i) {
+        const QVariant value =
+            object->property(compound.properties[i].first.constData());
+        if (!value.isValid() ||
+            value.toString() != compound.properties[i].second) {
+            return false;
+        }
+    }
+    if (compound.visible && !object->property("visible").toBool()) {
+        return false;
+    }
+    return true;
+}
+
+bool ObjectSelector::matches(QObject * object, QObject * root) const {
+    if (m_compounds.isEmpty() ||
+        !matchesCompound(m_compounds.last(), object)) {
+        return false;
+    }
+    // ancestors are matched from the nearest one, like CSS engines do; they
+    // may be above root
+    int i = m_compounds.count() - 2;
+    bool belowRoot = (root == 0);
+    QObject * ancestor = object->parent();
+    while (ancestor && (i >= 0 || !belowRoot)) {
+        if (ancestor == root) {
+            belowRoot = true;
+        }
+        if (i >= 0 && matchesCompound(m_compounds[i], ancestor)) {
+            --i;
+        }
+        ancestor = ancestor->parent();
+    }
+    return i < 0 && belowRoot;
+}
+
+QList<QObject *> ObjectSelector::find(ObjectIndex * index, QObject * root,
+                                      int limit) const {
+    QList<QObject *> found;
+    if (m_compounds.isEmpty()) {
+        return found;
+    }
+    // take the candidates from the most selective index: names are usually
+    // more selective than classes (unnamed objects are not indexed by name)
+    const Compound & last = m_compounds.last();
+    QList<QObject *> candidates;
+    if (last.hasName && !last.name.isEmpty() && !hasWildcard(last.name)) {
+        candidates = index->objectsNamed(last.name);
+    } else if (!last.className.isEmpty()) {
+        candidates = index->objectsOfClass(last.className);
+    } else {
+        candidates = index->objects();
+    }
+    // the candidates come in hash order: sort the matches in tree order so
+    // that the result (and the objects kept by limit) does not vary
+    QList<QPair<QVector<int>, QObject *> > matched;
+    foreach (QObject * object, candidates) {
+        if (matches(object, root)) {
+            matched << qMakePair(treePosition(object), object);
+        }
+    }
+    std::stable_sort(matched.begin(), matched.end(), TreeOrder());
+    const int count =
+        limit > 0 ? qMin(limit, matched.count()) : matched.count();
+    for (int i = 0; i < count; ++i) {
+        found << matched[i].second;
+    }
+    return found;
+}
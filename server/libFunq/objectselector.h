@@ -0,0 +1,104 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef OBJECTSELECTOR_H
+#define OBJECTSELECTOR_H
+
+#include <QByteArray>
+#include <QList>
+#include <QObject>
+#include <QPair>
+#include <QString>
+
+class ObjectIndex;
+
+/**
+ * @brief Compact selector of objects, like
+ * "QDialog QPushButton[text=Apply]:visible".
+ *
+ * A selector is a list of compound selectors separated by spaces, each one
+ * matching a descendant of an object matched by the previous one. A compound
+ * selector is made of, in this order:
+ *
+ * - a class name, superclasses included (or "*", or nothing, for any class)
+ * - "#" and an objectName glob ("*" and "?" wildcards)
+ * - property predicates "[name=value]", the value being compared to the
+ *   property converted to a string (quote it with ' or " if needed)
+ * - ":visible" for visible objects only
+ */
+class ObjectSelector {
+public:
+    /**
+     * @brief Parse a selector. Returns false on error, see errorString().
+     */
+    bool parse(const QString & selector);
+    const QString & errorString() const { return m_error; }
+
+    /**
+     * @brief Returns true if the object matches the selector, and is a
+     * descendant of root when root is not 0.
+     */
+    bool matches(QObject * object, QObject * root = 0) const;
+
+    /**
+     * @brief Returns the objects matching the selector, taking the
+     * candidates from the index. Objects are returned in tree order
+     * (depth first, children in their order), at most limit of them when
+     * limit is positive.
+     */
+    QList<QObject *> find(ObjectIndex * index, QObject * root = 0,
+                          int limit = 0) const;
+
+private:
+    struct Compound {
+        Compound() : hasName(false), visible(false) {}
+        QString className;
+        QByteArray classNameLatin1;
+        QString name;
+        bool hasName;
+        QList<QPair<QByteArray, QString> > properties;
+        bool visible;
+    };
+
+    bool parseCompound(const QString & selector, int & pos,
+                       Compound & compound);
+    bool parseValue(const QString & selector, int & pos, bool untilBracket,
+                    QString & value);
+    static bool matchesCompound(const Compound & compound, QObject * object);
+
+    QList<Compound> m_compounds;
+    QString m_error;
+};
+
+#endif  // OBJECTSELECTOR_H
@@ -34,9 +34,21 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 
 #include "player.h"
 
+#include "commandargs.h"
+#include "commandregistry.h"
+#include "delayedresponse.h"
 #include "dragndropresponse.h"
+#include "objectindex.h"
 #include "objectpath.h"
+#include "objectselector.h"
+#include "sharedbuffer.h"
 #include "shortcutresponse.h"
+#include "timeslicedresponse.h"
+#include "treejournal.h"
+
+#ifdef QT_QML_LIB
+#include "scriptengine.h"
+#endif
 
 #include <QAbstractItemModel>
 #include <QAbstractItemView>
@@ -44,11 +56,14 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 #include <QApplication>
 #include <QBuffer>
 #include <QComboBox>
+#include <QElapsedTimer>
 #include <QGraphicsItem>
 #include <QGraphicsView>
 #include <QHeaderView>
 #include <QMetaMethod>
 #include <QMouseEvent>
+#include <QPointer>
+#include <QRegularExpression>
 #include <QStringList>
 #include <QTableView>
 #include <QTest>
@@ -130,11 +145,23 @@ void dump_properties(QObject * object, QtJson::JsonObject & out) {
     }
 }
 
-void dump_object(QObject * object, QtJson::JsonObject & out,
-                 bool with_properties = false) {
-    out["path"] = objectPath(object);
+/**
+ * @brief Dump only the given properties of an object, when they exist.
+ */
+void dump_properties(QObject * object, QtJson::JsonObject & out,
+                     const QStringList & names) {
+    foreach (const QString & name, names) {
+        QVariant value = object->property(name.toLatin1().constData());
+        bool success = false;
+        QtJson::serialize(value, success);
+        if (value.isValid() && success) {
+            out[name] = value;
+        }
+    }
+}
+
+QStringList class_names(const QMetaObject * mo) {
     QStringList classes;
-    const QMetaObject * mo = object->metaObject();
     while (mo) {
         // sometimes classes appears twice
         if (!classes.contains(mo->className())) {
@@ -142,7 +169,17 @@ void dump_object(QObject * object, QtJson::JsonObject & out,
         }
         mo = mo->superClass();
     }
-    out["classes"] = classes;
+    return classes;
+}
+
+/**
+ * @brief Dump an object; its path is computed from the root unless given.
+ */
+void dump_object(QObject * object, QtJson::JsonObject & out,
+                 bool with_properties = false,
+                 const QString & path = QString()) {
+    out["path"] = path.isEmpty() ? objectPath(object) : path;
+    out["classes"] = class_names(object->metaObject());
     if (with_properties) {
         QtJson::JsonObject properties;
         dump_properties(object, properties);
@@ -202,21 +239,183 @@ void dump_item_model_attrs(QAbstractItemModel * model, QtJson::JsonObject & out,
 
 void dump_items_model(QAbstractItemModel * model, QtJson::JsonObject & out,
                       const QModelIndex & parent, const qulonglong & modelId,
-                      bool recursive = true) {
+                      bool recursive = true);
+
+void dump_model_row(QAbstractItemModel * model, QtJson::JsonArray & items,
+                    const QModelIndex & parent, int row,
+                    const qulonglong & modelId, bool recursive) {
+    for (int j = 0; j < model->columnCount(parent); ++j) {
+        QModelIndex index = model->index(row, j, parent);
+        QtJson::JsonObject item;
+        dump_item_model_attrs(model, item, index, modelId);
+        if (j == 0 && recursive && model->hasChildren(index)) {
+            dump_items_model(model, item, index, modelId);
+        }
+        items << item;
+    }
+}
+
+void dump_items_model(QAbstractItemModel * model, QtJson::JsonObject & out,
+                      const QModelIndex & parent, const qulonglong & modelId,
+                      bool recursive) {
     QtJson::JsonArray items;
     for (int i = 0; i < model->rowCount(parent); ++i) {
-        for (int j = 0; j < model->columnCount(parent); ++j) {
-            QModelIndex index = model->index(i, j, parent);
+        dump_model_row(model, items, parent, i, modelId, recursive);
+    }
+    out["items"] = items;
+}
+
+struct ModelItemsArgs {
+    ModelItemsArgs() : oid(0), chunkSize(0) {}
+    qulonglong oid;
+    int chunkSize;
+    TimeSliceArgs timeSlice;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+        v.optional("chunk_size", chunkSize);
+        timeSlice.visit(v);
+    }
+};
+static const CommandArgs::Register<ModelItemsArgs> modelItemsArgs(
+    "model_items");
+
+/**
+ * @brief Dump the items of a model, in time slices, streamed by chunks of
+ * "chunk_size" top level rows if given.
+ *
+ * The rows are walked with an explicit stack of levels, so that the walk can
+ * be resumed at the next slice.
+ */
+class ModelItemsResponse : public TimeSlicedResponse {
+public:
+    ModelItemsResponse(Player * player, const QtJson::JsonObject & command)
+        : TimeSlicedResponse(player, command),
+          m_modelId(0),
+          m_recursive(true),
+          m_chunkSize(0),
+          m_chunkEnd(0) {
+        ModelItemsArgs args;
+        QtJson::JsonObject error;
+        if (!CommandArgs::decode(command, args, error)) {
+            writeResponse(error);
+            return;
+        }
+        m_chunkSize = args.chunkSize;
+        m_chunkEnd = args.chunkSize;
+        ObjectLocatorContext ctx(player, command, "oid");
+        if (ctx.hasError()) {
+            writeResponse(ctx.lastError);
+            return;
+        }
+        m_model = qobject_cast<QAbstractItemModel *>(ctx.obj);
+        m_modelId = ctx.id;
+        if (!m_model) {
+            writeResponse(player->createError(
+                "NotAModel",
+                QString("Object with id `%1` is not a QAbstractItemModel")
+                    .arg(ctx.id)));
+            return;
+        }
+        m_recursive = !(ctx.obj->inherits("QAbstractTableModel") ||
+                        ctx.obj->inherits("QAbstractListModel"));
+        m_levels << Level();
+    }
+
+protected:
+    bool step() {
+        if (!m_model) {
+            writeResponse(jsonClient()->createError(
+                "NotRegisteredObject",
+                QString::fromUtf8("The model (id:%1) has been destroyed")
+                    .arg(m_modelId)));
+            return false;
+        }
+        bool isRoot = m_levels.count() == 1;
+        Level & level = m_levels.last();
+        if (!isRoot && !level.parent.isValid()) {
+            // removed from the model since the previous slice
+            m_levels.removeLast();
+            m_levels.last().firstColumn.clear();
+            m_levels.last().row += 1;
+            return true;
+        }
+        QModelIndex parent = level.parent;
+        if (level.row < m_model->rowCount(parent)) {
+            if (isRoot && m_chunkSize > 0 && level.row >= m_chunkEnd) {
+                if (!canWritePartialResponse()) {
+                    // give the client time to read the chunks, without
+                    // polling
+                    waitFor(WriteRetryInterval);
+                    return false;
+                }
+                QtJson::JsonObject result;
+                result["items"] = level.items;
+                writePartialResponse(result);
+                level.items.clear();
+                m_chunkEnd = level.row + m_chunkSize;
+                return true;
+            }
+            QModelIndex first = m_model->index(level.row, 0, parent);
             QtJson::JsonObject item;
-            dump_item_model_attrs(model, item, index, modelId);
-            if (j == 0 && recursive && model->hasChildren(index)) {
-                dump_items_model(model, item, index, modelId);
+            dump_item_model_attrs(m_model, item, first, m_modelId);
+            if (m_recursive && m_model->hasChildren(first)) {
+                // the first column item is added once its children are
+                level.firstColumn = item;
+                Level child;
+                child.parent = first;
+                m_levels << child;
+                return true;
             }
-            items << item;
+            level.items << item;
+            appendOtherColumns(level);
+            return true;
         }
+        if (isRoot) {
+            QtJson::JsonObject result;
+            result["items"] = level.items;
+            writeResponse(result);
+            return false;
+        }
+        QtJson::JsonArray children = level.items;
+        m_levels.removeLast();
+        Level & up = m_levels.last();
+        up.firstColumn["items"] = children;
+        up.items << up.firstColumn;
+        up.firstColumn.clear();
+        appendOtherColumns(up);
+        return true;
+    }
+
+private:
+    enum { WriteRetryInterval = 10 };
+
+    struct Level {
+        Level() : row(0) {}
+        QPersistentModelIndex parent;
+        int row;
+        QtJson::JsonArray items;
+        QtJson::JsonObject firstColumn;
+    };
+
+    void appendOtherColumns(Level & level) {
+        QModelIndex parent = level.parent;
+        for (int j = 1; j < m_model->columnCount(parent); ++j) {
+            QModelIndex index = m_model->index(level.row, j, parent);
+            QtJson::JsonObject item;
+            dump_item_model_attrs(m_model, item, index, m_modelId);
+            level.items << item;
+        }
+        level.row += 1;
     }
-    out["items"] = items;
-}
+
+    QPointer<QAbstractItemModel> m_model;
+    qulonglong m_modelId;
+    bool m_recursive;
+    int m_chunkSize;
+    int m_chunkEnd;
+    QList<Level> m_levels;
+};
 
 QModelIndex get_model_item(QAbstractItemModel * model, const QString & path,
                            int row, int column) {
@@ -262,30 +461,76 @@ void dump_graphics_items(const QList<QGraphicsItem *> & items,
     out["items"] = outitems;
 }
 
+/**
+ * @brief Replace the "$N.key.subkey" strings of a batch step by the values
+ * found in the results of the previous steps, "$$" escaping a leading "$".
+ * error is set for an invalid reference.
+ */
+QVariant resolve_batch_references(const QVariant & value,
+                                  const QVariantList & results,
+                                  QString & error) {
+    if (value.type() == QVariant::Map) {
+        QtJson::JsonObject object = value.toMap();
+        for (QtJson::JsonObject::iterator it = object.begin();
+             it != object.end(); ++it) {
+            it.value() = resolve_batch_references(it.value(), results, error);
+        }
+        return object;
+    } else if (value.type() == QVariant::List) {
+        QVariantList list = value.toList();
+        for (int i = 0; i < list.count(); ++i) {
+            list[i] = resolve_batch_references(list.at(i), results, error);
+        }
+        return list;
+    } else if (value.type() != QVariant::String) {
+        return value;
+    }
+    QString text = value.toString();
+    if (text.startsWith("$$")) {
+        return text.mid(1);
+    }
+    static const QRegularExpression reference("^\\$(\\d+)((?:\\.\\w+)*)$");
+    QRegularExpressionMatch match = reference.match(text);
+    if (!match.hasMatch()) {
+        return value;
+    }
+    int step = match.captured(1).toInt();
+    if (step >= results.count()) {
+        error = QString::fromUtf8("`%1` refers to a step not yet executed")
+                    .arg(text);
+        return QVariant();
+    }
+    QVariant resolved = results.at(step);
+    QString keys = match.captured(2);
+    if (!keys.isEmpty()) {
+        foreach (const QString & key, keys.mid(1).split('.')) {
+            QtJson::JsonObject object = resolved.toMap();
+            if (!object.contains(key)) {
+                error = QString::fromUtf8("`%1` refers to a missing value")
+                            .arg(text);
+                return QVariant();
+            }
+            resolved = object.value(key);
+        }
+    }
+    return resolved;
+}
+
 Player::Player(QIODevice * device, QObject * parent)
-    : JsonClient(device, parent) {
+    : JsonClient(device, parent), m_scriptEngine(0), m_rawImageSequence(0) {
 }
 
-qulonglong Player::registerObject(QObject * object) {
-    if (!object) {
-        return 0;
-    }
-    qulonglong id = (qulonglong)object;
-    if (!m_registeredObjects.contains(id)) {
-        connect(object, SIGNAL(destroyed(QObject *)), this,
-                SLOT(objectDeleted(QObject *)));
-        m_registeredObjects[id] = object;
-    }
-    return id;
+Player::Player(JsonChannel * channel, QObject * parent)
+    : JsonClient(channel, parent), m_scriptEngine(0), m_rawImageSequence(0) {
 }
 
-QObject * Player::registeredObject(const qulonglong & id) {
-    return m_registeredObjects[id];
+qulonglong Player::registerObject(QObject * object) {
+    return m_handles.insert(object);
 }
 
-void Player::objectDeleted(QObject * object) {
-    qulonglong id = (qulonglong)object;
-    m_registeredObjects.remove(id);
+QObject * Player::registeredObject(const qulonglong & id,
+                                   HandleTable::Status * status) {
+    return m_handles.find(id, status);
 }
 
 QtJson::JsonObject Player::list_actions(const QtJson::JsonObject &) {
@@ -299,19 +544,148 @@ QtJson::JsonObject Player::list_actions(const QtJson::JsonObject &) {
                 metaObject->method(i).methodSignature());
         }
     }
+    // commands registered by the application
+    foreach (const QString & name, CommandRegistry::names()) {
+        methods << name + "(QtJson::JsonObject)";
+    }
     QtJson::JsonObject result;
     result["commands"] = methods;
+    QtJson::JsonObject schemas;
+    QHash<QString, QtJson::JsonArray>::const_iterator it;
+    for (it = CommandArgs::schemas().constBegin();
+         it != CommandArgs::schemas().constEnd(); ++it) {
+        schemas[it.key()] = it.value();
+    }
+    result["schemas"] = schemas;
     return result;
 }
 
+bool Player::callExtraAction(const QString & action,
+                             const QtJson::JsonObject & command,
+                             QtJson::JsonObject & result) {
+    CommandHandler handler = CommandRegistry::handler(action);
+    if (!handler) {
+        return false;
+    }
+    result = handler(this, command);
+    return true;
+}
+
+QtJson::JsonObject Player::negotiate(const QtJson::JsonObject & command) {
+    return negotiateChannel(command);
+}
+
+QtJson::JsonObject Player::protocol_stats(const QtJson::JsonObject &) {
+    return channelStats();
+}
+
+QtJson::JsonObject Player::batch(const QtJson::JsonObject & command) {
+    if (command.value("commands").type() != QVariant::List) {
+        return createError("InvalidBatch",
+                           "A batch requires a 'commands' list");
+    }
+    bool stopOnError = command.value("stop_on_error", true).toBool();
+    QVariantList results;
+    foreach (const QVariant & step, command["commands"].toList()) {
+        QString error;
+        QtJson::JsonObject stepCommand =
+            resolve_batch_references(step, results, error).toMap();
+        QtJson::JsonObject result;
+        if (!error.isEmpty()) {
+            result = createError("InvalidReference", error);
+        } else {
+            result = callAction(stepCommand);
+        }
+        results << result;
+        if (stopOnError && !result.value("success", true).toBool()) {
+            break;
+        }
+    }
+    QtJson::JsonObject result;
+    result["results"] = results;
+    return result;
+}
+
+struct EvalScriptArgs {
+    EvalScriptArgs() : timeout(10.0) {}
+    QString script;
+    QVariantMap args;
+    double timeout;
+    template <class V>
+    void visit(V & v) {
+        v.required("script", script);
+        v.optional("args", args);
+        v.optional("timeout", timeout);
+    }
+};
+static const CommandArgs::Register<EvalScriptArgs> evalScriptArgs(
+    "eval_script");
+
+QtJson::JsonObject Player::eval_script(const QtJson::JsonObject & command) {
+#ifdef QT_QML_LIB
+    EvalScriptArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    if (args.timeout < 0) {
+        return createError("InvalidArgument",
+                           "Argument `timeout`: expected a positive number");
+    }
+    if (!m_scriptEngine) {
+        m_scriptEngine = new ScriptEngine(this);
+    }
+    return m_scriptEngine->evaluate(args.script, args.args,
+                                    qRound(qMin(args.timeout, 86400.0) * 1000));
+#else
+    Q_UNUSED(command);
+    return createError("QtQmlOnly",
+                       "eval_script requires libFunq compiled with Qt Qml");
+#endif
+}
+
+QtJson::JsonObject Player::dispatch_stats(const QtJson::JsonObject & command) {
+    QtJson::JsonObject actions;
+    QHash<QString, ActionStats>::const_iterator it;
+    for (it = dispatchStats().constBegin(); it != dispatchStats().constEnd();
+         ++it) {
+        QtJson::JsonObject stats;
+        stats["count"] = it.value().count;
+        stats["lookup_ns"] = it.value().lookupNsecs;
+        stats["execute_ns"] = it.value().executeNsecs;
+        stats["max_execute_ns"] = it.value().maxExecuteNsecs;
+        actions[it.key()] = stats;
+    }
+    if (command.value("reset").toBool()) {
+        resetDispatchStats();
+    }
+    QtJson::JsonObject result;
+    result["actions"] = actions;
+    return result;
+}
+
+struct WidgetByPathArgs {
+    QString path;
+    template <class V>
+    void visit(V & v) {
+        v.required("path", path);
+    }
+};
+static const CommandArgs::Register<WidgetByPathArgs> widgetByPathArgs(
+    "widget_by_path");
+
 QtJson::JsonObject Player::widget_by_path(const QtJson::JsonObject & command) {
-    QString path = command["path"].toString();
-    QObject * o = findObject(path);
+    WidgetByPathArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    QObject * o = findObject(args.path);
     qulonglong id = registerObject(o);
     if (id == 0) {
         return createError(
             "InvalidWidgetPath",
-            QString("Unable to find widget with path `%1`").arg(path));
+            QString("Unable to find widget with path `%1`").arg(args.path));
     }
     QtJson::JsonObject result;
     result["oid"] = id;
@@ -319,6 +693,183 @@ QtJson::JsonObject Player::widget_by_path(const QtJson::JsonObject & command) {
     return result;
 }
 
+struct WaitForObjectArgs {
+    WaitForObjectArgs() : timeout(20.0) {}
+    QString path;
+    double timeout;
+    template <class V>
+    void visit(V & v) {
+        v.required("path", path);
+        v.optional("timeout", timeout);
+    }
+};
+static const CommandArgs::Register<WaitForObjectArgs> waitForObjectArgs(
+    "wait_for_object");
+
+/**
+ * @brief Answers the object at a path as soon as it exists.
+ *
+ * The path is resolved again once the events adding, polishing or showing
+ * objects are processed, and every second for the changes without events
+ * (like a rename). The "timeout" argument (in seconds) is the time given to
+ * the object to appear, after which the answer is an InvalidWidgetPath
+ * error, like widget_by_path.
+ */
+class WaitForObjectResponse : public DelayedResponse {
+public:
+    /**
+     * @brief Decode the arguments before building the response, whose own
+     * timeout depends on them.
+     */
+    static DelayedResponse * create(Player * player,
+                                    const QtJson::JsonObject & command) {
+        WaitForObjectArgs args;
+        QtJson::JsonObject error;
+        int timeout = DefaultTimeout;
+        if (CommandArgs::decode(command, args, error)) {
+            decodeTimeout(command, timeout, error);
+        }
+        return new WaitForObjectResponse(player, command, args.path, timeout,
+                                         error);
+    }
+
+    ~WaitForObjectResponse() {
+        if (qApp) {
+            qApp->removeEventFilter(this);
+        }
+    }
+
+protected:
+    void execute(int call) {
+        m_checkPending = false;
+        if (QObject * object = findObject(m_path)) {
+            Player * player = static_cast<Player *>(jsonClient());
+            QtJson::JsonObject result;
+            result["oid"] = player->registerObject(object);
+            dump_object(object, result);
+            writeResponse(result);
+            return;
+        }
+        const qint64 remaining = m_timeout - m_elapsed.elapsed();
+        if (remaining <= 0) {
+            writeResponse(jsonClient()->createError(
+                "InvalidWidgetPath",
+                QString("Unable to find widget with path `%1`").arg(m_path)));
+            return;
+        }
+        if (call == 0) {
+            qApp->installEventFilter(this);
+        }
+        waitFor(int(qMin<qint64>(remaining, RecheckInterval)));
+    }
+
+    bool eventFilter(QObject * watched, QEvent * event) {
+        switch (event->type()) {
+            case QEvent::ChildAdded:
+            case QEvent::Polish:
+            case QEvent::Show:
+                // an added child is built (and named) once the events
+                // already posted are processed
+                if (!m_checkPending) {
+                    m_checkPending = true;
+                    waitForIdle();
+                }
+                break;
+            default:
+                break;
+        }
+        return DelayedResponse::eventFilter(watched, event);
+    }
+
+private:
+    enum {
+        DefaultTimeout = 20000,
+        TimeoutMargin = 1000,
+        RecheckInterval = 1000
+    };
+
+    WaitForObjectResponse(Player * player, const QtJson::JsonObject & command,
+                          const QString & path, int timeout,
+                          const QtJson::JsonObject & error)
+        : DelayedResponse(player, withoutTimeout(command), 0,
+                          timeout + TimeoutMargin),
+          m_path(path),
+          m_timeout(timeout),
+          m_checkPending(false) {
+        if (!error.isEmpty()) {
+            writeResponse(error);
+            return;
+        }
+        m_elapsed.start();
+    }
+
+    static QtJson::JsonObject withoutTimeout(QtJson::JsonObject command) {
+        // the deadline is handled here, to answer InvalidWidgetPath
+        command.remove("timeout");
+        return command;
+    }
+
+    QString m_path;
+    int m_timeout;
+    bool m_checkPending;
+    QElapsedTimer m_elapsed;
+};
+
+DelayedResponse * Player::wait_for_object(const QtJson::JsonObject & command) {
+    return WaitForObjectResponse::create(this, command);
+}
+
+struct FindObjectsArgs {
+    FindObjectsArgs() : oid(0), limit(0), hasOid(false) {}
+    QString selector;
+    qulonglong oid;
+    int limit;
+    bool hasOid;
+    template <class V>
+    void visit(V & v) {
+        v.required("selector", selector);
+        v.optional("oid", oid, &hasOid);
+        v.optional("limit", limit);
+    }
+};
+static const CommandArgs::Register<FindObjectsArgs> findObjectsArgs(
+    "find_objects");
+
+QtJson::JsonObject Player::find_objects(const QtJson::JsonObject & command) {
+    FindObjectsArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    ObjectSelector selector;
+    if (!selector.parse(args.selector)) {
+        return createError("InvalidSelector",
+                           QString("Invalid selector `%1`: %2")
+                               .arg(args.selector)
+                               .arg(selector.errorString()));
+    }
+    QObject * root = 0;
+    if (args.hasOid) {
+        ObjectLocatorContext ctx(this, args.oid);
+        if (ctx.hasError()) {
+            return ctx.lastError;
+        }
+        root = ctx.obj;
+    }
+    QtJson::JsonArray objects;
+    if (ObjectIndex * index = ObjectIndex::instance()) {
+        foreach (QObject * object, selector.find(index, root, args.limit)) {
+            QtJson::JsonObject out;
+            out["oid"] = registerObject(object);
+            dump_object(object, out);
+            objects << out;
+        }
+    }
+    QtJson::JsonObject result;
+    result["objects"] = objects;
+    return result;
+}
+
 QtJson::JsonObject Player::quick_item_find(const QtJson::JsonObject & command) {
     QtJson::JsonObject result;
 #ifdef QT_QUICK_LIB
@@ -402,15 +953,30 @@ QtJson::JsonObject Player::active_widget(const QtJson::JsonObject & command) {
 
 ObjectLocatorContext::ObjectLocatorContext(Player * player,
                                            const QtJson::JsonObject & command,
-                                           const QString & oidKey) {
-    id = command[oidKey].value<qulonglong>();
-    obj = player->registeredObject(id);
+                                           const QString & oidKey)
+    : ObjectLocatorContext(player, command[oidKey].value<qulonglong>()) {}
+
+ObjectLocatorContext::ObjectLocatorContext(Player * player,
+                                           qulonglong objectId)
+    : id(objectId) {
+    HandleTable::Status status;
+    obj = player->registeredObject(id, &status);
     if (!obj) {
+        QString reason;
+        switch (status) {
+            case HandleTable::Destroyed:
+                reason = "has been destroyed";
+                break;
+            case HandleTable::Stale:
+                reason = "has been released or destroyed";
+                break;
+            default:
+                reason = "is not registered";
+                break;
+        }
         lastError = player->createError(
             "NotRegisteredObject",
-            QString::fromUtf8(
-                "The object (id:%1) is not registered or has been destroyed")
-                .arg(id));
+            QString::fromUtf8("The object (id:%1) %2").arg(id).arg(reason));
     }
 }
 
@@ -437,9 +1003,30 @@ QuickItemLocatorContext::QuickItemLocatorContext(
 }
 #endif
 
+/**
+ * @brief Arguments of the actions only taking the object id.
+ */
+struct OidArgs {
+    OidArgs() : oid(0) {}
+    qulonglong oid;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+    }
+};
+static const CommandArgs::Register<OidArgs> objectPropertiesArgs(
+    "object_properties");
+static const CommandArgs::Register<OidArgs> widgetCloseArgs("widget_close");
+static const CommandArgs::Register<OidArgs> modelArgs("model");
+
 QtJson::JsonObject Player::object_properties(
     const QtJson::JsonObject & command) {
-    ObjectLocatorContext ctx(this, command, "oid");
+    OidArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    ObjectLocatorContext ctx(this, args.oid);
     if (ctx.hasError()) {
         return ctx.lastError;
     }
@@ -448,14 +1035,31 @@ QtJson::JsonObject Player::object_properties(
     return result;
 }
 
+struct ObjectSetPropertiesArgs {
+    ObjectSetPropertiesArgs() : oid(0) {}
+    qulonglong oid;
+    QVariantMap properties;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+        v.required("properties", properties);
+    }
+};
+static const CommandArgs::Register<ObjectSetPropertiesArgs>
+    objectSetPropertiesArgs("object_set_properties");
+
 QtJson::JsonObject Player::object_set_properties(
     const QtJson::JsonObject & command) {
-    ObjectLocatorContext ctx(this, command, "oid");
+    ObjectSetPropertiesArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    ObjectLocatorContext ctx(this, args.oid);
     if (ctx.hasError()) {
         return ctx.lastError;
     }
-    QVariantMap properties = command["properties"].value<QVariantMap>();
-    _object_set_properties(ctx.obj, properties);
+    _object_set_properties(ctx.obj, args.properties);
     QtJson::JsonObject result;
     return result;
 }
@@ -468,51 +1072,373 @@ void Player::_object_set_properties(QObject * object,
     }
 }
 
-void recursive_list_widget(QWidget * widget, QtJson::JsonObject & out,
-                           bool with_properties) {
-    QtJson::JsonObject resultWidgets, resultWidget;
-    dump_object(widget, resultWidget, with_properties);
-    foreach (QObject * obj, widget->children()) {
-        QWidget * subWidget = qobject_cast<QWidget *>(obj);
-        if (subWidget) {
-            recursive_list_widget(subWidget, resultWidgets, with_properties);
+struct WidgetsListArgs {
+    WidgetsListArgs()
+        : oid(0),
+          withProperties(false),
+          maxDepth(0),
+          visibleOnly(false),
+          classTable(false),
+          hashes(false),
+          hasOid(false) {}
+    qulonglong oid;
+    bool withProperties;
+    QVariantList properties;
+    int maxDepth;
+    bool visibleOnly;
+    QVariantList classes;
+    bool classTable;
+    bool hashes;
+    bool hasOid;
+    TimeSliceArgs timeSlice;
+    template <class V>
+    void visit(V & v) {
+        v.optional("oid", oid, &hasOid);
+        v.optional("with_properties", withProperties);
+        v.optional("properties", properties);
+        v.optional("max_depth", maxDepth);
+        v.optional("visible_only", visibleOnly);
+        v.optional("classes", classes);
+        v.optional("class_table", classTable);
+        v.optional("hashes", hashes);
+        timeSlice.visit(v);
+    }
+};
+static const CommandArgs::Register<WidgetsListArgs> widgetsListArgs(
+    "widgets_list");
+static const CommandArgs::Register<WidgetsListArgs> treeHashArgs("tree_hash");
+
+/**
+ * @brief 64 bits FNV-1a hash of length prefixed strings.
+ */
+class TreeHash {
+public:
+    TreeHash() : m_value(Q_UINT64_C(14695981039346656037)) {}
+
+    void add(const QByteArray & data) {
+        addBytes(QByteArray::number(data.size()) + ':');
+        addBytes(data);
+    }
+    void add(const QString & text) { add(text.toUtf8()); }
+    void add(quint64 hash) { add(QByteArray::number(hash)); }
+
+    quint64 value() const { return m_value; }
+    static QString toString(quint64 hash) {
+        return QString("%1").arg(hash, 16, 16, QLatin1Char('0'));
+    }
+
+private:
+    void addBytes(const QByteArray & data) {
+        for (int i = 0; i < data.size(); ++i) {
+            m_value ^= quint8(data[i]);
+            m_value *= Q_UINT64_C(1099511628211);
         }
     }
-    resultWidget["children"] = resultWidgets;
-    out[objectName(widget)] = resultWidget;
-}
 
-QtJson::JsonObject Player::widgets_list(const QtJson::JsonObject & command) {
-    bool with_properties = command["with_properties"].toBool();
-    QtJson::JsonObject result;
-    if (command.contains("oid")) {
-        ObjectLocatorContext ctx(this, command, "oid");
-        if (ctx.hasError()) {
-            return ctx.lastError;
+    quint64 m_value;
+};
+
+/**
+ * @brief Dump a tree of widgets in time slices, one widget by step. The
+ * widgets destroyed before being dumped are skipped.
+ *
+ * Paths are built from the path of the parent and the names of the children,
+ * computed once per parent, so that dumping is linear in the number of
+ * widgets.
+ *
+ * The dump can be reduced: hidden subtrees pruned (visible_only), depth
+ * limited (max_depth), only some properties dumped (properties), only
+ * widgets of some classes dumped (classes, the other ones being kept with
+ * their path only when they contain dumped widgets), and class lists shared
+ * in a table (class_table).
+ *
+ * With hashes, each node gets a hash of its name, class, dumped properties
+ * and the hashes of its children: a subtree did not change if its hash did
+ * not. The tree_hash command only gives these hashes.
+ */
+class WidgetsListResponse : public TimeSlicedResponse {
+public:
+    WidgetsListResponse(Player * player, const QtJson::JsonObject & command,
+                        bool hashOnly = false)
+        : TimeSlicedResponse(player, command),
+          m_withProperties(false),
+          m_maxDepth(0),
+          m_visibleOnly(false),
+          m_classTable(false),
+          m_hashes(hashOnly),
+          m_hashOnly(hashOnly) {
+        WidgetsListArgs args;
+        QtJson::JsonObject error;
+        if (!CommandArgs::decode(command, args, error)) {
+            writeResponse(error);
+            return;
         }
-        foreach (QObject * obj, ctx.obj->children()) {
-            QWidget * subWidget = qobject_cast<QWidget *>(obj);
-            if (subWidget) {
-                recursive_list_widget(subWidget, result, with_properties);
-            }
+        m_withProperties = args.withProperties;
+        foreach (const QVariant & name, args.properties) {
+            m_properties << name.toString();
         }
-    } else {
-        QList<QWidget *> widgets = QApplication::topLevelWidgets();
-        if (!widgets.isEmpty()) {
-            foreach (QWidget * widget, widgets) {
-                recursive_list_widget(widget, result, with_properties);
+        m_maxDepth = args.maxDepth;
+        m_visibleOnly = args.visibleOnly;
+        foreach (const QVariant & className, args.classes) {
+            m_classes << className.toString().toLatin1();
+        }
+        m_classTable = args.classTable && !hashOnly;
+        m_hashes = m_hashes || args.hashes;
+        if (args.hasOid) {
+            ObjectLocatorContext ctx(player, args.oid);
+            if (ctx.hasError()) {
+                writeResponse(ctx.lastError);
+                return;
             }
+            appendWidgets(m_roots, ctx.obj, objectPath(ctx.obj), 1);
         } else {
-            // no qwidgets, this is probably a qtquick app - anyway, check for
-            // windows
-            foreach (QWindow * window, QApplication::topLevelWindows()) {
-                QtJson::JsonObject resultWindow;
-                dump_object(window, resultWindow, with_properties);
-                result[resultWindow["path"].toString()] = resultWindow;
+            foreach (QWidget * widget, QApplication::topLevelWidgets()) {
+                Child root;
+                root.widget = widget;
+                root.name = objectName(widget);
+                root.path = root.name;
+                root.depth = 1;
+                m_roots << root;
+            }
+            if (m_roots.isEmpty()) {
+                // no qwidgets, this is probably a qtquick app - anyway,
+                // check for windows
+                foreach (QWindow * window, QApplication::topLevelWindows()) {
+                    if ((m_visibleOnly && !window->isVisible()) ||
+                        !matchesClasses(window)) {
+                        continue;
+                    }
+                    const QString name = objectName(window);
+                    QtJson::JsonObject resultWindow;
+                    if (!m_hashOnly) {
+                        dumpObject(window, resultWindow, name);
+                    }
+                    if (m_hashes) {
+                        TreeHash hash;
+                        hash.add(name);
+                        hashObject(window, resultWindow, hash);
+                        m_rootHashes[name] = hash.value();
+                        resultWindow["hash"] = TreeHash::toString(hash.value());
+                    }
+                    if (m_hashOnly) {
+                        resultWindow["children"] = QtJson::JsonObject();
+                    }
+                    m_result[name] = resultWindow;
+                }
             }
         }
     }
-    return result;
+
+protected:
+    bool step() {
+        if (m_stack.isEmpty()) {
+            while (!m_roots.isEmpty()) {
+                Child root = m_roots.takeFirst();
+                if (accept(root)) {
+                    push(root);
+                    return true;
+                }
+            }
+            if (m_classTable) {
+                m_result["_class_table"] = m_classLists;
+            }
+            if (m_hashOnly) {
+                TreeHash hash;
+                addChildHashes(hash, m_rootHashes);
+                QtJson::JsonObject result;
+                result["hash"] = TreeHash::toString(hash.value());
+                result["children"] = m_result;
+                writeResponse(result);
+            } else {
+                writeResponse(m_result);
+            }
+            return false;
+        }
+        Node & top = m_stack.last();
+        while (!top.pending.isEmpty()) {
+            Child child = top.pending.takeFirst();
+            if (accept(child)) {
+                push(child);
+                return true;
+            }
+        }
+        Node node = m_stack.takeLast();
+        // widgets not matching the classes are only kept as containers
+        if (node.widget && (node.matches || !node.children.isEmpty())) {
+            if (m_hashes) {
+                addChildHashes(node.hash, node.childHashes);
+                QMap<QString, quint64> & siblingHashes =
+                    m_stack.isEmpty() ? m_rootHashes
+                                      : m_stack.last().childHashes;
+                siblingHashes[node.name] = node.hash.value();
+                node.out["hash"] = TreeHash::toString(node.hash.value());
+            }
+            node.out["children"] = node.children;
+            QtJson::JsonObject & siblings =
+                m_stack.isEmpty() ? m_result : m_stack.last().children;
+            siblings[node.name] = node.out;
+        }
+        return true;
+    }
+
+private:
+    struct Child {
+        Child() : depth(0) {}
+        QPointer<QWidget> widget;
+        QString name;
+        QString path;
+        int depth;
+    };
+
+    struct Node {
+        Node() : matches(false) {}
+        QPointer<QWidget> widget;
+        QString name;
+        bool matches;
+        QtJson::JsonObject out;
+        QtJson::JsonObject children;
+        QList<Child> pending;
+        TreeHash hash;
+        QMap<QString, quint64> childHashes;
+    };
+
+    static void appendWidgets(QList<Child> & widgets, QObject * parent,
+                              const QString & parentPath, int depth) {
+        // names of every child, widgets or not, in one pass
+        const QObjectList objects = parent->children();
+        const QStringList names = childrenNames(parent);
+        for (int i = 0; i < objects.count(); ++i) {
+            if (QWidget * widget = qobject_cast<QWidget *>(objects[i])) {
+                Child child;
+                child.widget = widget;
+                child.name = names[i];
+                child.path = parentPath + "::" + names[i];
+                child.depth = depth;
+                widgets << child;
+            }
+        }
+    }
+
+    bool accept(const Child & child) const {
+        // hidden widgets hide their whole subtree
+        return child.widget && (!m_visibleOnly || child.widget->isVisible());
+    }
+
+    bool matchesClasses(QObject * object) const {
+        if (m_classes.isEmpty()) {
+            return true;
+        }
+        foreach (const QByteArray & className, m_classes) {
+            if (object->inherits(className.constData())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void addChildHashes(TreeHash & hash,
+                               const QMap<QString, quint64> & hashes) {
+        // sorted by name, so independent of the children order
+        for (QMap<QString, quint64>::const_iterator it = hashes.constBegin();
+             it != hashes.constEnd(); ++it) {
+            hash.add(it.key());
+            hash.add(it.value());
+        }
+    }
+
+    QtJson::JsonObject properties(QObject * object) const {
+        QtJson::JsonObject properties;
+        if (!m_properties.isEmpty()) {
+            dump_properties(object, properties, m_properties);
+        } else if (m_withProperties) {
+            dump_properties(object, properties);
+        }
+        return properties;
+    }
+
+    /**
+     * @brief Hash the class and the properties of an object, taking the
+     * properties from its dump if any.
+     */
+    void hashObject(QObject * object, const QtJson::JsonObject & out,
+                    TreeHash & hash) const {
+        hash.add(QByteArray(object->metaObject()->className()));
+        const QtJson::JsonObject props =
+            m_hashOnly ? properties(object) : out["properties"].toMap();
+        for (QtJson::JsonObject::const_iterator it = props.constBegin();
+             it != props.constEnd(); ++it) {
+            hash.add(it.key());
+            hash.add(QtJson::serialize(it.value()));
+        }
+    }
+
+    void dumpObject(QObject * object, QtJson::JsonObject & out,
+                    const QString & path) {
+        out["path"] = path;
+        if (m_classTable) {
+            const QMetaObject * mo = object->metaObject();
+            QHash<const QMetaObject *, int>::const_iterator it =
+                m_classIndexes.constFind(mo);
+            if (it == m_classIndexes.constEnd()) {
+                it = m_classIndexes.insert(mo, m_classLists.count());
+                m_classLists << class_names(mo);
+            }
+            out["class"] = it.value();
+        } else {
+            out["classes"] = class_names(object->metaObject());
+        }
+        if (m_withProperties || !m_properties.isEmpty()) {
+            out["properties"] = properties(object);
+        }
+    }
+
+    void push(const Child & child) {
+        Node node;
+        node.widget = child.widget;
+        node.name = child.name;
+        node.matches = matchesClasses(child.widget);
+        if (m_hashes) {
+            node.hash.add(child.name);
+        }
+        if (node.matches) {
+            if (!m_hashOnly) {
+                dumpObject(child.widget, node.out, child.path);
+            }
+            if (m_hashes) {
+                hashObject(child.widget, node.out, node.hash);
+            }
+        } else if (!m_hashOnly) {
+            node.out["path"] = child.path;
+        }
+        if (m_maxDepth <= 0 || child.depth < m_maxDepth) {
+            appendWidgets(node.pending, child.widget, child.path,
+                          child.depth + 1);
+        }
+        m_stack << node;
+    }
+
+    bool m_withProperties;
+    QStringList m_properties;
+    int m_maxDepth;
+    bool m_visibleOnly;
+    QList<QByteArray> m_classes;
+    bool m_classTable;
+    bool m_hashes;
+    bool m_hashOnly;
+    QMap<QString, quint64> m_rootHashes;
+    QHash<const QMetaObject *, int> m_classIndexes;
+    QtJson::JsonArray m_classLists;
+    QList<Child> m_roots;
+    QList<Node> m_stack;
+    QtJson::JsonObject m_result;
+};
+
+DelayedResponse * Player::widgets_list(const QtJson::JsonObject & command) {
+    return new WidgetsListResponse(this, command);
+}
+
+DelayedResponse * Player::tree_hash(const QtJson::JsonObject & command) {
+    return new WidgetsListResponse(this, command, true);
 }
 
 QtJson::JsonObject Player::quit(const QtJson::JsonObject &) {
@@ -523,13 +1449,150 @@ QtJson::JsonObject Player::quit(const QtJson::JsonObject &) {
     return result;
 }
 
+struct ReleaseArgs {
+    ReleaseArgs() : oid(0) {}
+    qulonglong oid;
+    QVariantList oids;
+    template <class V>
+    void visit(V & v) {
+        v.optional("oid", oid);
+        v.optional("oids", oids);
+    }
+};
+static const CommandArgs::Register<ReleaseArgs> releaseArgs("release");
+
+QtJson::JsonObject Player::release(const QtJson::JsonObject & command) {
+    ReleaseArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    if (args.oid) {
+        args.oids.prepend(args.oid);
+    }
+    int released = 0;
+    foreach (const QVariant & oid, args.oids) {
+        if (m_handles.release(oid.value<qulonglong>())) {
+            released += 1;
+        }
+    }
+    QtJson::JsonObject result;
+    result["released"] = released;
+    return result;
+}
+
+QtJson::JsonObject Player::release_all(const QtJson::JsonObject &) {
+    int count = m_handles.count();
+    m_handles.releaseAll();
+    QtJson::JsonObject result;
+    result["released"] = count;
+    return result;
+}
+
+QtJson::JsonObject Player::scope_begin(const QtJson::JsonObject &) {
+    QtJson::JsonObject result;
+    result["scope"] = m_handles.openScope();
+    return result;
+}
+
+struct ScopeEndArgs {
+    ScopeEndArgs() : scope(0) {}
+    int scope;
+    template <class V>
+    void visit(V & v) {
+        v.required("scope", scope);
+    }
+};
+static const CommandArgs::Register<ScopeEndArgs> scopeEndArgs("scope_end");
+
+QtJson::JsonObject Player::scope_end(const QtJson::JsonObject & command) {
+    ScopeEndArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    int released = m_handles.closeScope(quint32(args.scope));
+    if (released < 0) {
+        return createError(
+            "UnknownScope",
+            QString::fromUtf8("The scope %1 is not open").arg(args.scope));
+    }
+    QtJson::JsonObject result;
+    result["released"] = released;
+    return result;
+}
+
+QtJson::JsonObject Player::registry_stats(const QtJson::JsonObject &) {
+    HandleTable::Stats stats = m_handles.stats();
+    QtJson::JsonObject result;
+    result["count"] = stats.count;
+    result["capacity"] = stats.capacity;
+    result["destroyed"] = stats.destroyed;
+    result["open_scopes"] = stats.openScopes;
+    result["max_handles"] = stats.maxHandles;
+    result["released"] = stats.released;
+    result["evicted"] = stats.evicted;
+    result["collected"] = stats.collected;
+    return result;
+}
+
+DelayedResponse * Player::subscribe_tree(const QtJson::JsonObject & command) {
+    return new TreeSubscription(this, command);
+}
+
+struct UnsubscribeTreeArgs {
+    UnsubscribeTreeArgs() : subscription(0) {}
+    int subscription;
+    template <class V>
+    void visit(V & v) {
+        v.required("subscription", subscription);
+    }
+};
+static const CommandArgs::Register<UnsubscribeTreeArgs> unsubscribeTreeArgs(
+    "unsubscribe_tree");
+
+QtJson::JsonObject Player::unsubscribe_tree(
+    const QtJson::JsonObject & command) {
+    UnsubscribeTreeArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    TreeSubscription * subscription =
+        TreeSubscription::find(this, args.subscription);
+    if (!subscription) {
+        return createError("UnknownSubscription",
+                           QString::fromUtf8("The subscription %1 is not open")
+                               .arg(args.subscription));
+    }
+    subscription->finish();
+    return QtJson::JsonObject();
+}
+
+struct ActionTriggerArgs {
+    ActionTriggerArgs() : oid(0), blocking(false) {}
+    qulonglong oid;
+    bool blocking;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+        v.optional("blocking", blocking);
+    }
+};
+static const CommandArgs::Register<ActionTriggerArgs> actionTriggerArgs(
+    "action_trigger");
+
 QtJson::JsonObject Player::action_trigger(const QtJson::JsonObject & command) {
-    WidgetLocatorContext<QAction> ctx(this, command, "oid");
+    ActionTriggerArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    WidgetLocatorContext<QAction> ctx(this, args.oid);
     if (ctx.hasError()) {
         return ctx.lastError;
     }
-    bool blocking = command["blocking"].toBool();
-    if (blocking) {
+    if (args.blocking) {
         // block until QAction::trigger() returns
         ctx.widget->trigger();
     } else {
@@ -540,12 +1603,30 @@ QtJson::JsonObject Player::action_trigger(const QtJson::JsonObject & command) {
     return result;
 }
 
+struct WidgetClickArgs {
+    WidgetClickArgs() : oid(0), mouseAction("click") {}
+    qulonglong oid;
+    QString mouseAction;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+        v.optional("mouseAction", mouseAction);
+    }
+};
+static const CommandArgs::Register<WidgetClickArgs> widgetClickArgs(
+    "widget_click");
+
 QtJson::JsonObject Player::widget_click(const QtJson::JsonObject & command) {
-    WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+    WidgetClickArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    WidgetLocatorContext<QWidget> ctx(this, args.oid);
     if (ctx.hasError()) {
         return ctx.lastError;
     }
-    QString action = command["mouseAction"].toString();
+    const QString & action = args.mouseAction;
     QPoint pos = ctx.widget->rect().center();
     if (action == "doubleclick") {
         mouse_dclick(ctx.widget, pos);
@@ -684,18 +1765,38 @@ QtJson::JsonObject Player::quick_item_key_press(
 #endif
 }
 
+struct WidgetMoveArgs {
+    WidgetMoveArgs() : oid(0), x(0), y(0), hasX(false), hasY(false) {}
+    qulonglong oid;
+    int x, y;
+    bool hasX, hasY;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+        v.optional("x", x, &hasX);
+        v.optional("y", y, &hasY);
+    }
+};
+static const CommandArgs::Register<WidgetMoveArgs> widgetMoveArgs(
+    "widget_move");
+
 QtJson::JsonObject Player::widget_move(const QtJson::JsonObject & command) {
-  WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+  WidgetMoveArgs args;
+  QtJson::JsonObject error;
+  if (!CommandArgs::decode(command, args, error)) {
+      return error;
+  }
+  WidgetLocatorContext<QWidget> ctx(this, args.oid);
   if (ctx.hasError()) {
       return ctx.lastError;
   }
 
   QPoint pos = ctx.widget->pos();
-  if (!command["x"].isNull()) {
-    pos.setX(command["x"].toInt());
+  if (args.hasX) {
+    pos.setX(args.x);
   }
-  if (!command["y"].isNull()) {
-    pos.setY(command["y"].toInt());
+  if (args.hasY) {
+    pos.setY(args.y);
   }
   ctx.widget->move(pos);
 
@@ -705,18 +1806,39 @@ QtJson::JsonObject Player::widget_move(const QtJson::JsonObject & command) {
   return result;
 }
 
+struct WidgetResizeArgs {
+    WidgetResizeArgs()
+        : oid(0), width(0), height(0), hasWidth(false), hasHeight(false) {}
+    qulonglong oid;
+    int width, height;
+    bool hasWidth, hasHeight;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+        v.optional("width", width, &hasWidth);
+        v.optional("height", height, &hasHeight);
+    }
+};
+static const CommandArgs::Register<WidgetResizeArgs> widgetResizeArgs(
+    "widget_resize");
+
 QtJson::JsonObject Player::widget_resize(const QtJson::JsonObject & command) {
-  WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+  WidgetResizeArgs args;
+  QtJson::JsonObject error;
+  if (!CommandArgs::decode(command, args, error)) {
+      return error;
+  }
+  WidgetLocatorContext<QWidget> ctx(this, args.oid);
   if (ctx.hasError()) {
       return ctx.lastError;
   }
 
   QSize size = ctx.widget->size();
-  if (!command["width"].isNull()) {
-    size.setWidth(command["width"].toInt());
+  if (args.hasWidth) {
+    size.setWidth(args.width);
   }
-  if (!command["height"].isNull()) {
-    size.setHeight(command["height"].toInt());
+  if (args.hasHeight) {
+    size.setHeight(args.height);
   }
   ctx.widget->resize(size);
 
@@ -727,7 +1849,12 @@ QtJson::JsonObject Player::widget_resize(const QtJson::JsonObject & command) {
 }
 
 QtJson::JsonObject Player::widget_close(const QtJson::JsonObject & command) {
-    WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+    OidArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    WidgetLocatorContext<QWidget> ctx(this, args.oid);
     if (ctx.hasError()) {
         return ctx.lastError;
     }
@@ -738,25 +1865,48 @@ QtJson::JsonObject Player::widget_close(const QtJson::JsonObject & command) {
     return result;
 }
 
+struct WidgetMapPositionArgs {
+    WidgetMapPositionArgs()
+        : oid(0), parentOid(0), x(0), y(0), hasParent(false) {}
+    qulonglong oid;
+    qulonglong parentOid;
+    QString direction;
+    int x, y;
+    bool hasParent;
+    template <class V>
+    void visit(V & v) {
+        v.required("oid", oid);
+        v.optional("parent_oid", parentOid, &hasParent);
+        v.required("direction", direction);
+        v.required("x", x);
+        v.required("y", y);
+    }
+};
+static const CommandArgs::Register<WidgetMapPositionArgs>
+    widgetMapPositionArgs("widget_map_position");
+
 QtJson::JsonObject Player::widget_map_position(
     const QtJson::JsonObject & command) {
-    WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+    WidgetMapPositionArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    WidgetLocatorContext<QWidget> ctx(this, args.oid);
     if (ctx.hasError()) {
         return ctx.lastError;
     }
     QWidget * parent = 0;
-    if (!command["parent_oid"].isNull()) {
-        WidgetLocatorContext<QWidget> parentCtx(this, command, "parent_oid");
+    if (args.hasParent) {
+        WidgetLocatorContext<QWidget> parentCtx(this, args.parentOid);
         if (parentCtx.hasError()) {
-            return ctx.lastError;
+            return parentCtx.lastError;
         } else {
             parent = parentCtx.widget;
         }
     }
-    QString direction = command["direction"].toString();
-    QPoint pos;
-    pos.setX(command["x"].toInt());
-    pos.setY(command["y"].toInt());
+    const QString & direction = args.direction;
+    QPoint pos(args.x, args.y);
 
     if (direction == "from") {
         if (parent) {
@@ -783,7 +1933,12 @@ QtJson::JsonObject Player::widget_map_position(
 }
 
 QtJson::JsonObject Player::model(const QtJson::JsonObject & command) {
-    ObjectLocatorContext ctx(this, command, "oid");
+    OidArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
+    ObjectLocatorContext ctx(this, args.oid);
     if (ctx.hasError()) {
         return ctx.lastError;
     }
@@ -809,25 +1964,8 @@ QtJson::JsonObject Player::model(const QtJson::JsonObject & command) {
     }
 }
 
-QtJson::JsonObject Player::model_items(const QtJson::JsonObject & command) {
-    ObjectLocatorContext ctx(this, command, "oid");
-    if (ctx.hasError()) {
-        return ctx.lastError;
-    }
-
-    QAbstractItemModel * model = qobject_cast<QAbstractItemModel *>(ctx.obj);
-    if (!model) {
-        return createError(
-            "NotAModel",
-            QString("Object with id `%1` is not a QAbstractItemModel")
-                .arg(ctx.id));
-    }
-
-    QtJson::JsonObject result;
-    bool recursive = !(ctx.obj->inherits("QAbstractTableModel") ||
-                       ctx.obj->inherits("QAbstractListModel"));
-    dump_items_model(model, result, QModelIndex(), ctx.id, recursive);
-    return result;
+DelayedResponse * Player::model_items(const QtJson::JsonObject & command) {
+    return new ModelItemsResponse(this, command);
 }
 
 QtJson::JsonObject Player::model_item_action(
@@ -964,14 +2102,43 @@ QtJson::JsonObject Player::model_gitem_action(
     return result;
 }
 
+struct GrabArgs {
+    GrabArgs() : oid(0), format("PNG"), hasOid(false) {}
+    qulonglong oid;
+    QString format;
+    bool hasOid;
+    template <class V>
+    void visit(V & v) {
+        v.optional("oid", oid, &hasOid);
+        v.optional("format", format);
+    }
+};
+static const CommandArgs::Register<GrabArgs> grabArgs("grab");
+
 QtJson::JsonObject Player::grab(const QtJson::JsonObject & command) {
+    GrabArgs args;
+    QtJson::JsonObject result;
+    if (!CommandArgs::decode(command, args, result)) {
+        return result;
+    }
+    QString format = args.format.isEmpty() ? QString("PNG") : args.format;
+    result["format"] = format;
+
     QPixmap pixmap;
-    if (command.contains("oid")) {
+    if (args.hasOid) {
         // grab a single widget
-        WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+        WidgetLocatorContext<QWidget> ctx(this, args.oid);
         if (ctx.hasError()) {
             return ctx.lastError;
         }
+        if (format == "RAW") {
+            // rendered in place, in the shared buffer if enabled
+            QImage image = createRawImage(ctx.widget->size());
+            image.fill(Qt::transparent);
+            ctx.widget->render(&image);
+            writeRawImage(result, "data", image);
+            return result;
+        }
 #if QT_VERSION_MAJOR >= 6
         pixmap = ctx.widget->grab();
 #else
@@ -987,24 +2154,41 @@ QtJson::JsonObject Player::grab(const QtJson::JsonObject & command) {
         pixmap = QPixmap::grabWindow(QApplication::desktop()->winId());
 #endif
     }
-    QString format = command["format"].toString();
-    if (format.isEmpty()) {
-        format = "PNG";
+    if (format == "RAW") {
+        writeRawImage(result, "data", pixmap.toImage());
+        return result;
     }
 
     QBuffer buffer;
     pixmap.save(&buffer, "PNG");
 
-    QtJson::JsonObject result;
-    result["format"] = format;
-    result["data"] = buffer.data().toBase64();
+    writeBinaryData(result, "data", buffer.data(), "PNG");
     return result;
 }
 
+struct WidgetKeyclickArgs {
+    WidgetKeyclickArgs() : oid(0), hasOid(false) {}
+    qulonglong oid;
+    QString text;
+    bool hasOid;
+    template <class V>
+    void visit(V & v) {
+        v.optional("oid", oid, &hasOid);
+        v.required("text", text);
+    }
+};
+static const CommandArgs::Register<WidgetKeyclickArgs> widgetKeyclickArgs(
+    "widget_keyclick");
+
 QtJson::JsonObject Player::widget_keyclick(const QtJson::JsonObject & command) {
+    WidgetKeyclickArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        return error;
+    }
     QWidget * widget;
-    if (command.contains("oid")) {
-        WidgetLocatorContext<QWidget> ctx(this, command, "oid");
+    if (args.hasOid) {
+        WidgetLocatorContext<QWidget> ctx(this, args.oid);
         if (ctx.hasError()) {
             return ctx.lastError;
         }
@@ -1012,7 +2196,7 @@ QtJson::JsonObject Player::widget_keyclick(const QtJson::JsonObject & command) {
     } else {
         widget = qApp->activeWindow();
     }
-    QString text = command["text"].toString();
+    const QString & text = args.text;
     for (int i = 0; i < text.count(); ++i) {
         QChar ch = text[i];
         int key = (int)ch.toLatin1();
@@ -1259,6 +2443,19 @@ QtJson::JsonObject Player::grab_graphics_view(
     if (format.isEmpty()) {
         format = "PNG";
     }
+    QtJson::JsonObject result;
+    result["format"] = format;
+    if (format == "RAW") {
+        QImage image = createRawImage(ctx.widget->scene()->sceneRect()
+                                          .size()
+                                          .toSize());
+        image.fill(Qt::transparent);
+        QPainter q_painter(&image);
+        ctx.widget->scene()->render(&q_painter);
+        q_painter.end();
+        writeRawImage(result, "data", image);
+        return result;
+    }
     QPixmap pixmap(ctx.widget->scene()->width(), ctx.widget->scene()->height());
     QPainter q_painter(&pixmap);
 
@@ -1266,9 +2463,42 @@ QtJson::JsonObject Player::grab_graphics_view(
     QBuffer buffer;
     pixmap.save(&buffer, format.toStdString().c_str());
 
-    QtJson::JsonObject result;
-    result["format"] = format;
-    result["data"] = buffer.data().toBase64();
+    writeBinaryData(result, "data", buffer.data(), format);
 
     return result;
 }
+
+QImage Player::createRawImage(const QSize & size) {
+    SharedBuffer * shared = sharedBuffer();
+    const int bytesPerLine = size.width() * 4;
+    if (shared && !size.isEmpty()) {
+        uchar * data = shared->allocate(qint64(bytesPerLine) * size.height(),
+                                        &m_rawImageSequence);
+        if (data) {
+            return QImage(data, size.width(), size.height(), bytesPerLine,
+                          QImage::Format_ARGB32);
+        }
+    }
+    return QImage(size, QImage::Format_ARGB32);
+}
+
+void Player::writeRawImage(QtJson::JsonObject & result, const QString & key,
+                           const QImage & source) {
+    QImage image = source.convertToFormat(QImage::Format_ARGB32);
+    result["width"] = image.width();
+    result["height"] = image.height();
+    result["bytes_per_line"] = image.bytesPerLine();
+    result["pixel_format"] = "ARGB32";
+    SharedBuffer * shared = sharedBuffer();
+    if (shared && shared->contains(image.constBits())) {
+        // already in place, no copy
+        result[key + "_shm"] =
+            shared->descriptor(image.constBits(), image.sizeInBytes(), "RAW",
+                               m_rawImageSequence);
+        return;
+    }
+    writeBinaryData(result, key,
+                    QByteArray(reinterpret_cast<const char *>(image.constBits()),
+                               image.sizeInBytes()),
+                    "RAW");
+}
@@ -35,14 +35,17 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 #ifndef PLAYER_H
 #define PLAYER_H
 
+#include "handletable.h"
 #include "jsonclient.h"
 
+#include <QImage>
 #include <QModelIndex>
 #include <QWidget>
 class DelayedResponse;
 class QAbstractItemView;
 class QQuickItem;
 class QQuickWindow;
+class ScriptEngine;
 
 /**
  * @brief Player is a specialized JsonClient that handle remote Qt object
@@ -55,9 +58,15 @@ class Player : public JsonClient {
     Q_OBJECT
 public:
     explicit Player(QIODevice * device, QObject * parent = 0);
+    explicit Player(JsonChannel * channel, QObject * parent = 0);
 
+    /**
+     * @brief Returns the id of an object for the clients (0 for a null
+     * object), always the same while the object lives.
+     */
     qulonglong registerObject(QObject * object);
-    QObject * registeredObject(const qulonglong & id);
+    QObject * registeredObject(const qulonglong & id,
+                               HandleTable::Status * status = 0);
 
 public slots:
     /*
@@ -74,14 +83,22 @@ public slots:
      *
      */
     QtJson::JsonObject list_actions(const QtJson::JsonObject & command);
+    QtJson::JsonObject negotiate(const QtJson::JsonObject & command);
+    QtJson::JsonObject protocol_stats(const QtJson::JsonObject & command);
+    QtJson::JsonObject dispatch_stats(const QtJson::JsonObject & command);
+    QtJson::JsonObject batch(const QtJson::JsonObject & command);
+    QtJson::JsonObject eval_script(const QtJson::JsonObject & command);
 
     QtJson::JsonObject widget_by_path(const QtJson::JsonObject & command);
+    DelayedResponse * wait_for_object(const QtJson::JsonObject & command);
+    QtJson::JsonObject find_objects(const QtJson::JsonObject & command);
     QtJson::JsonObject active_widget(const QtJson::JsonObject & command);
     QtJson::JsonObject object_properties(const QtJson::JsonObject & command);
     QtJson::JsonObject object_set_properties(
         const QtJson::JsonObject & command);
     QtJson::JsonObject action_trigger(const QtJson::JsonObject & command);
-    QtJson::JsonObject widgets_list(const QtJson::JsonObject & command);
+    DelayedResponse * widgets_list(const QtJson::JsonObject & command);
+    DelayedResponse * tree_hash(const QtJson::JsonObject & command);
     QtJson::JsonObject widget_click(const QtJson::JsonObject & command);
     QtJson::JsonObject widget_move(const QtJson::JsonObject & command);
     QtJson::JsonObject widget_resize(const QtJson::JsonObject & command);
@@ -89,7 +106,7 @@ public slots:
     QtJson::JsonObject widget_map_position(const QtJson::JsonObject & command);
     DelayedResponse * drag_n_drop(const QtJson::JsonObject & command);
     QtJson::JsonObject model(const QtJson::JsonObject & command);
-    QtJson::JsonObject model_items(const QtJson::JsonObject & command);
+    DelayedResponse * model_items(const QtJson::JsonObject & command);
     QtJson::JsonObject model_item_action(const QtJson::JsonObject & command);
     QtJson::JsonObject model_gitem_action(const QtJson::JsonObject & command);
     QtJson::JsonObject grab(const QtJson::JsonObject & command);
@@ -109,12 +126,25 @@ public slots:
 
     QtJson::JsonObject quit(const QtJson::JsonObject & command);
 
+    QtJson::JsonObject release(const QtJson::JsonObject & command);
+    QtJson::JsonObject release_all(const QtJson::JsonObject & command);
+    QtJson::JsonObject scope_begin(const QtJson::JsonObject & command);
+    QtJson::JsonObject scope_end(const QtJson::JsonObject & command);
+    QtJson::JsonObject registry_stats(const QtJson::JsonObject & command);
+
+    DelayedResponse * subscribe_tree(const QtJson::JsonObject & command);
+    QtJson::JsonObject unsubscribe_tree(const QtJson::JsonObject & command);
+
     QtJson::JsonObject quick_item_find(const QtJson::JsonObject & command);
     QtJson::JsonObject quick_item_click(const QtJson::JsonObject & command);
     QtJson::JsonObject quick_item_key_click(const QtJson::JsonObject & command);
     QtJson::JsonObject quick_item_key_press(const QtJson::JsonObject & command);
 
 protected:
+    bool callExtraAction(const QString & action,
+                         const QtJson::JsonObject & command,
+                         QtJson::JsonObject & result);
+
     QtJson::JsonObject createQtQuickOnlyError() {
         return createError("QtQuickOnly",
                            "this method can only be called for a Qt5 app "
@@ -125,12 +155,15 @@ private:
     void _object_set_properties(QObject * object, const QVariantMap & props);
     void _model_item_action(const QString &, QAbstractItemView *,
                             const QModelIndex &);
-
-private slots:
-    void objectDeleted(QObject * object);
+    QImage createRawImage(const QSize & size);
+    void writeRawImage(QtJson::JsonObject & result, const QString & key,
+                       const QImage & image);
 
 private:
-    QHash<qulonglong, QObject *> m_registeredObjects;
+    HandleTable m_handles;
+    ScriptEngine * m_scriptEngine;
+    // sequence of the last image created in the shared buffer
+    qint64 m_rawImageSequence;
 };
 
 /**
@@ -140,6 +173,7 @@ class ObjectLocatorContext {
 public:
     ObjectLocatorContext(Player * player, const QtJson::JsonObject & command,
                          const QString & objKey);
+    ObjectLocatorContext(Player * player, qulonglong objectId);
     virtual ~ObjectLocatorContext() {}
 
     qulonglong id;
@@ -157,6 +191,17 @@ public:
     WidgetLocatorContext(Player * player, const QtJson::JsonObject & command,
                          const QString & objKey)
         : ObjectLocatorContext(player, command, objKey) {
+        checkType(player);
+    }
+    WidgetLocatorContext(Player * player, qulonglong objectId)
+        : ObjectLocatorContext(player, objectId) {
+        checkType(player);
+    }
+    T * widget;
+
+private:
+    void checkType(Player * player) {
+        widget = 0;
         if (!hasError()) {
             widget = qobject_cast<T *>(obj);
             if (!widget) {
@@ -168,7 +213,6 @@ public:
             }
         }
     }
-    T * widget;
 };
 
 #ifdef QT_QUICK_LIB
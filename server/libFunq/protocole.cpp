@@ -35,45 +35,191 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 #include "protocole.h"
 
 #include <QDebug>
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <QtEndian>
+
+// longest text header accepted, without its line feed
+static const qint64 MaxTextHeaderSize = 20;
+// memory reserved for a frame payload before receiving it
+static const qint64 MaxPayloadReserve = 64 * 1024;
 
 Protocole::Protocole(QObject * parent)
-    : QObject(parent), m_device(0), m_messageSize(0) {
+    : QObject(parent),
+      m_device(0),
+      m_framing(TextFraming),
+      m_nextFraming(TextFraming),
+      m_hasHeader(false),
+      m_frameType(MessageFrame),
+      m_frameFlags(0),
+      m_messageSize(0),
+      m_bytesToSkip(0),
+      m_maxFrameSize(DefaultMaxFrameSize),
+      m_maxQueuedBytes(DefaultMaxQueuedBytes),
+      m_queuedBytes(0),
+      m_readPaused(false),
+      m_compression(NoCompression),
+      m_compressionThreshold(DefaultCompressionThreshold),
+      m_compressionLevel(-1) {
+    bool ok = false;
+    qint64 maxFrameSize = qgetenv("FUNQ_MAX_FRAME_SIZE").toLongLong(&ok);
+    if (ok && maxFrameSize > 0) {
+        m_maxFrameSize = maxFrameSize;
+    }
 }
 
 void Protocole::setDevice(QIODevice * device) {
     if (m_device) {
-        disconnect(m_device, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        disconnect(m_device.data(), SIGNAL(readyRead()), this,
+                   SLOT(onReadyRead()));
     }
     if (device) {
         connect(device, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+        // frames are read progressively, so the socket does not need to
+        // buffer a whole frame: the sender is slowed down instead.
+        if (QAbstractSocket * socket = qobject_cast<QAbstractSocket *>(device)) {
+            socket->setReadBufferSize(SocketReadBufferSize);
+        } else if (QLocalSocket * socket =
+                       qobject_cast<QLocalSocket *>(device)) {
+            socket->setReadBufferSize(SocketReadBufferSize);
+        }
     }
     m_device = device;
 }
 
+void Protocole::setFramingAfterNextMessage(Framing framing) {
+    m_nextFraming = framing;
+}
+
+void Protocole::setCompression(Compression compression, int threshold,
+                               int level) {
+    m_compression = compression;
+    m_compressionThreshold = threshold;
+    m_compressionLevel = level;
+}
+
+bool Protocole::readHeader() {
+    if (m_framing == TextFraming) {
+        if (!m_device->canReadLine()) {
+            if (m_device->bytesAvailable() > MaxTextHeaderSize) {
+                qDebug() << "Error while reading frame header: too long";
+                close();
+            }
+            return false;  // we need more data
+        }
+        QString entete = QString(m_device->readLine());
+        bool ok = false;
+        m_messageSize = entete.toLongLong(&ok);
+        if (!ok || m_messageSize <= 0) {
+            qDebug() << QString("Error while reading frame header: %1")
+                            .arg(entete);
+            close();
+            return false;
+        }
+        m_frameType = MessageFrame;
+        m_frameFlags = 0;
+    } else {
+        if (m_device->bytesAvailable() < BinaryHeaderSize) {
+            return false;  // we need more data
+        }
+        QByteArray entete = m_device->read(BinaryHeaderSize);
+        const uchar * data = reinterpret_cast<const uchar *>(entete.constData());
+        m_messageSize = qFromBigEndian<quint32>(data);
+        m_frameType = data[4];
+        m_frameFlags = data[5];
+    }
+    m_hasHeader = true;
+    m_stats.receivedFrames++;
+    if (m_messageSize > m_maxFrameSize) {
+        dropFrame(m_messageSize);
+        m_bytesToSkip = m_messageSize;
+    } else {
+        // grows with the received bytes, the header alone is not trusted
+        m_payload.reserve(int(qMin(m_messageSize, MaxPayloadReserve)));
+    }
+    return true;
+}
+
+void Protocole::dropFrame(qint64 size) {
+    qDebug() << "Dropping a frame of" << size << "bytes, the maximum is"
+             << m_maxFrameSize;
+    m_stats.oversizedFrames++;
+    emit frameTooLarge(size);
+}
+
 void Protocole::onReadyRead() {
-    while (1) {
-        if (m_messageSize == 0) {
-            // waiting header
-            if (!m_device->canReadLine()) {
+    while (m_device && m_device->isOpen()) {
+        if (m_queuedBytes >= m_maxQueuedBytes) {
+            // resumed by nextAvailableMessage()
+            if (!m_readPaused) {
+                m_readPaused = true;
+                m_stats.readPauses++;
+            }
+            return;
+        }
+        if (!m_hasHeader && !readHeader()) {
+            return;
+        }
+        if (m_bytesToSkip > 0) {
+            qint64 skipped = m_device->skip(
+                qMin(m_bytesToSkip, m_device->bytesAvailable()));
+            if (skipped <= 0) {
                 return;  // we need more data
             }
-            QString entete = QString(m_device->readLine());
-            bool ok = false;
-            m_messageSize = entete.toLongLong(&ok);
-            if (!ok || m_messageSize == 0) {
-                qDebug() << QString("Error while reading frame header: %1")
-                                .arg(entete);
-                close();
-                return;
+            m_stats.receivedBytes += skipped;
+            m_bytesToSkip -= skipped;
+            if (m_bytesToSkip == 0) {
+                m_hasHeader = false;
+                m_messageSize = 0;
             }
-        }
-        if (m_device->bytesAvailable() < m_messageSize) {
-            return;  // we need more data
+            continue;
         }
 
-        // the message now
-        m_receivedMessages.push_front(m_device->read(m_messageSize));
+        // the message now, read as it arrives
+        qint64 missing = m_messageSize - m_payload.size();
+        if (missing > 0) {
+            QByteArray data = m_device->read(missing);
+            m_stats.receivedBytes += data.size();
+            m_payload.append(data);
+            if (m_payload.size() < m_messageSize) {
+                return;  // we need more data
+            }
+        }
+        QByteArray payload;
+        payload.swap(m_payload);
+        m_hasHeader = false;
         m_messageSize = 0;
+        if (m_frameType != MessageFrame) {
+            qDebug() << "Ignoring frame of type" << m_frameType;
+            m_stats.droppedFrames++;
+            continue;
+        }
+        if (m_frameFlags & CompressedFlag) {
+            // qCompress() format starts with the uncompressed size, which
+            // qUncompress() allocates
+            qint64 size = 0;
+            if (payload.size() >= 4) {
+                size = qFromBigEndian<quint32>(
+                    reinterpret_cast<const uchar *>(payload.constData()));
+            }
+            if (size > m_maxFrameSize) {
+                dropFrame(size);
+                continue;
+            }
+            payload = qUncompress(payload);
+            if (payload.isEmpty()) {
+                qDebug() << "Error while uncompressing a frame";
+                close();
+                return;
+            }
+            if (payload.size() > m_maxFrameSize) {
+                // the announced size lied
+                dropFrame(payload.size());
+                continue;
+            }
+        }
+        m_queuedBytes += payload.size();
+        m_receivedMessages.append(payload);
         emit messageReceived();
     }
 }
@@ -84,21 +230,60 @@ QByteArray Protocole::nextAvailableMessage() {
     }
     QByteArray message = m_receivedMessages.front();
     m_receivedMessages.removeFirst();
+    m_queuedBytes -= message.size();
+    if (m_readPaused && m_queuedBytes < m_maxQueuedBytes) {
+        m_readPaused = false;
+        // no readyRead() is emitted for the data already buffered
+        QMetaObject::invokeMethod(this, "onReadyRead", Qt::QueuedConnection);
+    }
     return message;
 }
 
-bool Protocole::sendMessage(const QByteArray & ba) {
+void Protocole::writeBinaryFrame(FrameType type, const QByteArray & payload,
+                                 int flags) {
+    uchar entete[BinaryHeaderSize];
+    qToBigEndian<quint32>(payload.size(), entete);
+    entete[4] = type;
+    entete[5] = flags;
+    entete[6] = 0;  // reserved
+    entete[7] = 0;
+    m_device->write(reinterpret_cast<const char *>(entete), BinaryHeaderSize);
+    m_device->write(payload);
+}
+
+bool Protocole::sendMessage(const QByteArray & ba,
+                            const QList<QByteArray> & attachments) {
     if (!m_device) {
         return false;
     }
-    QByteArray messageToSend;
-    messageToSend.append(QString::number(ba.size()).toUtf8());
-    messageToSend.append('\n');
-    messageToSend.append(ba);
-    m_device->write(messageToSend);
+    if (m_framing == BinaryFraming) {
+        foreach (const QByteArray & attachment, attachments) {
+            writeBinaryFrame(AttachmentFrame, attachment);
+        }
+        if (m_compression == ZlibCompression &&
+            ba.size() >= m_compressionThreshold) {
+            writeBinaryFrame(MessageFrame, qCompress(ba, m_compressionLevel),
+                             CompressedFlag);
+        } else {
+            writeBinaryFrame(MessageFrame, ba);
+        }
+    } else {
+        if (!attachments.isEmpty()) {
+            qDebug() << "Attachments can not be sent with the text framing";
+        }
+        // the header and the body are written separately to avoid copying
+        // the body
+        m_device->write(QByteArray::number(ba.size()) + '\n');
+        m_device->write(ba);
+    }
+    m_framing = m_nextFraming;
     return true;
 }
 
+qint64 Protocole::bytesToWrite() const {
+    return m_device ? m_device->bytesToWrite() : 0;
+}
+
 void Protocole::close() {
     if (m_device) {
         m_device->close();
@@ -39,30 +39,162 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 #include <QIODevice>
 #include <QList>
 #include <QObject>
-
+#include <QPointer>
+
+/**
+ * @brief Split the data of a QIODevice into messages, and write messages on
+ * it.
+ *
+ * Two framings are available:
+ *
+ * - TextFraming (the default): each message is preceded by its size written
+ *   as text and a line feed ("26\n{...}").
+ * - BinaryFraming: each frame is preceded by a fixed size header of
+ *   BinaryHeaderSize bytes: the payload size (big endian quint32), the
+ *   frame type (quint8), some flags (quint8) and two reserved bytes. Raw
+ *   attachment frames may be sent before a message, which can reference them
+ *   by their index.
+ *
+ * With the BinaryFraming, messages bigger than a threshold may be compressed
+ * (see setCompression()). Such frames have the CompressedFlag and contain
+ * data in the qCompress() format.
+ *
+ * Received frames bigger than maxFrameSize() are skipped and signaled with
+ * frameTooLarge(). Reading is paused while the received messages not yet
+ * taken with nextAvailableMessage() exceed maxQueuedBytes(), and the read
+ * buffer of sockets is bounded, so that a client can not make the
+ * application allocate too much memory.
+ */
 class Protocole : public QObject {
     Q_OBJECT
 public:
+    enum Framing { TextFraming, BinaryFraming };
+
+    enum FrameType { MessageFrame = 0, AttachmentFrame = 1 };
+
+    enum FrameFlag { CompressedFlag = 0x01 };
+
+    enum Compression { NoCompression, ZlibCompression };
+
+    enum {
+        BinaryHeaderSize = 8,
+        DefaultCompressionThreshold = 16384,
+        DefaultMaxFrameSize = 64 * 1024 * 1024,
+        DefaultMaxQueuedBytes = 16 * 1024 * 1024,
+        SocketReadBufferSize = 1024 * 1024
+    };
+
+    /**
+     * @brief Counters of the received data.
+     */
+    struct Stats {
+        Stats()
+            : receivedFrames(0),
+              receivedBytes(0),
+              droppedFrames(0),
+              oversizedFrames(0),
+              readPauses(0) {}
+        qint64 receivedFrames;
+        qint64 receivedBytes;
+        qint64 droppedFrames;  // ignored frames (unknown types, attachments)
+        qint64 oversizedFrames;
+        qint64 readPauses;
+    };
+
     explicit Protocole(QObject * parent = 0);
 
+    /**
+     * @brief Set the device, and bound its read buffer if it is a socket.
+     */
     void setDevice(QIODevice * device);
 
-    bool sendMessage(const QByteArray & ba);
+    /**
+     * @brief Maximum size of a received frame (once uncompressed). The
+     * default may be changed with the FUNQ_MAX_FRAME_SIZE environment
+     * variable.
+     */
+    qint64 maxFrameSize() const { return m_maxFrameSize; }
+    void setMaxFrameSize(qint64 size) { m_maxFrameSize = size; }
+
+    qint64 maxQueuedBytes() const { return m_maxQueuedBytes; }
+    void setMaxQueuedBytes(qint64 size) { m_maxQueuedBytes = size; }
+
+    const Stats & stats() const { return m_stats; }
+
+    Framing framing() const { return m_framing; }
+    void setFraming(Framing framing) { m_framing = m_nextFraming = framing; }
+
+    /**
+     * @brief Switch to the given framing once the next message is sent.
+     *
+     * This allows to answer a negotiation request with the framing the client
+     * used to send it.
+     */
+    void setFramingAfterNextMessage(Framing framing);
+
+    /**
+     * @brief Compress the messages of at least threshold bytes sent with the
+     * BinaryFraming.
+     *
+     * level is the zlib compression level given to qCompress(), from 0 to 9
+     * (1 is the fastest), -1 meaning the zlib default.
+     */
+    void setCompression(Compression compression,
+                        int threshold = DefaultCompressionThreshold,
+                        int level = -1);
+    Compression compression() const { return m_compression; }
+    int compressionThreshold() const { return m_compressionThreshold; }
+
+    /**
+     * @brief Send a message, preceded by its attachments.
+     *
+     * Attachments can only be sent with the BinaryFraming.
+     */
+    bool sendMessage(const QByteArray & ba,
+                     const QList<QByteArray> & attachments =
+                         QList<QByteArray>());
 
     QByteArray nextAvailableMessage();
 
     inline bool hasAvailableMessage() { return !m_receivedMessages.isEmpty(); }
 
     void close();
+
+    /**
+     * @brief Returns the number of bytes waiting to be written.
+     */
+    qint64 bytesToWrite() const;
+
 signals:
     void messageReceived();
+    void frameTooLarge(qint64 size);
 
 private slots:
     void onReadyRead();
 
 private:
-    QIODevice * m_device;
+    bool readHeader();
+    void dropFrame(qint64 size);
+    void writeBinaryFrame(FrameType type, const QByteArray & payload,
+                          int flags = 0);
+
+    QPointer<QIODevice> m_device;
+    Framing m_framing;
+    Framing m_nextFraming;
+    bool m_hasHeader;
+    int m_frameType;
+    int m_frameFlags;
     qlonglong m_messageSize;
+    qint64 m_bytesToSkip;
+    QByteArray m_payload;
+    qint64 m_maxFrameSize;
+    qint64 m_maxQueuedBytes;
+    qint64 m_queuedBytes;
+    bool m_readPaused;
+    Stats m_stats;
+    Compression m_compression;
+    int m_compressionThreshold;
+    int m_compressionLevel;
     QList<QByteArray> m_receivedMessages;
 };
 
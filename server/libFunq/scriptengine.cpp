@@ -0,0 +1,217 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "scriptengine.h"
+
+#include "objectpath.h"
+#include "player.h"
+
+#include <QAbstractItemModel>
+#include <QAbstractItemView>
+#include <QCryptographicHash>
+
+ScriptBindings::ScriptBindings(Player * player, QObject * parent)
+    : QObject(parent), m_player(player) {
+}
+
+QVariant ScriptBindings::find(const QString & path) {
+    qulonglong id = m_player->registerObject(ObjectPath::findObject(path));
+    return id ? QVariant(id) : QVariant();
+}
+
+QVariantMap ScriptBindings::properties(const QVariant & oid) {
+    QVariantMap args;
+    args["oid"] = oid;
+    return call("object_properties", args);
+}
+
+QVariantMap ScriptBindings::call(const QString & action,
+                                 const QVariantMap & args) {
+    if (action == "eval_script") {
+        return Player::createError("ScriptError",
+                                   "eval_script can not be called by a script");
+    }
+    QtJson::JsonObject command(args);
+    command["action"] = action;
+    return m_player->callAction(command);
+}
+
+QAbstractItemModel * ScriptBindings::model(const QVariant & oid) {
+    QObject * object = m_player->registeredObject(oid.value<qulonglong>());
+    if (QAbstractItemView * view = qobject_cast<QAbstractItemView *>(object)) {
+        return view->model();
+    }
+    return qobject_cast<QAbstractItemModel *>(object);
+}
+
+int ScriptBindings::rowCount(const QVariant & oid) {
+    QAbstractItemModel * m = model(oid);
+    return m ? m->rowCount() : -1;
+}
+
+int ScriptBindings::columnCount(const QVariant & oid) {
+    QAbstractItemModel * m = model(oid);
+    return m ? m->columnCount() : -1;
+}
+
+QVariant ScriptBindings::data(const QVariant & oid, int row, int column,
+                              const QString & role) {
+    QAbstractItemModel * m = model(oid);
+    if (!m) {
+        return QVariant();
+    }
+    int roleId = role == "checkState" ? int(Qt::CheckStateRole)
+                                      : m->roleNames().key(role.toUtf8(), -1);
+    if (roleId < 0) {
+        return QVariant();
+    }
+    return m->index(row, column).data(roleId);
+}
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+ScriptWatchdog::ScriptWatchdog()
+    : m_engine(0),
+      m_deadline(0),
+      m_armed(false),
+      m_interrupted(false),
+      m_stop(false) {}
+
+ScriptWatchdog::~ScriptWatchdog() {
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stop = true;
+        m_condition.wakeAll();
+    }
+    wait();
+}
+
+void ScriptWatchdog::arm(QJSEngine * engine, int msecs) {
+    {
+        QMutexLocker locker(&m_mutex);
+        m_engine = engine;
+        m_elapsed.start();
+        m_deadline = msecs;
+        m_armed = true;
+        m_interrupted = false;
+        m_condition.wakeAll();
+    }
+    if (!isRunning()) {
+        start();
+    }
+}
+
+bool ScriptWatchdog::disarm() {
+    bool interrupted = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        m_armed = false;
+        interrupted = m_interrupted;
+        m_condition.wakeAll();
+    }
+    // ready for the next script
+    m_engine->setInterrupted(false);
+    return interrupted;
+}
+
+void ScriptWatchdog::run() {
+    QMutexLocker locker(&m_mutex);
+    while (!m_stop) {
+        if (!m_armed) {
+            m_condition.wait(&m_mutex);
+            continue;
+        }
+        const qint64 remaining = m_deadline - m_elapsed.elapsed();
+        if (remaining <= 0) {
+            m_engine->setInterrupted(true);
+            m_interrupted = true;
+            m_armed = false;
+        } else {
+            m_condition.wait(&m_mutex, ulong(remaining));
+        }
+    }
+}
+#endif
+
+ScriptEngine::ScriptEngine(Player * player)
+    : QObject(player), m_bindings(new ScriptBindings(player, this)) {
+    m_engine.globalObject().setProperty("funq",
+                                        m_engine.newQObject(m_bindings));
+}
+
+QtJson::JsonObject ScriptEngine::evaluate(const QString & script,
+                                          const QVariantMap & args,
+                                          int timeout) {
+    QByteArray hash =
+        QCryptographicHash::hash(script.toUtf8(), QCryptographicHash::Sha1);
+    QJSValue function = m_scripts.value(hash);
+    if (function.isUndefined()) {
+        function = m_engine.evaluate("(function(args) {\n" + script + "\n})",
+                                     "eval_script");
+        if (!function.isError()) {
+            if (m_scripts.count() >= MaxCachedScripts) {
+                m_scripts.clear();
+            }
+            m_scripts.insert(hash, function);
+        }
+    }
+    QJSValue value = function;
+    if (!function.isError()) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        m_watchdog.arm(&m_engine, timeout);
+        value = function.call(QJSValueList() << m_engine.toScriptValue(args));
+        if (m_watchdog.disarm() && value.isError()) {
+            return Player::createError(
+                "ScriptTimeout",
+                QString::fromUtf8("The script ran more than %1 ms")
+                    .arg(timeout));
+        }
+#else
+        Q_UNUSED(timeout);
+        value = function.call(QJSValueList() << m_engine.toScriptValue(args));
+#endif
+    }
+    if (value.isError()) {
+        // the first line is the function header
+        return Player::createError(
+            "ScriptError",
+            QString::fromUtf8("line %1: %2")
+                .arg(value.property("lineNumber").toInt() - 1)
+                .arg(value.toString()));
+    }
+    QtJson::JsonObject result;
+    if (!value.isNull() && !value.isUndefined()) {
+        result["result"] = value.toVariant();
+    }
+    return result;
+}
@@ -0,0 +1,162 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef SCRIPTENGINE_H
+#define SCRIPTENGINE_H
+
+#include "json.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJSEngine>
+#include <QJSValue>
+#include <QMutex>
+#include <QObject>
+#include <QThread>
+#include <QWaitCondition>
+
+class Player;
+class QAbstractItemModel;
+
+/**
+ * @brief Functions available to the scripts under the "funq" name.
+ *
+ * Objects are designated by their oid, as in the protocol.
+ */
+class ScriptBindings : public QObject {
+    Q_OBJECT
+public:
+    explicit ScriptBindings(Player * player, QObject * parent = 0);
+
+    /**
+     * @brief Returns the oid of the object at path, or null.
+     */
+    Q_INVOKABLE QVariant find(const QString & path);
+    Q_INVOKABLE QVariantMap properties(const QVariant & oid);
+    /**
+     * @brief Execute a synchronous action of the Player, like
+     * funq.call("widget_click", {oid: oid}).
+     */
+    Q_INVOKABLE QVariantMap call(const QString & action,
+                                 const QVariantMap & args = QVariantMap());
+
+    /**
+     * @brief Access to the top level rows of a model, or of the model of a
+     * view. role is a role name like "display", "edit" or "checkState".
+     */
+    Q_INVOKABLE int rowCount(const QVariant & oid);
+    Q_INVOKABLE int columnCount(const QVariant & oid);
+    Q_INVOKABLE QVariant data(const QVariant & oid, int row, int column,
+                              const QString & role = QString("display"));
+
+private:
+    QAbstractItemModel * model(const QVariant & oid);
+
+    Player * m_player;
+};
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+/**
+ * @brief Thread interrupting a QJSEngine once a script runs past its
+ * deadline (QJSEngine::setInterrupted() is thread safe).
+ */
+class ScriptWatchdog : public QThread {
+public:
+    ScriptWatchdog();
+    ~ScriptWatchdog();
+
+    /**
+     * @brief Interrupt engine in msecs milliseconds.
+     */
+    void arm(QJSEngine * engine, int msecs);
+
+    /**
+     * @brief Stop watching the engine, and returns true if it was
+     * interrupted.
+     */
+    bool disarm();
+
+protected:
+    void run();
+
+private:
+    QJSEngine * m_engine;
+    QMutex m_mutex;
+    QWaitCondition m_condition;
+    QElapsedTimer m_elapsed;
+    qint64 m_deadline;
+    bool m_armed;
+    bool m_interrupted;
+    bool m_stop;
+};
+#endif
+
+/**
+ * @brief Run the scripts of the eval_script command in a QJSEngine of its
+ * own, without the Qt extensions, the only binding being "funq".
+ *
+ * A script is the body of a function receiving the "args" of the command.
+ * Compiled scripts are cached by hash so that repeated calls are not parsed
+ * again.
+ *
+ * With Qt >= 5.14, a script running longer than its time limit is
+ * interrupted by a ScriptWatchdog; older versions can not stop a script.
+ */
+class ScriptEngine : public QObject {
+    Q_OBJECT
+public:
+    enum { MaxCachedScripts = 128, DefaultTimeout = 10000 };
+
+    explicit ScriptEngine(Player * player);
+
+    /**
+     * @brief Returns {"result": value}, a ScriptError, or a ScriptTimeout
+     * error if the script ran more than timeout milliseconds.
+     */
+    QtJson::JsonObject evaluate(const QString & script,
+                                const QVariantMap & args,
+                                int timeout = DefaultTimeout);
+
+    int cachedScripts() const { return m_scripts.count(); }
+
+private:
+    QJSEngine m_engine;
+    ScriptBindings * m_bindings;
+    QHash<QByteArray, QJSValue> m_scripts;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    ScriptWatchdog m_watchdog;
+#endif
+};
+
+#endif  // SCRIPTENGINE_H
@@ -0,0 +1,126 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "sharedbuffer.h"
+
+#include <QDebug>
+#include <QDir>
+
+#include <cstring>
+
+namespace {
+QString sharedDirectory() {
+#ifdef Q_OS_LINUX
+    // memory backed, so the mapping is never written to disk
+    if (QDir("/dev/shm").exists()) {
+        return "/dev/shm";
+    }
+#endif
+    return QDir::tempPath();
+}
+}  // namespace
+
+SharedBuffer::SharedBuffer(qint64 capacity)
+    : m_file(sharedDirectory() + "/funq-XXXXXX.shm"),
+      m_data(0),
+      m_capacity(capacity),
+      m_position(HeaderSize),
+      m_lap(0) {
+    if (!m_file.open() || !m_file.resize(capacity)) {
+        qDebug() << "Unable to create the shared buffer"
+                 << m_file.errorString();
+        return;
+    }
+    m_data = m_file.map(0, capacity);
+    if (!m_data) {
+        qDebug() << "Unable to map the shared buffer" << m_file.errorString();
+        return;
+    }
+    const qint64 end = m_position;
+    memcpy(m_data, &end, sizeof(end));
+}
+
+SharedBuffer::~SharedBuffer() {
+    if (m_data) {
+        m_file.unmap(m_data);
+    }
+}
+
+uchar * SharedBuffer::allocate(qint64 size, qint64 * sequence) {
+    if (!m_data || size > m_capacity - HeaderSize) {
+        return 0;
+    }
+    QMutexLocker locker(&m_mutex);
+    if (m_position + size > m_capacity) {
+        m_position = HeaderSize;
+        m_lap += 1;
+    }
+    uchar * data = m_data + m_position;
+    if (sequence) {
+        *sequence = m_lap * m_capacity + m_position;
+    }
+    m_position += (size + Alignment - 1) / Alignment * Alignment;
+    // published before the block is written, so that clients still reading
+    // the blocks it overwrites know it
+    const qint64 end = m_lap * m_capacity + m_position;
+    memcpy(m_data, &end, sizeof(end));
+    return data;
+}
+
+bool SharedBuffer::contains(const uchar * data) const {
+    return m_data && data >= m_data && data < m_data + m_capacity;
+}
+
+QtJson::JsonObject SharedBuffer::descriptor(const uchar * data, qint64 size,
+                                            const QString & format,
+                                            qint64 sequence) const {
+    QtJson::JsonObject result;
+    result["name"] = path();
+    result["offset"] = static_cast<qlonglong>(data - m_data);
+    result["size"] = size;
+    result["format"] = format;
+    result["sequence"] = sequence;
+    return result;
+}
+
+QtJson::JsonObject SharedBuffer::write(const QByteArray & data,
+                                       const QString & format) {
+    qint64 sequence = 0;
+    uchar * block = allocate(data.size(), &sequence);
+    if (!block) {
+        return QtJson::JsonObject();
+    }
+    memcpy(block, data.constData(), data.size());
+    return descriptor(block, data.size(), format, sequence);
+}
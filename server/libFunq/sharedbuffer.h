@@ -0,0 +1,113 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef SHAREDBUFFER_H
+#define SHAREDBUFFER_H
+
+#include "json.h"
+
+#include <QMutex>
+#include <QTemporaryFile>
+
+/**
+ * @brief A memory mapped file, shared with local clients, used as a ring to
+ * transfer bulk data without copying it in the protocol messages.
+ *
+ * Blocks are allocated one after the other and the allocation restarts at
+ * the beginning of the file once its end is reached. So a block stays valid
+ * until enough data has been allocated after it, and clients have to read it
+ * as soon as they receive its descriptor.
+ *
+ * Allocations are numbered by a sequence that never wraps: the offset of the
+ * block plus the capacity times the number of times the ring restarted. The
+ * file starts with a header holding the sequence of the end of the last
+ * allocation (a native 64 bits integer), and descriptors give the sequence
+ * of their block. A client checks after reading a block that this end is
+ * not more than capacity() after the block sequence, else the block may have
+ * been overwritten.
+ *
+ * Blocks may be allocated from the GUI and the network I/O threads.
+ */
+class SharedBuffer {
+public:
+    enum {
+        DefaultCapacity = 32 * 1024 * 1024,
+        Alignment = 64,
+        HeaderSize = Alignment
+    };
+
+    explicit SharedBuffer(qint64 capacity = DefaultCapacity);
+    ~SharedBuffer();
+
+    bool isValid() const { return m_data != 0; }
+    QString path() const { return m_file.fileName(); }
+    qint64 capacity() const { return m_capacity; }
+
+    /**
+     * @brief Allocate a block of size bytes in the ring, or returns 0 if it
+     * can not fit. The sequence of the block is stored in sequence if given.
+     */
+    uchar * allocate(qint64 size, qint64 * sequence = 0);
+
+    /**
+     * @brief Returns true if data points inside the mapped memory.
+     */
+    bool contains(const uchar * data) const;
+
+    /**
+     * @brief Returns the descriptor of size bytes stored at data, a block
+     * allocated with the given sequence.
+     */
+    QtJson::JsonObject descriptor(const uchar * data, qint64 size,
+                                  const QString & format,
+                                  qint64 sequence) const;
+
+    /**
+     * @brief Copy data in a new block and returns its descriptor, or an
+     * empty object if it does not fit.
+     */
+    QtJson::JsonObject write(const QByteArray & data, const QString & format);
+
+private:
+    Q_DISABLE_COPY(SharedBuffer)
+
+    QMutex m_mutex;
+    QTemporaryFile m_file;
+    uchar * m_data;
+    qint64 m_capacity;
+    qint64 m_position;
+    qint64 m_lap;
+};
+
+#endif  // SHAREDBUFFER_H
@@ -74,9 +74,10 @@ void ShortcutResponse::execute(int call) {
     }
     if (call == 0) {
         m_target->repaint();
-        setInterval(100);
+        waitForIdle();
     } else if (call == 1) {
         m_target->grabKeyboard();
+        waitForIdle();
     } else if (call == 2) {
         // taken from
         // http://stackoverflow.com/questions/14283764/how-can-i-simulate-emission-of-a-standard-key-sequence
@@ -88,6 +89,8 @@ void ShortcutResponse::execute(int call) {
             key = key & ~Qt::KeyboardModifierMask;
             QTest::keyPress(m_target, static_cast<Qt::Key>(key), modifiers);
         }
+        // let the shortcut be handled before releasing the keys
+        waitForIdle();
     } else if (call == 3) {
         for (int i = 0; i < static_cast<int>(m_binding.count()); ++i) {
             uint key = m_binding[i];
@@ -97,6 +100,7 @@ void ShortcutResponse::execute(int call) {
             key = key & ~Qt::KeyboardModifierMask;
             QTest::keyRelease(m_target, static_cast<Qt::Key>(key), modifiers);
         }
+        waitForIdle();
     } else if (call == 4) {
         m_target->releaseKeyboard();
         writeResponse(QtJson::JsonObject());
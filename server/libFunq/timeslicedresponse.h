@@ -0,0 +1,82 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef TIMESLICEDRESPONSE_H
+#define TIMESLICEDRESPONSE_H
+
+#include "delayedresponse.h"
+
+/**
+ * @brief The "time_slice" argument, to visit from the arguments of the time
+ * sliced actions so that it is part of their schema.
+ */
+struct TimeSliceArgs {
+    enum { DefaultTimeSlice = 5 };
+    TimeSliceArgs() : timeSlice(DefaultTimeSlice) {}
+    int timeSlice;
+    template <class V>
+    void visit(V & v) {
+        v.optional("time_slice", timeSlice);
+    }
+};
+
+/**
+ * @brief Delayed response doing its work by small steps, in time slices
+ * separated by event loop iterations, so that the tested application stays
+ * responsive during big queries.
+ *
+ * The slice budget is given by the "time_slice" argument of the command, in
+ * milliseconds (5 by default), see TimeSliceArgs. At least one step is done
+ * by slice.
+ */
+class TimeSlicedResponse : public DelayedResponse {
+public:
+    explicit TimeSlicedResponse(JsonClient * client,
+                                const QtJson::JsonObject & command);
+
+protected:
+    /**
+     * @brief Do a bounded amount of work, and call writeResponse() when
+     * done. Returns false to end the current slice early.
+     */
+    virtual bool step() = 0;
+
+    virtual void execute(int call);
+    virtual bool canRunSynchronously() const { return true; }
+
+private:
+    int m_timeSlice;
+};
+
+#endif  // TIMESLICEDRESPONSE_H
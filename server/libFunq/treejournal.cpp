@@ -0,0 +1,312 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#include "treejournal.h"
+
+#include <QApplication>
+#include <QChildEvent>
+#include <QPair>
+#include <QSet>
+#include <QWidget>
+#include <limits>
+
+#include "commandargs.h"
+#include "jsonclient.h"
+#include "objectpath.h"
+
+static const int DefaultCapacity = 4096;
+static const int DefaultInterval = 50;
+
+TreeJournal * TreeJournal::instance() {
+    static QPointer<TreeJournal> journal;
+    if (!journal && qApp) {
+        journal = new TreeJournal(qApp);
+    }
+    return journal;
+}
+
+TreeJournal::TreeJournal(QObject * parent)
+    : QObject(parent),
+      m_capacity(DefaultCapacity),
+      m_lastSequence(0),
+      m_subscribers(0) {}
+
+void TreeJournal::subscribe() {
+    m_subscribers += 1;
+    if (m_subscribers == 1) {
+        qApp->installEventFilter(this);
+        // renames are not notified by events
+        foreach (QWidget * widget, QApplication::allWidgets()) {
+            watchName(widget);
+        }
+    }
+}
+
+void TreeJournal::unsubscribe() {
+    m_subscribers -= 1;
+    if (m_subscribers == 0) {
+        if (qApp) {
+            qApp->removeEventFilter(this);
+        }
+        m_entries.clear();
+    }
+}
+
+bool TreeJournal::eventFilter(QObject * watched, QEvent * event) {
+    switch (event->type()) {
+        case QEvent::ChildAdded:
+        case QEvent::ChildRemoved:
+            if (watched->isWidgetType()) {
+                // any child may change the names of the widget children
+                QObject * child = static_cast<QChildEvent *>(event)->child();
+                if (event->type() == QEvent::ChildAdded &&
+                    child->isWidgetType()) {
+                    watchName(child);
+                }
+                record(Children, watched);
+            }
+            break;
+        case QEvent::ZOrderChange:
+            if (watched->isWidgetType() && watched->parent()) {
+                record(Children, watched->parent());
+            }
+            break;
+        case QEvent::Show:
+        case QEvent::Hide:
+            if (watched->isWidgetType()) {
+                if (static_cast<QWidget *>(watched)->isWindow()) {
+                    record(Roots, 0);
+                }
+                record(event->type() == QEvent::Show ? Shown : Hidden,
+                       watched);
+            }
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+void TreeJournal::onObjectNameChanged() {
+    QObject * object = sender();
+    if (object && object->parent()) {
+        record(Children, object->parent());
+    } else {
+        record(Roots, 0);
+    }
+}
+
+void TreeJournal::watchName(QObject * widget) {
+    connect(widget, SIGNAL(objectNameChanged(QString)), this,
+            SLOT(onObjectNameChanged()), Qt::UniqueConnection);
+}
+
+void TreeJournal::record(Kind kind, QObject * object) {
+    if (m_subscribers == 0) {
+        return;
+    }
+    if (!m_entries.isEmpty() && m_entries.last().kind == kind &&
+        m_entries.last().object.data() == object) {
+        return;
+    }
+    Entry entry;
+    entry.sequence = ++m_lastSequence;
+    entry.kind = kind;
+    entry.object = object;
+    m_entries << entry;
+    if (m_entries.count() > m_capacity) {
+        m_entries.removeFirst();
+    }
+    emit changed();
+}
+
+quint64 TreeJournal::changesSince(quint64 since,
+                                  QtJson::JsonArray & changes) const {
+    if (m_entries.isEmpty() || since >= m_lastSequence) {
+        return m_lastSequence;
+    }
+    const quint64 first = m_entries.first().sequence;
+    if (since + 1 < first) {
+        // the entries were dropped before being read
+        QtJson::JsonObject reset;
+        reset["seq"] = m_lastSequence;
+        reset["event"] = "reset";
+        changes << reset;
+        return m_lastSequence;
+    }
+    const int start = int(since + 1 - first);
+    QSet<QObject *> shown, hidden;
+    for (int i = start; i < m_entries.count(); ++i) {
+        if (m_entries[i].kind == Shown) {
+            shown << m_entries[i].object.data();
+        } else if (m_entries[i].kind == Hidden) {
+            hidden << m_entries[i].object.data();
+        }
+    }
+    static const char * const names[] = {"children", "shown", "hidden",
+                                          "roots"};
+    QSet<QPair<int, QObject *> > done;
+    for (int i = start; i < m_entries.count(); ++i) {
+        const Entry & entry = m_entries[i];
+        QObject * object = entry.object.data();
+        if (entry.kind != Roots && !object) {
+            continue;  // destroyed since
+        }
+        QPair<int, QObject *> key(entry.kind, object);
+        if (done.contains(key)) {
+            continue;
+        }
+        done.insert(key);
+        if (entry.kind == Shown || entry.kind == Hidden) {
+            const QSet<QObject *> & same =
+                entry.kind == Shown ? shown : hidden;
+            bool covered = false;
+            for (QObject * parent = object->parent(); parent && !covered;
+                 parent = parent->parent()) {
+                covered = same.contains(parent);
+            }
+            if (covered) {
+                continue;
+            }
+        }
+        QtJson::JsonObject change;
+        change["seq"] = entry.sequence;
+        change["event"] = names[entry.kind];
+        if (object) {
+            change["path"] = ObjectPath::objectPath(object);
+        }
+        changes << change;
+    }
+    return m_lastSequence;
+}
+
+struct SubscribeTreeArgs {
+    SubscribeTreeArgs() : interval(DefaultInterval) {}
+    int interval;
+    template <class V>
+    void visit(V & v) {
+        v.optional("interval", interval);
+    }
+};
+static const CommandArgs::Register<SubscribeTreeArgs> subscribeTreeArgs(
+    "subscribe_tree");
+
+QHash<int, TreeSubscription *> TreeSubscription::s_subscriptions;
+int TreeSubscription::s_lastToken = 0;
+
+TreeSubscription::TreeSubscription(JsonClient * client,
+                                   const QtJson::JsonObject & command)
+    : DelayedResponse(client, command, 0, std::numeric_limits<int>::max()),
+      m_journal(TreeJournal::instance()),
+      m_token(++s_lastToken),
+      m_interval(DefaultInterval),
+      m_sequence(0),
+      m_subscribed(false),
+      m_batching(false) {
+    SubscribeTreeArgs args;
+    QtJson::JsonObject error;
+    if (!CommandArgs::decode(command, args, error)) {
+        writeResponse(error);
+        return;
+    }
+    if (!m_journal) {
+        writeResponse(client->createError(
+            "NoApplication", "The tree journal requires an application"));
+        return;
+    }
+    m_interval = qMax(0, args.interval);
+    m_journal->subscribe();
+    m_subscribed = true;
+    m_sequence = m_journal->lastSequence();
+    s_subscriptions.insert(m_token, this);
+}
+
+TreeSubscription::~TreeSubscription() {
+    s_subscriptions.remove(m_token);
+    if (m_subscribed && m_journal) {
+        m_journal->unsubscribe();
+    }
+}
+
+TreeSubscription * TreeSubscription::find(JsonClient * client, int token) {
+    TreeSubscription * subscription = s_subscriptions.value(token);
+    if (subscription && subscription->jsonClient() == client) {
+        return subscription;
+    }
+    return 0;
+}
+
+void TreeSubscription::finish() {
+    s_subscriptions.remove(m_token);
+    if (!hasResponded() && m_journal) {
+        flush(true);
+    }
+}
+
+void TreeSubscription::execute(int call) {
+    if (!m_journal) {
+        writeResponse(QtJson::JsonObject());
+        return;
+    }
+    if (call == 0) {
+        QtJson::JsonObject result;
+        result["subscription"] = m_token;
+        result["seq"] = m_sequence;
+        result["changes"] = QtJson::JsonArray();
+        writePartialResponse(result);
+    } else if (m_batching && canWritePartialResponse()) {
+        m_batching = false;
+        flush(false);
+    }
+    if (m_batching || m_journal->lastSequence() > m_sequence) {
+        // gather the changes of the next interval in one part
+        m_batching = true;
+        waitFor(m_interval);
+    } else {
+        waitForSignal(m_journal, SIGNAL(changed()));
+    }
+}
+
+void TreeSubscription::flush(bool last) {
+    QtJson::JsonArray changes;
+    m_sequence = m_journal->changesSince(m_sequence, changes);
+    QtJson::JsonObject result;
+    result["seq"] = m_sequence;
+    result["changes"] = changes;
+    if (last) {
+        writeResponse(result);
+    } else if (!changes.isEmpty()) {
+        writePartialResponse(result);
+    }
+}
@@ -0,0 +1,150 @@
+/*
+Copyright: SCLE SFE
+Contributor: Julien Pagès <j.parkouss@gmail.com>
+
+This software is a computer program whose purpose is to test graphical
+applications written with the QT framework (http://qt.digia.com/).
+
+This software is governed by the CeCILL v2.1 license under French law and
+abiding by the rules of distribution of free software.  You can  use,
+modify and/ or redistribute the software under the terms of the CeCILL
+license as circulated by CEA, CNRS and INRIA at the following URL
+"http://www.cecill.info".
+
+As a counterpart to the access to the source code and  rights to copy,
+modify and redistribute granted by the license, users are provided only
+with a limited warranty  and the software's author,  the holder of the
+economic rights,  and the successive licensors  have only  limited
+liability.
+
+In this respect, the user's attention is drawn to the risks associated
+with loading,  using,  modifying and/or developing or reproducing the
+software by the user in light of its specific status of free software,
+that may mean  that it is complicated to manipulate,  and  that  also
+therefore means  that it is reserved for developers  and  experienced
+professionals having in-depth computer knowledge. Users are therefore
+encouraged to load and test the software's suitability as regards their
+requirements in conditions enabling the security of their systems and/or
+data to be ensured and,  more generally, to use and operate it in the
+same conditions as regards security.
+
+The fact that you are presently reading this means that you have had
+knowledge of the CeCILL v2.1 license and that you accept its terms.
+*/
+
+#ifndef TREEJOURNAL_H
+#define TREEJOURNAL_H
+
+#include "delayedresponse.h"
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+
+/**
+ * @brief Journal of the changes of the widgets tree, with sequence numbers.
+ *
+ * Records that the children of a widget changed (added, removed, renamed or
+ * restacked), that a widget was shown or hidden, and that the top-level
+ * widgets may have changed. Only widgets and their direct children are
+ * watched, through an application event filter installed while there are
+ * subscribers, so the journal costs nothing otherwise. Everything happens
+ * in the GUI thread, without locks.
+ *
+ * The journal keeps the last capacity() entries; a subscriber that did not
+ * read the older ones gets a "reset" entry instead.
+ */
+class TreeJournal : public QObject {
+    Q_OBJECT
+public:
+    enum Kind { Children, Shown, Hidden, Roots };
+
+    /**
+     * @brief Returns the journal of the application (0 without
+     * application).
+     */
+    static TreeJournal * instance();
+
+    void subscribe();
+    void unsubscribe();
+
+    quint64 lastSequence() const { return m_lastSequence; }
+    int capacity() const { return m_capacity; }
+
+    /**
+     * @brief Append the changes recorded after the sequence number since to
+     * changes, as {"seq", "event", "path"} objects, and returns the last
+     * sequence number. Duplicates are dropped, and so are the shown or
+     * hidden widgets having an ancestor shown or hidden in the same
+     * changes.
+     */
+    quint64 changesSince(quint64 since, QtJson::JsonArray & changes) const;
+
+    virtual bool eventFilter(QObject * watched, QEvent * event);
+
+signals:
+    void changed();
+
+private slots:
+    void onObjectNameChanged();
+
+private:
+    explicit TreeJournal(QObject * parent);
+
+    struct Entry {
+        quint64 sequence;
+        Kind kind;
+        QPointer<QObject> object;
+    };
+
+    void record(Kind kind, QObject * object);
+    void watchName(QObject * widget);
+
+    QList<Entry> m_entries;
+    int m_capacity;
+    quint64 m_lastSequence;
+    int m_subscribers;
+};
+
+/**
+ * @brief Subscription to the TreeJournal: a response that never ends by
+ * itself, sending the changes as partial responses.
+ *
+ * The first part gives the subscription token and the current sequence
+ * number. Changes are then sent at most every "interval" milliseconds (50 by
+ * default), until finish() is called by the unsubscribe_tree command.
+ */
+class TreeSubscription : public DelayedResponse {
+public:
+    TreeSubscription(JsonClient * client, const QtJson::JsonObject & command);
+    ~TreeSubscription();
+
+    /**
+     * @brief Returns the subscription of a client, or 0.
+     */
+    static TreeSubscription * find(JsonClient * client, int token);
+
+    /**
+     * @brief Send the last changes and end the subscription.
+     */
+    void finish();
+
+protected:
+    virtual void execute(int call);
+
+private:
+    void flush(bool last);
+
+    static QHash<int, TreeSubscription *> s_subscriptions;
+    static int s_lastToken;
+
+    QPointer<TreeJournal> m_journal;
+    int m_token;
+    int m_interval;
+    quint64 m_sequence;
+    bool m_subscribed;
+    bool m_batching;
+};
+
+#endif  // TREEJOURNAL_H
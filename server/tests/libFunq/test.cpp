@@ -57,10 +57,17 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 #include <QQuickView>
 #endif
 
+#include "funq.h"
+#include "handletable.h"
 #include "objectpath.h"
 #include "player.h"
+#include "protocole.h"
 #include "shortcutresponse.h"
 
+#ifdef FUNQ_COROUTINES
+#include "asyncresponse.h"
+#endif
+
 class TestDragNDropWidget : public QWidget {
 public:
     explicit TestDragNDropWidget(QWidget * parent = NULL) : QWidget(parent) {
@@ -97,6 +104,96 @@ public slots:
     }
 };
 
+/**
+ * @brief Returns every message written in the buffer.
+ */
+QList<QtJson::JsonObject> readMessages(QBuffer * buffer) {
+    QList<QtJson::JsonObject> messages;
+    buffer->seek(0);
+    while (buffer->canReadLine()) {
+        qint64 size = buffer->readLine().trimmed().toLongLong();
+        messages << QtJson::parse(QString::fromUtf8(buffer->read(size)))
+                        .toMap();
+    }
+    return messages;
+}
+
+/**
+ * @brief Run a delayed response until it answers, then returns every message
+ * written in the buffer.
+ */
+QList<QtJson::JsonObject> runDelayedResponse(DelayedResponse * dresponse,
+                                             QBuffer * buffer) {
+    QEventLoop loop;
+    QObject::connect(dresponse,
+                     SIGNAL(aboutToWriteResponse(const QtJson::JsonObject &)),
+                     &loop, SLOT(quit()));
+    dresponse->start();
+    loop.exec();
+    return readMessages(buffer);
+}
+
+/**
+ * @brief Delayed response advancing on a signal, then on an event, then once
+ * the posted events are processed.
+ */
+class WaitingResponse : public DelayedResponse {
+public:
+    WaitingResponse(JsonClient * client, const QtJson::JsonObject & command,
+                    QTimer * trigger, QWidget * widget)
+        : DelayedResponse(client, command),
+          m_trigger(trigger),
+          m_widget(widget) {}
+
+    QStringList steps;
+
+protected:
+    virtual void execute(int call) {
+        switch (call) {
+            case 0:
+                steps << "start";
+                m_trigger->start();
+                waitForSignal(m_trigger, SIGNAL(timeout()));
+                break;
+            case 1:
+                steps << "signal";
+                QCoreApplication::postEvent(m_widget, new QEvent(QEvent::User));
+                waitForEvent(m_widget, QEvent::User);
+                break;
+            case 2:
+                steps << "event";
+                waitForIdle();
+                break;
+            case 3:
+                steps << "idle";
+                writeResponse(QtJson::JsonObject());
+                break;
+        }
+    }
+
+private:
+    QTimer * m_trigger;
+    QWidget * m_widget;
+};
+
+#ifdef FUNQ_COROUTINES
+AsyncCommand awaitSteps(QTimer * trigger, QWidget * widget) {
+    QStringList steps;
+    trigger->start();
+    co_await Async::signal(trigger, SIGNAL(timeout()));
+    steps << "signal";
+    co_await Async::idle();
+    steps << "idle";
+    co_await Async::delay(10);
+    steps << "delay";
+    co_await Async::nextFrame(widget);
+    steps << "frame";
+    QtJson::JsonObject result;
+    result["steps"] = steps;
+    co_return result;
+}
+#endif
+
 class LibFunqTest : public QObject {
     Q_OBJECT
 private slots:
@@ -183,6 +280,28 @@ private slots:
 
         QCOMPARE(ObjectPath::findObject("QMainWindow:::_:NAMEd"), &obj2);
     }
+    void test_objectPath_findObject_follows_changes() {
+        QWidget parent;
+        parent.setObjectName("indexed");
+        QWidget first(&parent);
+        QWidget second(&parent);
+
+        QCOMPARE(ObjectPath::findObject("indexed::QWidget-1"), &second);
+        first.setObjectName("renamed");
+        QCOMPARE(ObjectPath::findObject("indexed::QWidget"), &second);
+        QCOMPARE(ObjectPath::findObject("indexed::QWidget-1"), (QObject *)0);
+        QCOMPARE(ObjectPath::findObject("indexed::renamed"), &first);
+
+        QWidget * third = new QWidget(&parent);
+        QCOMPARE(ObjectPath::findObject("indexed::QWidget-1"), third);
+        third->raise();
+        second.raise();
+        QCOMPARE(ObjectPath::findObject("indexed::QWidget-1"), &second);
+        delete third;
+        QCOMPARE(ObjectPath::findObject("indexed::QWidget-1"), (QObject *)0);
+        QCOMPARE(ObjectPath::childrenNames(&parent).count(),
+                 parent.children().count());
+    }
     void test_objectpath_graphicsItemId() {
         QGraphicsView view;
         QGraphicsScene scene;
@@ -257,6 +376,71 @@ private slots:
         QCOMPARE(result["errName"].toString(), QString("InvalidWidgetPath"));
     }
 
+    void test_player_wait_for_object() {
+        QMainWindow w;
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["path"] = "QMainWindow::late";
+        DelayedResponse * response = player.wait_for_object(command);
+        response->start();
+        QTest::qWait(20);
+        QVERIFY(readMessages(&buffer).isEmpty());
+
+        QObject late(&w);
+        late.setObjectName("late");
+        // answered on the ChildAdded event, before the next check
+        QTRY_COMPARE_WITH_TIMEOUT(readMessages(&buffer).count(), 1, 500);
+        QtJson::JsonObject result = readMessages(&buffer).first();
+        QCOMPARE(player.registeredObject(result["oid"].value<qulonglong>()),
+                 &late);
+        delete response;
+    }
+
+    void test_player_wait_for_object_timeout() {
+        QMainWindow w;
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["path"] = "QMainWindow::never";
+        command["timeout"] = 0.05;
+        DelayedResponse * response = player.wait_for_object(command);
+        QtJson::JsonObject result =
+            runDelayedResponse(response, &buffer).last();
+        QCOMPARE(result["errName"].toString(), QString("InvalidWidgetPath"));
+        delete response;
+    }
+
+    void test_player_wait_for_object_invalid_timeout() {
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        // answered from the constructor
+        QtJson::JsonObject command;
+        command["path"] = "QMainWindow::never";
+        command["timeout"] = -1;
+        DelayedResponse * response = player.wait_for_object(command);
+        QList<QtJson::JsonObject> messages = readMessages(&buffer);
+        QCOMPARE(messages.count(), 1);
+        QCOMPARE(messages[0]["errName"].toString(), QString("InvalidArgument"));
+        delete response;
+
+        // null is the default timeout, not an immediate one
+        command["timeout"] = QVariant();
+        response = player.wait_for_object(command);
+        response->start();
+        QTest::qWait(20);
+        QCOMPARE(readMessages(&buffer).count(), 1);
+        delete response;
+    }
+
     void test_player_object_properties() {
         QMainWindow w;
         QObject o(&w);
@@ -279,6 +463,79 @@ private slots:
         QCOMPARE(result["objectName"].toString(), QString("toto"));
     }
 
+    void test_player_batch() {
+        QMainWindow w;
+        QObject o(&w);
+        o.setObjectName("toto");
+
+        QBuffer buffer;
+
+        Player player(&buffer);
+
+        QtJson::JsonObject commandPath;
+        commandPath["action"] = "widget_by_path";
+        commandPath["path"] = "QMainWindow::toto";
+        QtJson::JsonObject commandProperties;
+        commandProperties["action"] = "object_properties";
+        commandProperties["oid"] = "$0.oid";
+        QtJson::JsonObject command;
+        command["commands"] = QVariantList() << commandPath
+                                             << commandProperties;
+
+        QVariantList results = player.batch(command)["results"].toList();
+
+        QCOMPARE(results.count(), 2);
+        QCOMPARE(results[1].toMap()["objectName"].toString(), QString("toto"));
+    }
+
+    void test_player_batch_stop_on_error() {
+        QBuffer buffer;
+
+        Player player(&buffer);
+
+        QtJson::JsonObject unknown;
+        unknown["action"] = "unknown";
+        QtJson::JsonObject wrongReference;
+        wrongReference["action"] = "object_properties";
+        wrongReference["oid"] = "$0.oid";
+        QtJson::JsonObject command;
+        command["commands"] = QVariantList() << unknown << wrongReference;
+
+        QVariantList results = player.batch(command)["results"].toList();
+        QCOMPARE(results.count(), 1);
+        QCOMPARE(results[0].toMap()["errName"].toString(),
+                 QString("UnknownAction"));
+
+        command["stop_on_error"] = false;
+        results = player.batch(command)["results"].toList();
+        QCOMPARE(results.count(), 2);
+        QCOMPARE(results[1].toMap()["errName"].toString(),
+                 QString("InvalidReference"));
+    }
+
+    void test_player_registered_command() {
+        QBuffer buffer;
+        Player player(&buffer);
+
+        Funq::registerCommand(
+            "test_double", [](Player *, const QtJson::JsonObject & command) {
+                QtJson::JsonObject result;
+                result["value"] = command["value"].toInt() * 2;
+                return result;
+            });
+        QtJson::JsonObject command;
+        command["action"] = "test_double";
+        command["value"] = 21;
+        QCOMPARE(player.callAction(command)["value"].toInt(), 42);
+        QVERIFY(player.list_actions(QtJson::JsonObject())["commands"]
+                    .toStringList()
+                    .contains("test_double(QtJson::JsonObject)"));
+
+        QVERIFY(CommandRegistry::unregisterCommand("test_double"));
+        QCOMPARE(player.callAction(command)["errName"].toString(),
+                 QString("UnknownAction"));
+    }
+
     void test_player_not_registered_object() {
         QMainWindow w;
         QObject o(&w);
@@ -288,12 +545,55 @@ private slots:
         Player player(&buffer);
 
         QtJson::JsonObject command;
+        command["oid"] = 0;
         QtJson::JsonObject result = player.object_properties(command);
 
         QCOMPARE(result["success"].toBool(), false);
         QCOMPARE(result["errName"].toString(), QString("NotRegisteredObject"));
     }
 
+    void test_player_typed_arguments() {
+        QMainWindow w;
+
+        QBuffer buffer;
+
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        QtJson::JsonObject result = player.object_properties(command);
+        QCOMPARE(result["errName"].toString(), QString("MissingArgument"));
+
+        command["oid"] = "not an oid";
+        result = player.object_properties(command);
+        QCOMPARE(result["errName"].toString(), QString("InvalidArgument"));
+
+        // integers are not truncated, like the client checks
+        command["oid"] = player.registerObject(&w);
+        command["x"] = 2.5;
+        result = player.widget_move(command);
+        QCOMPARE(result["errName"].toString(), QString("InvalidArgument"));
+        command["x"] = 2.0;
+        result = player.widget_move(command);
+        QCOMPARE(result["x"].toInt(), 2);
+
+        // null optional arguments are ignored
+        command["oid"] = player.registerObject(&w);
+        command["x"] = QVariant();
+        command["y"] = 12;
+        result = player.widget_move(command);
+        QCOMPARE(result["x"].toInt(), w.x());
+        QCOMPARE(result["y"].toInt(), 12);
+
+        QtJson::JsonObject schemas =
+            player.list_actions(QtJson::JsonObject())["schemas"].toMap();
+        QVariantList fields = schemas["widget_click"].toList();
+        QCOMPARE(fields.count(), 2);
+        QCOMPARE(fields[0].toMap()["name"].toString(), QString("oid"));
+        QCOMPARE(fields[0].toMap()["type"].toString(), QString("oid"));
+        QCOMPARE(fields[0].toMap()["required"].toBool(), true);
+        QCOMPARE(fields[1].toMap()["default"].toString(), QString("click"));
+    }
+
     void test_player_deleted_object() {
         QMainWindow w;
         QObject * o = new QObject(&w);
@@ -317,6 +617,166 @@ private slots:
         QCOMPARE(result["errName"].toString(), QString("NotRegisteredObject"));
     }
 
+    void test_handle_table() {
+        HandleTable table;
+        QObject * first = new QObject;
+        qulonglong handle = table.insert(first);
+        QVERIFY(handle != 0);
+        QVERIFY(handle < (Q_UINT64_C(1) << 53));
+        QCOMPARE(table.insert(first), handle);
+        QCOMPARE(table.find(handle), first);
+
+        // lookups of unknown handles do not insert anything
+        HandleTable::Status status;
+        QCOMPARE(table.find(handle + 1, &status), (QObject *)0);
+        QCOMPARE(status, HandleTable::Unknown);
+        QCOMPARE(table.find(0, &status), (QObject *)0);
+        QCOMPARE(table.count(), 1);
+
+        delete first;
+        QCOMPARE(table.find(handle, &status), (QObject *)0);
+        QCOMPARE(status, HandleTable::Destroyed);
+
+        // the slot of the destroyed object is reused with a new generation
+        QList<QObject *> objects;
+        for (int i = 0; i < 100; ++i) {
+            objects << new QObject;
+            QVERIFY(table.insert(objects.last()) != handle);
+        }
+        QCOMPARE(table.find(handle, &status), (QObject *)0);
+        QCOMPARE(status, HandleTable::Stale);
+        QCOMPARE(table.count(), 100);
+        qDeleteAll(objects);
+    }
+
+    void test_handle_table_release() {
+        HandleTable table;
+        QObject a, b, c;
+        qulonglong ha = table.insert(&a);
+        QVERIFY(table.release(ha));
+        QVERIFY(!table.release(ha));
+        HandleTable::Status status;
+        QCOMPARE(table.find(ha, &status), (QObject *)0);
+        QCOMPARE(status, HandleTable::Stale);
+
+        // handles inserted in a scope are released when it is closed
+        ha = table.insert(&a);
+        quint32 scope = table.openScope();
+        qulonglong hb = table.insert(&b);
+        QCOMPARE(table.insert(&a), ha);  // already outside the scope
+        QCOMPARE(table.closeScope(scope), 1);
+        QCOMPARE(table.closeScope(scope), -1);
+        QCOMPARE(table.find(ha), &a);
+        QCOMPARE(table.find(hb), (QObject *)0);
+
+        // the least recently used handle is evicted above the cap
+        table.setMaxHandles(2);
+        hb = table.insert(&b);
+        table.find(ha);
+        qulonglong hc = table.insert(&c);
+        QCOMPARE(table.find(ha), &a);
+        QCOMPARE(table.find(hb), (QObject *)0);
+        QCOMPARE(table.find(hc), &c);
+
+        HandleTable::Stats stats = table.stats();
+        QCOMPARE(stats.count, 2);
+        QCOMPARE(stats.released, Q_UINT64_C(2));
+        QCOMPARE(stats.evicted, Q_UINT64_C(1));
+        table.releaseAll();
+        QCOMPARE(table.count(), 0);
+    }
+
+    void test_player_release() {
+        QWidget w;
+        QWidget * child = new QWidget(&w);
+        QBuffer buffer;
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        QtJson::JsonObject result = player.scope_begin(command);
+        command["scope"] = result["scope"];
+        qulonglong id = player.registerObject(child);
+        player.registerObject(&w);
+        QCOMPARE(player.registry_stats(command)["count"].toInt(), 2);
+        result = player.scope_end(command);
+        QCOMPARE(result["released"].toInt(), 2);
+        QVERIFY(!player.registeredObject(id));
+        QCOMPARE(player.scope_end(command)["errName"].toString(),
+                 QString("UnknownScope"));
+
+        qulonglong parentId = player.registerObject(&w);
+        command.clear();
+        command["oid"] = parentId;
+        QCOMPARE(player.release(command)["released"].toInt(), 1);
+        command["oid"] = 0;
+        QtJson::JsonArray oids;
+        oids << parentId;
+        command["oids"] = oids;
+        QCOMPARE(player.release(command)["released"].toInt(), 0);
+
+        command.clear();
+        command["oid"] = parentId;
+        result = player.object_properties(command);
+        QCOMPARE(result["errName"].toString(),
+                 QString("NotRegisteredObject"));
+        result = player.registry_stats(command);
+        QCOMPARE(result["count"].toInt(), 0);
+        QCOMPARE(result["released"].toInt(), 3);
+    }
+
+    void test_player_find_objects() {
+        QWidget dialog;
+        dialog.setObjectName("findDialog");
+        QPushButton apply("Apply", &dialog);
+        QPushButton cancel("Cancel", &dialog);
+        QPushButton hidden("Apply", &dialog);
+        hidden.setObjectName("hiddenApply");
+        hidden.hide();
+        QPushButton outside("Apply");
+        dialog.show();
+        outside.show();
+
+        QBuffer buffer;
+        Player player(&buffer);
+        QtJson::JsonObject command;
+        command["selector"] =
+            "QWidget#findDialog QPushButton[text=Apply]:visible";
+        QtJson::JsonArray objects =
+            player.find_objects(command)["objects"].toList();
+        QCOMPARE(objects.count(), 1);
+        QtJson::JsonObject found = objects[0].toMap();
+        QCOMPARE(player.registeredObject(found["oid"].value<qulonglong>()),
+                 (QObject *)&apply);
+        QVERIFY(found["classes"].toStringList().contains("QAbstractButton"));
+
+        // objects created after the first query are indexed too
+        QPushButton * later = new QPushButton(&dialog);
+        later->setObjectName("later");
+        command["selector"] = "QAbstractButton#lat?r";
+        QCOMPARE(player.find_objects(command)["objects"].toList().count(), 1);
+        later->setObjectName("renamed");
+        command["selector"] = "#renamed";
+        QCOMPARE(player.find_objects(command)["objects"].toList().count(), 1);
+        delete later;
+        QCOMPARE(player.find_objects(command)["objects"].toList().count(), 0);
+
+        command["selector"] = "QPushButton[text='Apply']";
+        command["oid"] = player.registerObject(&dialog);
+        command["limit"] = 5;
+        QCOMPARE(player.find_objects(command)["objects"].toList().count(), 2);
+        // matches come in tree order, so limit keeps the first child
+        command["limit"] = 1;
+        objects = player.find_objects(command)["objects"].toList();
+        QCOMPARE(objects.count(), 1);
+        QCOMPARE(player.registeredObject(
+                     objects[0].toMap()["oid"].value<qulonglong>()),
+                 (QObject *)&apply);
+
+        command["selector"] = "QPushButton[text";
+        QCOMPARE(player.find_objects(command)["errName"].toString(),
+                 QString("InvalidSelector"));
+    }
+
     void test_player_active_widget() {
         QMainWindow w;
 
@@ -372,11 +832,15 @@ private slots:
         QWidget w(&mw);
 
         QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
 
         Player player(&buffer);
 
         QtJson::JsonObject command;
-        QtJson::JsonObject result = player.widgets_list(command);
+        // one widget by slice
+        command["time_slice"] = 0;
+        QtJson::JsonObject result =
+            runDelayedResponse(player.widgets_list(command), &buffer).last();
 
         QtJson::JsonObject mwResult = result["QMainWindow"].toMap();
         QtJson::JsonObject childrenResult = mwResult["children"].toMap();
@@ -395,6 +859,7 @@ private slots:
         QWidget w(&mw);
 
         QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
 
         Player player(&buffer);
 
@@ -405,7 +870,8 @@ private slots:
 
         QtJson::JsonObject command;
         command["oid"] = resultPath["oid"];
-        QtJson::JsonObject result = player.widgets_list(command);
+        QtJson::JsonObject result =
+            runDelayedResponse(player.widgets_list(command), &buffer).last();
 
         QtJson::JsonObject wResult = result["QWidget"].toMap();
         QVERIFY(wResult["children"].toMap().isEmpty());
@@ -414,6 +880,169 @@ private slots:
                                << "QObject");
     }
 
+    void test_player_widgets_list_paths() {
+        QWidget root;
+        root.setObjectName("pathsRoot");
+        QObject other(&root);
+        other.setObjectName("item");
+        QWidget first(&root);
+        first.setObjectName("item");
+        QWidget second(&root);
+        second.setObjectName("item");
+        QLineEdit edit(&second);
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["oid"] = player.registerObject(&root);
+        QtJson::JsonObject result =
+            runDelayedResponse(player.widgets_list(command), &buffer).last();
+
+        // same paths as computed from the root for each widget
+        QtJson::JsonObject secondResult = result["item-2"].toMap();
+        QCOMPARE(result["item-1"].toMap()["path"].toString(),
+                 ObjectPath::objectPath(&first));
+        QCOMPARE(secondResult["path"].toString(),
+                 ObjectPath::objectPath(&second));
+        QCOMPARE(
+            secondResult["children"].toMap()["QLineEdit"].toMap()["path"],
+            QVariant(ObjectPath::objectPath(&edit)));
+    }
+
+    void test_player_widgets_list_projection() {
+        QWidget root;
+        QPushButton button("ok", &root);
+        QWidget panel(&root);
+        QLineEdit edit(&panel);
+        QWidget hiddenPanel(&root);
+        QPushButton inner(&hiddenPanel);
+        hiddenPanel.hide();
+        root.show();
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["oid"] = player.registerObject(&root);
+        command["visible_only"] = true;
+        command["max_depth"] = 1;
+        QtJson::JsonObject result =
+            runDelayedResponse(player.widgets_list(command), &buffer).last();
+        QVERIFY(result.contains("QPushButton"));
+        QVERIFY(!result.contains("QWidget-1"));
+        QVERIFY(result["QWidget"].toMap()["children"].toMap().isEmpty());
+
+        command.remove("visible_only");
+        command.remove("max_depth");
+        command["classes"] = QtJson::JsonArray() << "QAbstractButton";
+        command["class_table"] = true;
+        command["properties"] = QtJson::JsonArray() << "text";
+        result =
+            runDelayedResponse(player.widgets_list(command), &buffer).last();
+        QtJson::JsonObject buttonResult = result["QPushButton"].toMap();
+        QVERIFY(!buttonResult.contains("classes"));
+        QtJson::JsonObject properties = buttonResult["properties"].toMap();
+        QCOMPARE(properties.keys(), QStringList() << "text");
+        QCOMPARE(properties["text"].toString(), QString("ok"));
+        QtJson::JsonArray classTable = result["_class_table"].toList();
+        QCOMPARE(classTable.count(), 1);
+        QCOMPARE(classTable[buttonResult["class"].toInt()]
+                     .toStringList()
+                     .first(),
+                 QString("QPushButton"));
+        // containers are only kept with the matching widgets they contain
+        QVERIFY(!result.contains("QWidget"));
+        QtJson::JsonObject container = result["QWidget-1"].toMap();
+        QVERIFY(!container.contains("class"));
+        QVERIFY(container["children"].toMap().contains("QPushButton"));
+    }
+
+    void test_player_tree_hash() {
+        QWidget root;
+        QWidget left(&root);
+        QPushButton button("before", &left);
+        QWidget right(&root);
+        QLineEdit edit(&right);
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["oid"] = player.registerObject(&root);
+        command["properties"] = QtJson::JsonArray() << "text";
+        QtJson::JsonObject first =
+            runDelayedResponse(player.tree_hash(command), &buffer).last();
+        QVERIFY(!first["hash"].toString().isEmpty());
+        QtJson::JsonObject children = first["children"].toMap();
+        QCOMPARE(children.keys(), QStringList() << "QWidget"
+                                                << "QWidget-1");
+        QVERIFY(!children["QWidget"].toMap().contains("path"));
+
+        button.setText("after");
+        QtJson::JsonObject second =
+            runDelayedResponse(player.tree_hash(command), &buffer).last();
+        QtJson::JsonObject secondChildren = second["children"].toMap();
+        QVERIFY(second["hash"] != first["hash"]);
+        QVERIFY(secondChildren["QWidget"].toMap()["hash"] !=
+                children["QWidget"].toMap()["hash"]);
+        QCOMPARE(secondChildren["QWidget-1"].toMap()["hash"],
+                 children["QWidget-1"].toMap()["hash"]);
+
+        // widgets_list gives the same hashes
+        command["hashes"] = true;
+        QtJson::JsonObject dump =
+            runDelayedResponse(player.widgets_list(command), &buffer).last();
+        QCOMPARE(dump["QWidget"].toMap()["hash"],
+                 secondChildren["QWidget"].toMap()["hash"]);
+        QCOMPARE(dump["QWidget"].toMap()["properties"].toMap()["text"],
+                 QVariant());
+    }
+
+    void test_player_subscribe_tree() {
+        QWidget root;
+        root.setObjectName("root");
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["interval"] = 0;
+        DelayedResponse * subscription = player.subscribe_tree(command);
+        subscription->start();
+        QTRY_COMPARE(readMessages(&buffer).count(), 1);
+        QtJson::JsonObject first = readMessages(&buffer).first();
+        QVERIFY(first["partial"].toBool());
+        QVERIFY(first["changes"].toList().isEmpty());
+
+        QPushButton button(&root);
+        QTRY_COMPARE(readMessages(&buffer).count(), 2);
+        QtJson::JsonObject second = readMessages(&buffer).last();
+        QVERIFY(second["partial"].toBool());
+        QVERIFY(second["seq"].toULongLong() > first["seq"].toULongLong());
+        QStringList paths;
+        foreach (const QVariant & change, second["changes"].toList()) {
+            if (change.toMap()["event"] == "children") {
+                paths << change.toMap()["path"].toString();
+            }
+        }
+        QVERIFY(paths.contains("root"));
+
+        QtJson::JsonObject unsubscribe;
+        unsubscribe["subscription"] = first["subscription"];
+        QVERIFY(!player.unsubscribe_tree(unsubscribe).contains("errName"));
+        QtJson::JsonObject last = readMessages(&buffer).last();
+        QVERIFY(!last.contains("partial"));
+        QVERIFY(last["seq"].toULongLong() >= second["seq"].toULongLong());
+        QCOMPARE(player.unsubscribe_tree(unsubscribe)["errName"].toString(),
+                 QString("UnknownSubscription"));
+        delete subscription;
+    }
+
     void test_player_widget_click() {
         QMainWindow mw;
         QPushButton * btn = new QPushButton("myBtn");
@@ -556,6 +1185,144 @@ private slots:
         }
     }
 
+    void test_delayed_response_waits() {
+        QWidget widget;
+        QTimer trigger;
+        trigger.setSingleShot(true);
+        trigger.setInterval(10);
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        WaitingResponse * dresponse = new WaitingResponse(
+            &player, QtJson::JsonObject(), &trigger, &widget);
+        QList<QtJson::JsonObject> messages =
+            runDelayedResponse(dresponse, &buffer);
+
+        QCOMPARE(dresponse->steps, QStringList() << "start"
+                                                 << "signal"
+                                                 << "event"
+                                                 << "idle");
+        QCOMPARE(messages.count(), 1);
+        QVERIFY(!messages[0].contains("errName"));
+    }
+
+#ifdef FUNQ_COROUTINES
+    void test_async_response() {
+        QWidget widget;
+        QTimer trigger;
+        trigger.setSingleShot(true);
+        trigger.setInterval(10);
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QList<QtJson::JsonObject> messages = runDelayedResponse(
+            new AsyncResponse(&player, QtJson::JsonObject(),
+                              awaitSteps(&trigger, &widget)),
+            &buffer);
+
+        QCOMPARE(messages.count(), 1);
+        QCOMPARE(messages[0]["steps"].toStringList(), QStringList()
+                                                          << "signal"
+                                                          << "idle"
+                                                          << "delay"
+                                                          << "frame");
+    }
+#endif
+
+    void test_delayed_response_command_timeout() {
+        QWidget widget;
+        QTimer trigger;
+        trigger.setInterval(60000);
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["timeout"] = 0.05;
+        QElapsedTimer elapsed;
+        elapsed.start();
+        QList<QtJson::JsonObject> messages = runDelayedResponse(
+            new WaitingResponse(&player, command, &trigger, &widget), &buffer);
+
+        QCOMPARE(messages.count(), 1);
+        QCOMPARE(messages[0]["errName"].toString(),
+                 QString("DelayedResponseTimeOut"));
+        QVERIFY(elapsed.elapsed() < 10000);
+    }
+
+    void test_delayed_response_invalid_timeout() {
+        QWidget widget;
+        QTimer trigger;
+
+        QList<QVariant> timeouts;
+        timeouts << QVariant("soon") << QVariant(-1);
+        foreach (const QVariant & timeout, timeouts) {
+            QBuffer buffer;
+            QVERIFY(buffer.open(QIODevice::ReadWrite));
+            Player player(&buffer);
+
+            QtJson::JsonObject command;
+            command["timeout"] = timeout;
+            // answered from the constructor
+            DelayedResponse * dresponse =
+                new WaitingResponse(&player, command, &trigger, &widget);
+            dresponse->start();
+            QList<QtJson::JsonObject> messages = readMessages(&buffer);
+
+            QCOMPARE(messages.count(), 1);
+            QCOMPARE(messages[0]["errName"].toString(),
+                     QString("InvalidArgument"));
+        }
+    }
+
+    void test_player_negotiate_binary_framing() {
+        QMainWindow mw;
+        mw.resize(20, 20);
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["framing"] = "binary";
+        QtJson::JsonObject result = player.negotiate(command);
+        QCOMPARE(result["framing"].toString(), QString("binary"));
+        // the switch happens once the answer is sent
+        QCOMPARE(player.protocole()->framing(), Protocole::TextFraming);
+
+        player.protocole()->setFraming(Protocole::BinaryFraming);
+        QtJson::JsonObject commandGrab;
+        commandGrab["oid"] = player.registerObject(&mw);
+        result = player.grab(commandGrab);
+        QVERIFY(!result.contains("data"));
+        QCOMPARE(result["data_attachment"].toInt(), 0);
+    }
+
+    void test_player_negotiate_compression() {
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["compression"] = "zlib";
+        QtJson::JsonObject result = player.negotiate(command);
+        QCOMPARE(result["error"].toString(),
+                 QString("CompressionRequiresBinaryFraming"));
+
+        command["framing"] = "binary";
+        command["compression_threshold"] = 100;
+        result = player.negotiate(command);
+        QCOMPARE(result["compression"].toString(), QString("zlib"));
+        QCOMPARE(result["compression_threshold"].toInt(), 100);
+        QCOMPARE(player.protocole()->compression(),
+                 Protocole::ZlibCompression);
+    }
+
     void test_player_tabbar_list() {
         QMainWindow mw;
         QTabBar tb(&mw);
@@ -739,6 +1506,7 @@ private slots:
         view.setModel(&model);
 
         QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
         Player player(&buffer);
 
         QtJson::JsonObject commandPath;
@@ -752,16 +1520,205 @@ private slots:
         QtJson::JsonObject command;
         command["oid"] = resultModel["oid"];
 
-        QtJson::JsonObject result = player.model_items(command);
+        QList<QtJson::JsonObject> messages =
+            runDelayedResponse(player.model_items(command), &buffer);
+        QCOMPARE(messages.count(), 1);
 
-        QList<QVariant> items = result["items"].toList();
+        QList<QVariant> items = messages.last()["items"].toList();
 
         QCOMPARE(items.count(), 4 * 4);
     }
 
+    void test_player_model_items_chunked() {
+        QStandardItemModel model(5, 2);
+        for (int row = 0; row < 5; ++row) {
+            for (int column = 0; column < 2; ++column) {
+                model.setItem(row, column, new QStandardItem("item"));
+            }
+        }
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["oid"] = player.registerObject(&model);
+        command["chunk_size"] = 2;
+
+        QList<QtJson::JsonObject> messages =
+            runDelayedResponse(player.model_items(command), &buffer);
+        // two chunks of two rows, then the last row
+        QCOMPARE(messages.count(), 3);
+        QVERIFY(messages[0]["partial"].toBool());
+        QCOMPARE(messages[0]["items"].toList().count(), 2 * 2);
+        QVERIFY(messages[1]["partial"].toBool());
+        QVERIFY(!messages[2].contains("partial"));
+        QCOMPARE(messages[2]["items"].toList().count(), 2);
+    }
+
+    void test_player_call_delayed_action() {
+        QStandardItemModel model(5, 2);
+        for (int row = 0; row < 5; ++row) {
+            for (int column = 0; column < 2; ++column) {
+                model.setItem(row, column, new QStandardItem("item"));
+            }
+        }
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        // time sliced responses run to completion, chunks merged
+        QtJson::JsonObject command;
+        command["action"] = "model_items";
+        command["oid"] = player.registerObject(&model);
+        command["chunk_size"] = 2;
+        QtJson::JsonObject result = player.callAction(command);
+        QCOMPARE(result["items"].toList().count(), 5 * 2);
+        QVERIFY(!result.contains("partial"));
+        QVERIFY(readMessages(&buffer).isEmpty());
+
+        // responses waiting for the event loop are refused
+        command = QtJson::JsonObject();
+        command["action"] = "wait_for_object";
+        command["path"] = "nowhere";
+        QCOMPARE(player.callAction(command)["errName"].toString(),
+                 QString("DelayedAction"));
+        QVERIFY(readMessages(&buffer).isEmpty());
+    }
+
+    void test_player_model_items_tree_time_sliced() {
+        QStandardItemModel model;
+        for (int row = 0; row < 2; ++row) {
+            QList<QStandardItem *> items;
+            items << new QStandardItem(QString("top %1").arg(row))
+                  << new QStandardItem("value");
+            if (row == 0) {
+                for (int child = 0; child < 2; ++child) {
+                    items[0]->appendRow(QList<QStandardItem *>()
+                                        << new QStandardItem("child")
+                                        << new QStandardItem("value"));
+                }
+            }
+            model.appendRow(items);
+        }
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        QtJson::JsonObject command;
+        command["oid"] = player.registerObject(&model);
+        // one item by slice
+        command["time_slice"] = 0;
+
+        QList<QtJson::JsonObject> messages =
+            runDelayedResponse(player.model_items(command), &buffer);
+        QCOMPARE(messages.count(), 1);
+        QVariantList items = messages[0]["items"].toList();
+        QCOMPARE(items.count(), 2 * 2);
+        QCOMPARE(items[0].toMap()["value"].toString(), QString("top 0"));
+        QCOMPARE(items[1].toMap()["column"].toInt(), 1);
+        QCOMPARE(items[2].toMap()["value"].toString(), QString("top 1"));
+        QVERIFY(!items[2].toMap().contains("items"));
+        QVariantList children = items[0].toMap()["items"].toList();
+        QCOMPARE(children.count(), 2 * 2);
+        QCOMPARE(children[2].toMap()["itempath"].toString(), QString("0-0"));
+        QCOMPARE(children[2].toMap()["row"].toInt(), 1);
+    }
+
+    void test_time_slice_argument() {
+        QStandardItemModel model(1, 1);
+
+        QBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        Player player(&buffer);
+
+        // answered from the constructor
+        QtJson::JsonObject command;
+        command["oid"] = player.registerObject(&model);
+        command["time_slice"] = "abc";
+        DelayedResponse * response = player.model_items(command);
+        QList<QtJson::JsonObject> messages = readMessages(&buffer);
+        QCOMPARE(messages.count(), 1);
+        QCOMPARE(messages[0]["errName"].toString(), QString("InvalidArgument"));
+        delete response;
+
+        QtJson::JsonObject schemas =
+            player.list_actions(QtJson::JsonObject())["schemas"].toMap();
+        foreach (const QString & action,
+                 QStringList() << "widgets_list" << "model_items") {
+            bool found = false;
+            foreach (const QVariant & field, schemas[action].toList()) {
+                found |= field.toMap()["name"].toString() ==
+                         QLatin1String("time_slice");
+            }
+            QVERIFY(found);
+        }
+    }
+
 #if QT_VERSION < 0x050000
     /* TODO: this test crash on ubuntu Using Qt version 5.2.1 in
      * /usr/lib/x86_64-linux-gnu */
+    void test_player_eval_script() {
+        QMainWindow mw;
+        QTableView view(&mw);
+        QStandardItemModel model(3, 3);
+        for (int row = 0; row < 3; ++row) {
+            QStandardItem * item =
+                new QStandardItem(QString("row %0").arg(row));
+            item->setCheckable(true);
+            item->setCheckState(row == 1 ? Qt::Checked : Qt::Unchecked);
+            model.setItem(row, 2, item);
+        }
+        view.setModel(&model);
+
+        QBuffer buffer;
+        Player player(&buffer);
+
+        QtJson::JsonObject args;
+        args["path"] = "QMainWindow::QTableView";
+        args["text"] = "row 1";
+        QtJson::JsonObject command;
+        command["script"] =
+            "var oid = funq.find(args.path);\n"
+            "for (var row = 0; row < funq.rowCount(oid); ++row) {\n"
+            "    if (funq.data(oid, row, 2) == args.text) {\n"
+            "        return funq.data(oid, row, 2, 'checkState');\n"
+            "    }\n"
+            "}\n";
+        command["args"] = args;
+        QtJson::JsonObject result = player.eval_script(command);
+#ifdef QT_QML_LIB
+        QCOMPARE(result["result"].toInt(), int(Qt::Checked));
+
+        command["script"] = "return unknown_function();";
+        result = player.eval_script(command);
+        QCOMPARE(result["errName"].toString(), QString("ScriptError"));
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        command["script"] = "while (true) {}";
+        command["timeout"] = 0.1;
+        result = player.eval_script(command);
+        QCOMPARE(result["errName"].toString(), QString("ScriptTimeout"));
+
+        // the engine is usable again
+        command["script"] = "return 1 + 1;";
+        result = player.eval_script(command);
+        QCOMPARE(result["result"].toInt(), 2);
+#endif
+        command["timeout"] = -1;
+        result = player.eval_script(command);
+        QCOMPARE(result["errName"].toString(), QString("InvalidArgument"));
+
+        command.remove("script");
+        command.remove("timeout");
+        result = player.eval_script(command);
+        QCOMPARE(result["errName"].toString(), QString("MissingArgument"));
+#else
+        QCOMPARE(result["errName"].toString(), QString("QtQmlOnly"));
+#endif
+    }
+
     void test_drag_ndrop() {
         TestDragNDropWidget dndwidget;
 
@@ -33,12 +33,20 @@ knowledge of the CeCILL v2.1 license and that you accept its terms.
 */
 
 #include "delayedresponse.h"
+#include "jsonchannel.h"
 #include "jsonclient.h"
+#include "networkserver.h"
 #include "protocole.h"
 
 #include <QBuffer>
+#include <QEventLoop>
+#include <QFile>
+#include <QLocalSocket>
 #include <QObject>
 #include <QSignalSpy>
+#include <QThread>
+#include <QTimer>
+#include <QtEndian>
 #include <QtTest/QtTest>
 /*
  * QBuffer by default does not emit readyRead and bytesWritten. But we need it
@@ -51,12 +59,28 @@ public:
     void emitBytesWritten(qint64 bytes) { emit bytesWritten(bytes); }
 };
 
+QByteArray textFrame(const QByteArray & message) {
+    return QByteArray::number(message.size()) + '\n' + message;
+}
+
+QList<QtJson::JsonObject> readTextFrames(QIODevice * device) {
+    QList<QtJson::JsonObject> messages;
+    while (device->canReadLine()) {
+        qint64 size = device->readLine().trimmed().toLongLong();
+        QByteArray message = device->read(size);
+        messages << QtJson::parse(QString::fromUtf8(message)).toMap();
+    }
+    return messages;
+}
+
 class TestJsonClient : public JsonClient {
     Q_OBJECT
 
 public:
     TestJsonClient(QIODevice * device, QObject * parent = 0)
-        : JsonClient(device, parent) {}
+        : JsonClient(device, parent), m_nestedLoop(0) {}
+    TestJsonClient(JsonChannel * channel, QObject * parent = 0)
+        : JsonClient(channel, parent), m_nestedLoop(0) {}
 
 public slots:
     QtJson::JsonObject test_echo(const QtJson::JsonObject & command) {
@@ -64,6 +88,28 @@ public slots:
         result["value"] = 2;
         return result;
     }
+
+    // runs an event loop, like a modal dialog, until test_quit_loop
+    QtJson::JsonObject test_nested_loop(const QtJson::JsonObject &) {
+        QEventLoop loop;
+        m_nestedLoop = &loop;
+        QTimer::singleShot(5000, &loop, SLOT(quit()));
+        loop.exec();
+        m_nestedLoop = 0;
+        return QtJson::JsonObject();
+    }
+
+    QtJson::JsonObject test_quit_loop(const QtJson::JsonObject &) {
+        QtJson::JsonObject result;
+        result["nested"] = m_nestedLoop != 0;
+        if (m_nestedLoop) {
+            m_nestedLoop->quit();
+        }
+        return result;
+    }
+
+private:
+    QEventLoop * m_nestedLoop;
 };
 
 class TestDelayedResponse : public DelayedResponse {
@@ -153,6 +199,148 @@ private slots:
                  QString("24\n{\"1\": 1, \"2\": 2, \"3\": 3}"));
     }
 
+    void test_protocole_binary_read() {
+        EmittingBuffer buffer;
+        Protocole protocole;
+        protocole.setFraming(Protocole::BinaryFraming);
+        QSignalSpy spy(&protocole, SIGNAL(messageReceived()));
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        // an attachment frame (ignored), then a message frame
+        buffer.write(QByteArray("\x00\x00\x00\x03\x01\x00\x00\x00", 8));
+        buffer.write("abc");
+        buffer.write(QByteArray("\x00\x00\x00\x08\x00\x00\x00\x00", 8));
+        buffer.write("{\"1\": 2}");
+        buffer.seek(0);
+        protocole.setDevice(&buffer);
+        buffer.emitReadyRead();
+
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(QString(protocole.nextAvailableMessage()),
+                 QString("{\"1\": 2}"));
+    }
+
+    void test_protocole_binary_write_attachments() {
+        EmittingBuffer buffer;
+        Protocole protocole;
+        protocole.setFraming(Protocole::BinaryFraming);
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        protocole.setDevice(&buffer);
+        protocole.sendMessage("{}", QList<QByteArray>() << "raw");
+        buffer.seek(0);
+        QCOMPARE(buffer.readAll(),
+                 QByteArray("\x00\x00\x00\x03\x01\x00\x00\x00"
+                            "raw"
+                            "\x00\x00\x00\x02\x00\x00\x00\x00"
+                            "{}",
+                            21));
+    }
+
+    void test_protocole_framing_after_next_message() {
+        EmittingBuffer buffer;
+        Protocole protocole;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        protocole.setDevice(&buffer);
+        protocole.setFramingAfterNextMessage(Protocole::BinaryFraming);
+        QCOMPARE(protocole.framing(), Protocole::TextFraming);
+        protocole.sendMessage("{}");
+        QCOMPARE(protocole.framing(), Protocole::BinaryFraming);
+        buffer.seek(0);
+        QCOMPARE(buffer.readAll(), QByteArray("2\n{}"));
+    }
+
+    void test_protocole_compressed_round_trip() {
+        EmittingBuffer buffer;
+        Protocole protocole;
+        protocole.setFraming(Protocole::BinaryFraming);
+        protocole.setCompression(Protocole::ZlibCompression, 10);
+        QSignalSpy spy(&protocole, SIGNAL(messageReceived()));
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        protocole.setDevice(&buffer);
+        QByteArray message = "{\"data\": \"" + QByteArray(1000, 'a') + "\"}";
+        protocole.sendMessage("{}");  // below the threshold
+        protocole.sendMessage(message);
+
+        buffer.seek(0);
+        QByteArray written = buffer.readAll();
+        QCOMPARE(written.left(Protocole::BinaryHeaderSize + 2),
+                 QByteArray("\x00\x00\x00\x02\x00\x00\x00\x00{}", 10));
+        QCOMPARE(written.at(Protocole::BinaryHeaderSize + 2 + 5),
+                 char(Protocole::CompressedFlag));
+        QVERIFY(written.size() < message.size());
+
+        buffer.seek(0);
+        buffer.emitReadyRead();
+        QCOMPARE(spy.count(), 2);
+        QCOMPARE(protocole.nextAvailableMessage(), QByteArray("{}"));
+        QCOMPARE(protocole.nextAvailableMessage(), message);
+    }
+
+    void test_protocole_compressed_frame_over_max_size() {
+        EmittingBuffer buffer;
+        Protocole protocole;
+        protocole.setFraming(Protocole::BinaryFraming);
+        protocole.setMaxFrameSize(100);
+        QSignalSpy spy(&protocole, SIGNAL(messageReceived()));
+        QSignalSpy tooLargeSpy(&protocole, SIGNAL(frameTooLarge(qint64)));
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        // the announced uncompressed size lies
+        QByteArray compressed = qCompress(QByteArray(100000, 'a'));
+        compressed.replace(0, 4, QByteArray("\x00\x00\x00\x0a", 4));
+        QByteArray header(Protocole::BinaryHeaderSize, '\0');
+        qToBigEndian<quint32>(quint32(compressed.size()),
+                              reinterpret_cast<uchar *>(header.data()));
+        header[5] = char(Protocole::CompressedFlag);
+        buffer.write(header + compressed);
+        buffer.write(QByteArray("\x00\x00\x00\x02\x00\x00\x00\x00{}", 10));
+        buffer.seek(0);
+        protocole.setDevice(&buffer);
+        buffer.emitReadyRead();
+
+        QCOMPARE(tooLargeSpy.count(), 1);
+        QVERIFY(tooLargeSpy.first().first().toLongLong() > 100);
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(protocole.nextAvailableMessage(), QByteArray("{}"));
+    }
+
+    void test_protocole_skip_oversized_frame() {
+        EmittingBuffer buffer;
+        Protocole protocole;
+        protocole.setMaxFrameSize(10);
+        QSignalSpy spy(&protocole, SIGNAL(messageReceived()));
+        QSignalSpy tooLargeSpy(&protocole, SIGNAL(frameTooLarge(qint64)));
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        buffer.write(textFrame(QByteArray(20, 'a')) + textFrame("{}"));
+        buffer.seek(0);
+        protocole.setDevice(&buffer);
+        buffer.emitReadyRead();
+
+        QCOMPARE(tooLargeSpy.count(), 1);
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(protocole.nextAvailableMessage(), QByteArray("{}"));
+        QCOMPARE(protocole.stats().receivedFrames, qint64(2));
+        QCOMPARE(protocole.stats().oversizedFrames, qint64(1));
+    }
+
+    void test_protocole_pause_reading_when_queue_is_full() {
+        EmittingBuffer buffer;
+        Protocole protocole;
+        protocole.setMaxQueuedBytes(2);
+        QSignalSpy spy(&protocole, SIGNAL(messageReceived()));
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        buffer.write(textFrame("{}") + textFrame("[]"));
+        buffer.seek(0);
+        protocole.setDevice(&buffer);
+        buffer.emitReadyRead();
+
+        // the second message is not read until the first one is taken
+        QCOMPARE(spy.count(), 1);
+        QCOMPARE(protocole.stats().readPauses, qint64(1));
+        QCOMPARE(protocole.nextAvailableMessage(), QByteArray("{}"));
+        qApp->processEvents();
+        QCOMPARE(spy.count(), 2);
+        QCOMPARE(protocole.nextAvailableMessage(), QByteArray("[]"));
+    }
+
     /* jsonclient tests */
     void test_jsonclient_response() {
         EmittingBuffer buffer;
@@ -173,6 +361,134 @@ private slots:
                  QString("39\n{ \"action\" : \"test_echo\", \"value\" : 2 }"));
     }
 
+    void test_jsonclient_pipelined_responses() {
+        EmittingBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        TestJsonClient client(&buffer);
+        QByteArray input =
+            textFrame("{\"action\": \"test_echo\", \"order\": 1}") +
+            textFrame("{\"action\": \"unknown\", \"id\": 7}") +
+            textFrame("{\"action\": \"test_echo\", \"order\": 2}");
+        buffer.write(input);
+        buffer.seek(0);
+        buffer.emitReadyRead();
+
+        // responses are written in the order of the requests
+        buffer.seek(input.size());
+        QList<QtJson::JsonObject> responses = readTextFrames(&buffer);
+        QCOMPARE(responses.count(), 3);
+        QCOMPARE(responses[0]["order"].toInt(), 1);
+        QCOMPARE(responses[1]["errName"].toString(), QString("UnknownAction"));
+        QCOMPARE(responses[1]["id"].toInt(), 7);
+        QCOMPARE(responses[2]["order"].toInt(), 2);
+    }
+
+    void test_jsonclient_command_in_nested_loop() {
+        EmittingBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        TestJsonClient client(&buffer);
+        QByteArray input =
+            textFrame("{\"action\": \"test_nested_loop\", \"id\": 1}") +
+            textFrame("{\"action\": \"test_quit_loop\", \"id\": 2}");
+        buffer.write(input);
+        buffer.seek(0);
+        buffer.emitReadyRead();
+
+        // the second command is answered from the loop of the first one
+        buffer.seek(input.size());
+        QList<QtJson::JsonObject> responses = readTextFrames(&buffer);
+        QCOMPARE(responses.count(), 2);
+        QCOMPARE(responses[0]["id"].toInt(), 2);
+        QVERIFY(responses[0]["nested"].toBool());
+        QCOMPARE(responses[1]["id"].toInt(), 1);
+    }
+
+    void test_jsonclient_dispatch_stats() {
+        EmittingBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        TestJsonClient client(&buffer);
+        QByteArray input = textFrame("{\"action\": \"test_echo\"}") +
+                           textFrame("{\"action\": \"unknown\"}") +
+                           textFrame("{\"action\": \"test_echo\"}");
+        buffer.write(input);
+        buffer.seek(0);
+        buffer.emitReadyRead();
+
+        // unknown actions are not recorded
+        QCOMPARE(client.dispatchStats().count(), 1);
+        JsonClient::ActionStats stats = client.dispatchStats()["test_echo"];
+        QCOMPARE(stats.count, qint64(2));
+        QVERIFY(stats.executeNsecs >= stats.maxExecuteNsecs);
+        client.resetDispatchStats();
+        QVERIFY(client.dispatchStats().isEmpty());
+    }
+
+    void test_jsonclient_shared_buffer() {
+        EmittingBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        TestJsonClient client(&buffer);
+        QVERIFY(client.enableSharedBuffer(4096, 100));
+
+        QtJson::JsonObject result;
+        result["text"] = QString(200, 'a');
+        client.writeBinaryData(result, "data", "raw", "RAW");
+        QVERIFY(client.sendResponse(result, 3));
+
+        buffer.seek(0);
+        QList<QtJson::JsonObject> responses = readTextFrames(&buffer);
+        QCOMPARE(responses.count(), 1);
+        QCOMPARE(responses[0]["id"].toInt(), 3);
+        QtJson::JsonObject descriptor = responses[0]["_shm"].toMap();
+        QCOMPARE(descriptor["format"].toString(), QString("JSON"));
+
+        QFile shared(descriptor["name"].toString());
+        QVERIFY(shared.open(QIODevice::ReadOnly));
+        QVERIFY(shared.seek(descriptor["offset"].toLongLong()));
+        QtJson::JsonObject stored =
+            QtJson::parse(QString::fromUtf8(
+                              shared.read(descriptor["size"].toLongLong())))
+                .toMap();
+        QCOMPARE(stored["text"].toString(), QString(200, 'a'));
+        QtJson::JsonObject data = stored["data_shm"].toMap();
+        QCOMPARE(data["format"].toString(), QString("RAW"));
+        QVERIFY(shared.seek(data["offset"].toLongLong()));
+        QCOMPARE(shared.read(data["size"].toLongLong()), QByteArray("raw"));
+    }
+
+    void test_jsonclient_threaded_channel() {
+        QString name =
+            QString("funq-test-%1").arg(QCoreApplication::applicationPid());
+        QThread thread;
+        NetworkServer * server = new NetworkServer(QHostAddress(), 0, name);
+        QSignalSpy spy(server, SIGNAL(newConnection(JsonChannel *)));
+        server->moveToThread(&thread);
+        connect(&thread, SIGNAL(finished()), server, SLOT(deleteLater()));
+        thread.start();
+        QMetaObject::invokeMethod(server, "listen",
+                                  Qt::BlockingQueuedConnection);
+
+        QLocalSocket socket;
+        socket.connectToServer(name);
+        QTRY_COMPARE(spy.count(), 1);
+        JsonChannel * channel = spy.at(0).at(0).value<JsonChannel *>();
+        QVERIFY(channel->thread() == &thread);
+        {
+            // commands are executed in this thread, the channel encodes the
+            // responses in its own thread
+            TestJsonClient client(channel);
+            socket.write(textFrame("{\"action\": \"test_echo\", \"id\": 5}"));
+            QTRY_VERIFY(socket.canReadLine());
+            qint64 size = socket.readLine().trimmed().toLongLong();
+            QTRY_VERIFY(socket.bytesAvailable() >= size);
+            QtJson::JsonObject response =
+                QtJson::parse(QString::fromUtf8(socket.read(size))).toMap();
+            QCOMPARE(response["id"].toInt(), 5);
+            QCOMPARE(response["value"].toInt(), 2);
+        }
+        thread.quit();
+        QVERIFY(thread.wait(5000));
+    }
+
     /* delayedresponse tests */
     void test_delayedresponse_simple() {
         EmittingBuffer buffer;
@@ -247,6 +563,22 @@ private slots:
         QCOMPARE(result["result"].toInt(), 1);
     }
 
+    void test_delayedresponse_echo_id() {
+        EmittingBuffer buffer;
+        QVERIFY(buffer.open(QIODevice::ReadWrite));
+        TestJsonClient client(&buffer);
+        QtJson::JsonObject command;
+        command["id"] = 42;
+        TestDelayedResponse response(&client, command);
+        response.start();
+        qApp->processEvents();
+        buffer.seek(0);
+        QList<QtJson::JsonObject> responses = readTextFrames(&buffer);
+        QCOMPARE(responses.count(), 1);
+        QCOMPARE(responses[0]["id"].toInt(), 42);
+        QCOMPARE(responses[0]["result"].toInt(), 1);
+    }
+
     void test_multi_pass_one_response() {
         EmittingBuffer buffer;
         QVERIFY(buffer.open(QIODevice::ReadWrite));